@@ -47,12 +47,14 @@ SERVALD_LOCAL_CFLAGS = \
         -DHAVE_BCOPY -DHAVE_BZERO -DHAVE_BCMP -DHAVE_NETINET_IN_H -DHAVE_LSEEK64 -DSIZEOF_OFF_T=4 \
 	-DHAVE_STRLCPY=1 \
         -DHAVE_GETTID=1 \
+	-DHAVE_PTHREAD=1 \
+	-DHAVE_ZLIB_H=1 -DHAVE_ZLIB=1 \
         -DHAVE_LINUX_IF_H -DHAVE_SYS_STAT_H -DHAVE_SYS_VFS_H -DHAVE_LINUX_NETLINK_H -DHAVE_LINUX_RTNETLINK_H \
 	-DSQLITE_OMIT_DATETIME_FUNCS -DSQLITE_OMIT_COMPILEOPTION_DIAGS -DSQLITE_OMIT_DEPRECATED \
 	-DSQLITE_OMIT_LOAD_EXTENSION -DSQLITE_OMIT_VIRTUALTABLE -DSQLITE_OMIT_AUTHORIZATION \
 	-I$(SQLITE3_INC)
 
-SERVALD_LOCAL_LDLIBS = -L$(SYSROOT)/usr/lib -llog
+SERVALD_LOCAL_LDLIBS = -L$(SYSROOT)/usr/lib -llog -lz
 SERVALD_LOCAL_STATIC_LIBRARIES += sodium
 
 # Build libservald.so
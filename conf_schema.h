@@ -290,6 +290,8 @@ STRING(256,                 directory_path, "", str,, "Path of directory for log
 STRING(256,                 path,           "", str_nonempty,, "Path of single log file, either absolute or relative to directory_path")
 ATOM(unsigned short,        rotate,         12, ushort,, "Number of log files to rotate, zero means no deletion")
 ATOM(uint32_t,              duration,       3600, uint32_time_interval,, "Time duration of each log file, zero means one file per invocation")
+ATOM(bool_t,                async,          0, boolean,, "If true, log lines are written to the file by a background thread, and dropped if it falls behind")
+ATOM(uint32_t,              async_buffer,   262144, uint32_nonzero,, "Size of the queue of log lines waiting for the background thread, in bytes")
 LOG_FORMAT_OPTIONS
 END_STRUCT
 
@@ -320,11 +322,17 @@ STRING(256,                 executable, "", absolute_path,, "Absolute path of wa
 ATOM(uint32_t,              interval_ms, 60000, uint32_nonzero,, "Time interval between watchdog invocations, in milliseconds")
 END_STRUCT
 
+STRUCT(server_trace)
+ATOM(bool_t,                enable,     0, boolean,, "If true, record the start and end of alarms, packets, SQL statements and payload IO for export as a Chrome trace")
+ATOM(uint32_t,              events,     65536, uint32_nonzero,, "Number of most recent trace events to keep")
+END_STRUCT
+
 STRUCT(server)
 STRING(256,                 chdir,      "/", absolute_path,, "Absolute path of chdir(2) for server process")
 STRING(256,                 interface_path, "", str_nonempty,, "Path of directory containing interface files, either absolute or relative to instance directory")
 ATOM(uint32_t,              config_reload_interval_ms, 1000, uint32_nonzero,, "Time interval between configuration reload polls, in milliseconds")
 SUB_STRUCT(watchdog,        watchdog,)
+SUB_STRUCT(server_trace,    trace,)
 STRING(120,                 motd,      "", str_nonempty,, "Message Of The Day displayed on HTTPD root page")
 END_STRUCT
 
@@ -344,9 +352,28 @@ ATOM(bool_t,                route,           1, boolean,, "If false, do not adve
 ATOM(short,                 encapsulation,   ENCAP_OVERLAY, encapsulation,, "Type of packet encapsulation")
 END_STRUCT
 
+STRUCT(mdp_broadcast)
+ATOM(uint32_t,              cache_size,  1024, uint32_nonzero,, "Number of recently seen broadcast packet identifiers to remember")
+ATOM(uint32_t,              timeout_ms,  60000, uint32_nonzero,, "Time after which a remembered broadcast packet identifier is forgotten, in milliseconds")
+END_STRUCT
+
+STRUCT(mdp_link_state)
+ATOM(uint32_t,              refresh_ms, 30000, uint32_nonzero,, "Interval between advertisements of unchanged link states, in milliseconds")
+ATOM(uint32_t,              retry_ms, 1000, uint32_nonzero,, "Time to wait for every neighbour to acknowledge a link state advertisement before repeating it, in milliseconds")
+END_STRUCT
+
+STRUCT(mdp_multipath)
+ATOM(uint32_t,              paths, 1, uint32_nonzero,, "Maximum number of equally short paths to spread unicast packets across, at most 4")
+ATOM(int32_t,               drop_rate_margin, 0, int32_nonneg,, "How much higher than the best path's drop rate an alternate path's drop rate may be")
+END_STRUCT
+
 STRUCT(mdp)
 ATOM(bool_t,                enable_inet, 0, boolean,, "If true, allow mdp clients to connect over loopback UDP")
 STRING(256,                 filter_rules_path, "", str_nonempty,, "Path of file containing MDP filter rules, either absolute or relative to instance directory")
+ATOM(uint32_t,              nm_cache_size, 512, uint32_nonzero,, "Number of shared secrets to keep for encrypting and decrypting packets between local identities and peers")
+SUB_STRUCT(mdp_broadcast,   broadcast,)
+SUB_STRUCT(mdp_link_state,  link_state,)
+SUB_STRUCT(mdp_multipath,   multipath,)
 END_STRUCT
 
 STRUCT(vomp)
@@ -418,6 +445,11 @@ ATOM(bool_t,                enable,     1, boolean,, "If true, Rhizome advertise
 ATOM(uint32_t,              interval,   500, uint32_nonzero,, "Interval between Rhizome advertisements")
 END_STRUCT
 
+STRUCT(rhizome_verify)
+ATOM(uint32_t,              batch,          64, uint32_nonzero,, "Number of received manifests to collect before checking their signatures together")
+ATOM(uint32_t,              delay_ms,       20, uint32_nonzero,, "Longest time a received manifest waits for its batch to fill, in milliseconds")
+END_STRUCT
+
 STRUCT(rhizome)
 ATOM(bool_t,                enable,         1, boolean,, "If true, server opens Rhizome database when starting")
 ATOM(bool_t,                fetch,          1, boolean,, "If false, no new bundles will be fetched from peers")
@@ -434,6 +466,7 @@ SUB_STRUCT(rhizome_api,     api,)
 SUB_STRUCT(rhizome_http,    http,)
 SUB_STRUCT(rhizome_mdp,     mdp,)
 SUB_STRUCT(rhizome_advertise, advertise,)
+SUB_STRUCT(rhizome_verify,  verify,)
 END_STRUCT
 
 STRUCT(directory)
@@ -492,6 +525,10 @@ STRUCT(api_restful)
 ATOM(enum http_authorization_scheme, authorization, BASIC, http_authorization_scheme,, "The kind of authorization that REST clients must supply")
 SUB_STRUCT(userlist,                 users,)
 ATOM(uint32_t,                       newsince_timeout, 60, uint32_time_interval,, "Time to block while reporting new bundles")
+ATOM(uint32_t,                       flush_size,    8192, uint32_nonzero,, "Most bytes of a list to generate before sending them to the client")
+ATOM(int32_t,                        compress_level, 6, int32_nonneg,, "Compression level (1-9) of text and JSON responses to clients that accept it, 0 for none")
+ATOM(uint32_t,                       compress_min_size, 1024, uint32_scaled,, "Smallest static response to compress")
+ATOM(uint32_t,                       request_memory_limit, 1048576, uint32_scaled,, "Most buffer memory that one request may hold, 0 for no limit")
 END_STRUCT
 
 STRUCT(api)
@@ -0,0 +1,250 @@
+/*
+Serval DNA HTTP RESTful event stream
+Copyright (C) 2016 Flinders University
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "serval.h"
+#include "conf.h"
+#include "httpd.h"
+#include "str.h"
+#include "mem.h"
+#include "strbuf_helpers.h"
+#include "overlay_address.h"
+#include "route_link.h"
+
+/* A single long-lived response that pushes events to the client as Server-Sent Events, instead of
+ * the client polling each newsince list in turn.  Bundle and MeshMS events are passed on from the
+ * bundle_add trigger through the request's watches (see httpd_watch_*()), and peer events from the
+ * link_change trigger to every request on the list of peer listeners.
+ */
+
+DEFINE_FEATURE(http_rest_events);
+
+#define EVENT_BUNDLE (1<<0)
+#define EVENT_MESHMS (1<<1)
+#define EVENT_PEER (1<<2)
+
+// Most bytes of events to hold for a slow client; any more are counted and dropped.
+#define EVENTS_QUEUE_MAX (64 * 1024)
+
+// How often to send a comment line when there are no events, to keep the connection open.
+#define EVENTS_KEEPALIVE_MS 30000
+
+static httpd_request *peer_listeners = NULL;
+
+static void events_queue(httpd_request *r, strbuf event)
+{
+  size_t len = strbuf_len(event);
+  if (strbuf_overrun(event) || r->u.events.queue_length + len > EVENTS_QUEUE_MAX) {
+    ++r->u.events.lost;
+    return;
+  }
+  if (r->u.events.queue_length + len > r->u.events.queue_size) {
+    size_t size = r->u.events.queue_size ? r->u.events.queue_size * 2 : 1024;
+    while (size < r->u.events.queue_length + len)
+      size *= 2;
+    char *queue = erealloc(r->u.events.queue, size);
+    if (queue == NULL) {
+      ++r->u.events.lost;
+      return;
+    }
+    r->u.events.queue = queue;
+    r->u.events.queue_size = size;
+  }
+  memcpy(r->u.events.queue + r->u.events.queue_length, strbuf_str(event), len);
+  r->u.events.queue_length += len;
+  http_request_resume_response(&r->http);
+}
+
+static void events_on_bundle_added(httpd_request *r, rhizome_manifest *m)
+{
+  strbuf b = strbuf_alloca(1024);
+  if (   (r->u.events.types & EVENT_BUNDLE)
+      && (!r->u.events.service || (m->service && strcmp(m->service, r->u.events.service) == 0))
+  ) {
+    strbuf_puts(b, "event: bundle\ndata: {\"id\":");
+    strbuf_json_hex(b, m->keypair.public_key.binary, sizeof m->keypair.public_key.binary);
+    strbuf_sprintf(b, ",\"version\":%"PRIu64",\"service\":", m->version);
+    strbuf_json_string(b, m->service);
+    strbuf_puts(b, ",\"sender\":");
+    if (m->has_sender)
+      strbuf_json_hex(b, m->sender.binary, sizeof m->sender.binary);
+    else
+      strbuf_json_null(b);
+    strbuf_puts(b, ",\"recipient\":");
+    if (m->has_recipient)
+      strbuf_json_hex(b, m->recipient.binary, sizeof m->recipient.binary);
+    else
+      strbuf_json_null(b);
+    strbuf_sprintf(b, ",\"filesize\":%"PRIu64",\"name\":", m->filesize);
+    strbuf_json_string(b, m->name);
+    strbuf_puts(b, "}\n\n");
+    events_queue(r, b);
+  }
+  if (   (r->u.events.types & EVENT_MESHMS)
+      && m->service && strcmp(m->service, RHIZOME_SERVICE_MESHMS2) == 0
+      && m->has_sender && m->has_recipient
+      && (!r->u.events.recipient_set || cmp_sid_t(&m->recipient, &r->sid1) == 0)
+  ) {
+    strbuf_reset(b);
+    strbuf_puts(b, "event: meshms\ndata: {\"sender\":");
+    strbuf_json_hex(b, m->sender.binary, sizeof m->sender.binary);
+    strbuf_puts(b, ",\"recipient\":");
+    strbuf_json_hex(b, m->recipient.binary, sizeof m->recipient.binary);
+    strbuf_puts(b, "}\n\n");
+    events_queue(r, b);
+  }
+}
+
+static void events_on_link_change(struct subscriber *subscriber, int prior_reachable)
+{
+  int reachable = (subscriber->reachable & REACHABLE) ? 1 : 0;
+  if (reachable == ((prior_reachable & REACHABLE) ? 1 : 0))
+    return;
+  httpd_request *r;
+  for (r = peer_listeners; r; r = r->u.events.next_peer_listener) {
+    strbuf b = strbuf_alloca(200);
+    strbuf_puts(b, "event: peer\ndata: {\"sid\":");
+    strbuf_json_hex(b, subscriber->sid.binary, sizeof subscriber->sid.binary);
+    strbuf_sprintf(b, ",\"reachable\":%s,\"hop_count\":%d}\n\n", reachable ? "true" : "false", subscriber->hop_count);
+    events_queue(r, b);
+  }
+}
+DEFINE_TRIGGER(link_change, events_on_link_change);
+
+static void finalise_union_events(httpd_request *r)
+{
+  if (r->u.events.types & EVENT_PEER) {
+    if (r->u.events.next_peer_listener)
+      r->u.events.next_peer_listener->u.events.prev_peer_listener = r->u.events.prev_peer_listener;
+    if (r->u.events.prev_peer_listener)
+      r->u.events.prev_peer_listener->u.events.next_peer_listener = r->u.events.next_peer_listener;
+    else {
+      assert(peer_listeners == r);
+      peer_listeners = r->u.events.next_peer_listener;
+    }
+  }
+  free(r->u.events.service);
+  free(r->u.events.queue);
+  r->u.events.service = NULL;
+  r->u.events.queue = NULL;
+}
+
+static int restful_events_content(struct http_request *hr, unsigned char *buf, size_t bufsz, struct http_content_generator_result *result)
+{
+  httpd_request *r = (httpd_request *) hr;
+  if (r->u.events.queue_length == 0 && r->u.events.lost) {
+    strbuf b = strbuf_alloca(60);
+    strbuf_sprintf(b, "event: lost\ndata: {\"count\":%u}\n\n", r->u.events.lost);
+    r->u.events.lost = 0;
+    events_queue(r, b);
+  }
+  if (r->u.events.queue_length == 0) {
+    time_ms_t now = gettime_ms();
+    if (now < r->u.events.keepalive_time) {
+      http_request_pause_response(&r->http, r->u.events.keepalive_time);
+      return 1;
+    }
+    r->u.events.keepalive_time = now + EVENTS_KEEPALIVE_MS;
+    strbuf b = strbuf_alloca(4);
+    strbuf_puts(b, ":\n\n");
+    events_queue(r, b);
+  }
+  size_t len = r->u.events.queue_length < bufsz ? r->u.events.queue_length : bufsz;
+  memcpy(buf, r->u.events.queue, len);
+  memmove(r->u.events.queue, r->u.events.queue + len, r->u.events.queue_length - len);
+  r->u.events.queue_length -= len;
+  result->generated = len;
+  return 1;
+}
+
+/* Parse a comma-separated list of event types into EVENT_ bits, or return -1 if any are unknown.
+ */
+static int parse_event_types(const char *text)
+{
+  int types = 0;
+  while (*text) {
+    const char *end = text + strcspn(text, ",");
+    size_t len = end - text;
+    if (len == 6 && strncmp(text, "bundle", len) == 0)
+      types |= EVENT_BUNDLE;
+    else if (len == 6 && strncmp(text, "meshms", len) == 0)
+      types |= EVENT_MESHMS;
+    else if (len == 4 && strncmp(text, "peer", len) == 0)
+      types |= EVENT_PEER;
+    else if (len)
+      return -1;
+    text = *end ? end + 1 : end;
+  }
+  return types;
+}
+
+DECLARE_HANDLER("/restful/events", restful_events);
+static int restful_events(httpd_request *r, const char *remainder)
+{
+  r->http.response.header.content_type = CONTENT_TYPE_JSON;
+  int ret = authorize_restful(&r->http);
+  if (ret)
+    return ret;
+  if (*remainder)
+    return 404;
+  if (r->http.verb != HTTP_VERB_GET)
+    return 405;
+  int types = EVENT_BUNDLE | EVENT_MESHMS | EVENT_PEER;
+  const char *param = http_request_get_query_param(&r->http, "types");
+  if (param && (types = parse_event_types(param)) == -1)
+    return 400;
+  if (!is_rhizome_http_enabled())
+    types &= ~(EVENT_BUNDLE | EVENT_MESHMS);
+  if (types == 0)
+    return 404;
+  const char *service = http_request_get_query_param(&r->http, "service");
+  const char *recipient = http_request_get_query_param(&r->http, "recipient");
+  bool_t recipient_set = 0;
+  if (recipient && *recipient) {
+    if (str_to_sid_t(&r->sid1, recipient) == -1)
+      return 400;
+    recipient_set = 1;
+  }
+  assert(r->finalise_union == NULL);
+  r->finalise_union = finalise_union_events;
+  bzero(&r->u.events, sizeof r->u.events);
+  r->u.events.types = types;
+  r->u.events.recipient_set = recipient_set;
+  if (service && *service && (r->u.events.service = str_edup(service)) == NULL)
+    return 500;
+  r->u.events.keepalive_time = gettime_ms() + EVENTS_KEEPALIVE_MS;
+  // Watch only the bundles that can produce a wanted event.
+  if (types & (EVENT_BUNDLE | EVENT_MESHMS))
+    r->trigger_rhizome_bundle_added = events_on_bundle_added;
+  if ((types & EVENT_BUNDLE) && !r->u.events.service)
+    httpd_watch_all_bundles(r);
+  else {
+    if (types & EVENT_BUNDLE)
+      httpd_watch_service(r, r->u.events.service);
+    if ((types & EVENT_MESHMS) && !((types & EVENT_BUNDLE) && strcmp(r->u.events.service, RHIZOME_SERVICE_MESHMS2) == 0))
+      httpd_watch_service(r, RHIZOME_SERVICE_MESHMS2);
+  }
+  if (types & EVENT_PEER) {
+    r->u.events.next_peer_listener = peer_listeners;
+    if (peer_listeners)
+      peer_listeners->u.events.prev_peer_listener = r;
+    peer_listeners = r;
+  }
+  http_request_response_generated(&r->http, 200, "text/event-stream", restful_events_content);
+  return 1;
+}
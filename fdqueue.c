@@ -49,134 +49,350 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <inttypes.h> // for PRIu64
 #include "fdqueue.h"
 #include "conf.h"
+#include "trace.h"
 #include "net.h"
 #include "str.h"
 #include "strbuf.h"
 #include "strbuf_helpers.h"
+#include "mem.h"
+
+#ifdef USE_EPOLL
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
 
 #define MAX_WATCHED_FDS 128
 __thread struct pollfd fds[MAX_WATCHED_FDS];
 __thread int fdcount=0;
 __thread struct sched_ent *fd_callbacks[MAX_WATCHED_FDS];
 
-__thread struct sched_ent *wake_list=NULL;
-__thread struct sched_ent *run_soon=NULL;
-__thread struct sched_ent *run_now=NULL;
+#ifdef USE_EPOLL
+// an epoll instance watching the same file handles as fds[], created on first use by each process
+__thread int epoll_fd=-1;
+__thread pid_t epoll_pid=0;
+__thread int epoll_disabled=0;
+// the events returned by the last epoll_wait(), dispatched directly to each alarm.
+// an alarm that is unwatched before its event is dispatched is removed from this list
+__thread struct epoll_event epoll_events[MAX_WATCHED_FDS];
+__thread int epoll_event_count=0;
 
-struct profile_total poll_stats={NULL,0,"Idle (in poll)",0,0,0,0};
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+// epoll only reports an edge once, but alarm functions expect to be called again until they have
+// read everything.  So watches that have reported an event are polled without waiting, each time
+// around, until they are no longer ready
+__thread struct pollfd ready_fds[MAX_WATCHED_FDS];
+__thread struct sched_ent *ready_alarms[MAX_WATCHED_FDS];
+__thread unsigned ready_count=0;
 
-#define alloca_alarm_name(alarm) ((alarm)->stats ? alloca_str_toprint((alarm)->stats->name) : "Unnamed")
+static void ready_add(struct sched_ent *alarm)
+{
+  ready_fds[ready_count] = alarm->poll;
+  ready_alarms[ready_count] = alarm;
+  alarm->_ready_index = ++ready_count;
+}
 
-void list_alarms()
+static void ready_remove(struct sched_ent *alarm)
 {
-  time_ms_t now = gettime_ms();
-  struct sched_ent *alarm;
-  
-  _DEBUG("Run now;");
-  for (alarm = run_now; alarm; alarm=alarm->_next_run)
-    _DEBUGF("%p %s deadline in %"PRId64"ms", alarm->function, alloca_alarm_name(alarm), alarm->run_before - now);
-    
-  _DEBUG("Run soon;");
-  for (alarm = run_soon; alarm; alarm=alarm->_next_run)
-    _DEBUGF("%p %s run in %"PRId64"ms", alarm->function, alloca_alarm_name(alarm), alarm->run_after - now);
-  
-  _DEBUG("Wake at;");
-  for (alarm = wake_list; alarm; alarm = alarm->_next_wake)
-    _DEBUGF("%p %s wake in %"PRId64"ms", alarm->function, alloca_alarm_name(alarm), alarm->wake_at - now);
-  
-  _DEBUG("File handles;");
+  unsigned index = alarm->_ready_index;
+  if (!index)
+    return;
+  alarm->_ready_index = 0;
+  if (index != ready_count){
+    ready_fds[index - 1] = ready_fds[ready_count - 1];
+    ready_alarms[index - 1] = ready_alarms[ready_count - 1];
+    ready_alarms[index - 1]->_ready_index = index;
+  }
+  ready_count--;
+}
+#define EPOLL_TRIGGER EPOLLET
+#else
+#define EPOLL_TRIGGER 0
+#endif
+
+static int epoll_is_ready()
+{
+  return epoll_fd != -1 && epoll_pid == getpid();
+}
+
+static void epoll_watch(struct sched_ent *alarm, int op)
+{
+  // poll(2) and epoll(7) use the same event flags
+  struct epoll_event event = {.events = alarm->poll.events | EPOLL_TRIGGER, .data.ptr = alarm};
+  if (epoll_ctl(epoll_fd, op, alarm->poll.fd, &event) == -1){
+    if (op == EPOLL_CTL_MOD && errno == ENOENT)
+      epoll_watch(alarm, EPOLL_CTL_ADD);
+    else if (op != EPOLL_CTL_DEL || (errno != ENOENT && errno != EBADF))
+      WHYF_perror("epoll_ctl(%d, %d, %d)", epoll_fd, op, alarm->poll.fd);
+  }
+}
+
+// stop watching, and forget any event for this alarm that has not been dispatched yet
+static void epoll_unwatch(struct sched_ent *alarm)
+{
+  epoll_watch(alarm, EPOLL_CTL_DEL);
   int i;
-  for (i = 0; i < fdcount; ++i)
-    _DEBUGF("%s watching #%d for %x", alloca_alarm_name(fd_callbacks[i]), fds[i].fd, fds[i].events);
+  for (i = 0; i < epoll_event_count; i++)
+    if (epoll_events[i].data.ptr == alarm)
+      epoll_events[i].data.ptr = NULL;
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+  ready_remove(alarm);
+#endif
 }
 
-static void insert_run_now(struct sched_ent *alarm)
+// create the epoll instance, or replace one inherited from our parent process.
+// returns 0 if epoll is unavailable and we should fall back to poll(2)
+static int epoll_start()
 {
-  struct sched_ent **list = &run_now;
-  
-  while(*list){
-    if ((*list)->run_before > alarm->run_before)
+  if (epoll_is_ready())
+    return 1;
+  if (epoll_disabled)
+    return 0;
+  if (epoll_fd != -1)
+    close(epoll_fd);
+  epoll_event_count = 0;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1){
+    WHY_perror("epoll_create1");
+    return 0;
+  }
+  epoll_pid = getpid();
+  int i;
+  for (i = 0; i < fdcount; i++)
+    epoll_watch(fd_callbacks[i], EPOLL_CTL_ADD);
+  return 1;
+}
+
+// wait for events, returning the number of alarms in epoll_events[] to call
+static int epoll_poll(int wait)
+{
+  int count = 0, r;
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+  int i;
+  if (ready_count){
+    int ready = poll(ready_fds, ready_count, 0);
+    for (i = 0; ready > 0 && i < (int)ready_count; i++){
+      if (ready_fds[i].revents){
+	epoll_events[count].events = ready_fds[i].revents;
+	epoll_events[count++].data.ptr = ready_alarms[i];
+      }
+    }
+    // anything that is no longer ready will report a new edge when it becomes ready again
+    for (i = ready_count; ready >= 0 && i > 0; i--)
+      if (!ready_fds[i - 1].revents)
+	ready_remove(ready_alarms[i - 1]);
+  }
+  if (count)
+    wait = 0;
+#endif
+  r = epoll_wait(epoll_fd, &epoll_events[count], MAX_WATCHED_FDS - count, wait);
+  if (r == -1){
+    epoll_event_count = count;
+    return count ? count : -1;
+  }
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+  for (i = count; i < count + r; i++){
+    struct sched_ent *alarm = epoll_events[i].data.ptr;
+    if (alarm->_ready_index)
+      // already reported as still ready
+      epoll_events[i].data.ptr = NULL;
+    else
+      ready_add(alarm);
+  }
+#endif
+  epoll_event_count = count + r;
+  return epoll_event_count;
+}
+#endif
+
+void fd_disable_epoll()
+{
+#ifdef USE_EPOLL
+  if (epoll_is_ready()){
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+  epoll_event_count = 0;
+  epoll_disabled = 1;
+#endif
+}
+
+const char *fd_poll_method()
+{
+#ifdef USE_EPOLL
+  if (!epoll_disabled){
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+    return "epoll, edge triggered";
+#else
+    return "epoll";
+#endif
+  }
+#endif
+  return "poll";
+}
+
+// binary heaps of scheduled alarms, ordered by one of their times
+enum heap_order{
+  RUN_BEFORE,
+  RUN_AFTER,
+  WAKE_AT,
+};
+
+struct alarm_heap{
+  enum heap_order order;
+  struct sched_ent **alarms;
+  unsigned count;
+  unsigned size;
+};
+
+__thread struct alarm_heap wake_list={.order=WAKE_AT};
+__thread struct alarm_heap run_soon={.order=RUN_AFTER};
+__thread struct alarm_heap run_now={.order=RUN_BEFORE};
+__thread uint64_t schedule_sequence=0;
+
+struct profile_total poll_stats={.name="Idle (in poll)"};
+
+#define alloca_alarm_name(alarm) ((alarm)->stats ? alloca_str_toprint((alarm)->stats->name) : "Unnamed")
+
+static time_ms_t heap_time(const struct alarm_heap *heap, const struct sched_ent *alarm)
+{
+  switch(heap->order){
+    case RUN_BEFORE: return alarm->run_before;
+    case RUN_AFTER: return alarm->run_after;
+    case WAKE_AT: break;
+  }
+  return alarm->wake_at;
+}
+
+static unsigned *heap_index(const struct alarm_heap *heap, struct sched_ent *alarm)
+{
+  return heap->order == WAKE_AT ? &alarm->_wake_index : &alarm->_run_index;
+}
+
+static int heap_before(const struct alarm_heap *heap, const struct sched_ent *a, const struct sched_ent *b)
+{
+  time_ms_t ta = heap_time(heap, a), tb = heap_time(heap, b);
+  if (ta != tb)
+    return ta < tb;
+  return a->_sequence < b->_sequence;
+}
+
+static void heap_set(struct alarm_heap *heap, unsigned pos, struct sched_ent *alarm)
+{
+  heap->alarms[pos] = alarm;
+  *heap_index(heap, alarm) = pos + 1;
+}
+
+static void heap_sift_up(struct alarm_heap *heap, unsigned pos)
+{
+  struct sched_ent *alarm = heap->alarms[pos];
+  while (pos > 0){
+    unsigned parent = (pos - 1) / 2;
+    if (!heap_before(heap, alarm, heap->alarms[parent]))
       break;
-    list = &(*list)->_next_run;
+    heap_set(heap, pos, heap->alarms[parent]);
+    pos = parent;
   }
-  alarm->_next_run = *list;
-  *list = alarm;
+  heap_set(heap, pos, alarm);
 }
 
-static void insert_run_soon(struct sched_ent *alarm)
+static void heap_sift_down(struct alarm_heap *heap, unsigned pos)
 {
-  struct sched_ent **list = &run_soon;
-  
-  while(*list){
-    if ((*list)->run_after > alarm->run_after)
+  struct sched_ent *alarm = heap->alarms[pos];
+  while (1){
+    unsigned child = pos * 2 + 1;
+    if (child >= heap->count)
+      break;
+    if (child + 1 < heap->count && heap_before(heap, heap->alarms[child + 1], heap->alarms[child]))
+      child++;
+    if (!heap_before(heap, heap->alarms[child], alarm))
       break;
-    list = &(*list)->_next_run;
+    heap_set(heap, pos, heap->alarms[child]);
+    pos = child;
   }
-  alarm->_next_run = *list;
-  *list = alarm;
+  heap_set(heap, pos, alarm);
 }
 
-static void remove_run_list(struct sched_ent *alarm, struct sched_ent **list)
+static void heap_insert(struct alarm_heap *heap, struct sched_ent *alarm)
 {
-  while(*list){
-    if (*list==alarm){
-      *list = alarm->_next_run;
-      list = &alarm->_next_run;
-      alarm->_next_run=NULL;
-      return;
-    }else{
-      list = &(*list)->_next_run;
-    }
+  if (heap->count == heap->size){
+    unsigned size = heap->size ? heap->size * 2 : 64;
+    struct sched_ent **alarms = erealloc(heap->alarms, sizeof(struct sched_ent *) * size);
+    if (!alarms)
+      FATAL("Unable to grow the alarm schedule");
+    heap->alarms = alarms;
+    heap->size = size;
   }
+  heap->alarms[heap->count] = alarm;
+  heap_sift_up(heap, heap->count++);
 }
 
-static void insert_wake_list(struct sched_ent *alarm)
+static void heap_remove(struct alarm_heap *heap, struct sched_ent *alarm)
 {
-  if (alarm->wake_at == TIME_MS_NEVER_WILL)
+  unsigned *index = heap_index(heap, alarm);
+  if (*index == 0 || *index > heap->count || heap->alarms[*index - 1] != alarm)
     return;
-  struct sched_ent **list = &wake_list, *last = NULL;
-  while(*list){
-    if ((*list)->wake_at > alarm->wake_at)
-      break;
-    last = (*list);
-    list = &last->_next_wake;
-  }
-  alarm->_next_wake = *list;
-  if (*list)
-    (*list)->_prev_wake = alarm;
-  alarm->_prev_wake = last;
-  *list = alarm;
+  unsigned pos = *index - 1;
+  *index = 0;
+  if (pos == --heap->count)
+    return;
+  heap_set(heap, pos, heap->alarms[heap->count]);
+  if (pos > 0 && heap_before(heap, heap->alarms[pos], heap->alarms[(pos - 1) / 2]))
+    heap_sift_up(heap, pos);
+  else
+    heap_sift_down(heap, pos);
 }
 
-static void remove_wake_list(struct sched_ent *alarm)
+static struct sched_ent *heap_first(const struct alarm_heap *heap)
 {
-  struct sched_ent *prev = alarm->_prev_wake;
-  struct sched_ent *next = alarm->_next_wake;
+  return heap->count ? heap->alarms[0] : NULL;
+}
+
+void list_alarms()
+{
+  time_ms_t now = gettime_ms();
+  unsigned i;
   
-  if (prev)
-    prev->_next_wake = next;
-  else if(wake_list==alarm)
-    wake_list = next;
+  _DEBUG("Run now;");
+  for (i = 0; i < run_now.count; i++)
+    _DEBUGF("%p %s deadline in %"PRId64"ms", run_now.alarms[i]->function, alloca_alarm_name(run_now.alarms[i]), run_now.alarms[i]->run_before - now);
     
-  if (next)
-    next->_prev_wake = prev;
+  _DEBUG("Run soon;");
+  for (i = 0; i < run_soon.count; i++)
+    _DEBUGF("%p %s run in %"PRId64"ms", run_soon.alarms[i]->function, alloca_alarm_name(run_soon.alarms[i]), run_soon.alarms[i]->run_after - now);
+  
+  _DEBUG("Wake at;");
+  for (i = 0; i < wake_list.count; i++)
+    _DEBUGF("%p %s wake in %"PRId64"ms", wake_list.alarms[i]->function, alloca_alarm_name(wake_list.alarms[i]), wake_list.alarms[i]->wake_at - now);
   
-  alarm->_prev_wake = NULL;
-  alarm->_next_wake = NULL;
+  _DEBUG("File handles;");
+  int j;
+  for (j = 0; j < fdcount; ++j)
+    _DEBUGF("%s watching #%d for %x", alloca_alarm_name(fd_callbacks[j]), fds[j].fd, fds[j].events);
 }
 
 // move alarms from run_soon to run_now
 static void move_run_list(){
   time_ms_t now = gettime_ms();
-  while(run_soon && run_soon->run_after <= now){
-    struct sched_ent *alarm = run_soon;
-    run_soon = run_soon->_next_run;
-    remove_wake_list(alarm);
-    insert_run_now(alarm);
+  struct sched_ent *alarm;
+  while((alarm = heap_first(&run_soon)) && alarm->run_after <= now){
+    heap_remove(&run_soon, alarm);
+    heap_remove(&wake_list, alarm);
+    alarm->_sequence = schedule_sequence++;
+    heap_insert(&run_now, alarm);
     DEBUGF(io, "Moved %s from run_soon to run_now", alloca_alarm_name(alarm));
   }
 }
 
+// remove the most urgent alarm from run_now, so it can be called
+static struct sched_ent *next_run_now()
+{
+  struct sched_ent *alarm = heap_first(&run_now);
+  heap_remove(&run_now, alarm);
+  alarm->_scheduled=0;
+  alarm->run_after = TIME_MS_NEVER_WILL;
+  return alarm;
+}
+
 // add an alarm to the list of scheduled function calls.
 // simply populate .alarm with the absolute time, and .function with the method to call.
 // on calling .poll.revents will be zero.
@@ -211,8 +427,10 @@ void _schedule(struct __sourceloc __whence, struct sched_ent *alarm)
   // don't bother to schedule an alarm that will (by definition) never run
   // not an error as it simplifies calling API use
   if (alarm->run_after != TIME_MS_NEVER_WILL){
-    insert_wake_list(alarm);
-    insert_run_soon(alarm);
+    alarm->_sequence = schedule_sequence++;
+    if (alarm->wake_at != TIME_MS_NEVER_WILL)
+      heap_insert(&wake_list, alarm);
+    heap_insert(&run_soon, alarm);
     alarm->_scheduled=1;
   }
 }
@@ -226,9 +444,10 @@ void _unschedule(struct __sourceloc __whence, struct sched_ent *alarm)
     
   DEBUGF(io, "unschedule(alarm=%s)", alloca_alarm_name(alarm));
 
-  remove_run_list(alarm, &run_now);
-  remove_run_list(alarm, &run_soon);
-  remove_wake_list(alarm);
+  // the alarm is either in run_soon or run_now, heap_remove ignores the other
+  heap_remove(&run_now, alarm);
+  heap_remove(&run_soon, alarm);
+  heap_remove(&wake_list, alarm);
   alarm->_scheduled=0;
   alarm->run_after = TIME_MS_NEVER_WILL;
 }
@@ -245,7 +464,8 @@ int _watch(struct __sourceloc __whence, struct sched_ent *alarm)
   if (!alarm->poll.events)
     FATAL("Can't watch if you haven't set any poll flags");
   
-  if (alarm->_poll_index>=0 && fd_callbacks[alarm->_poll_index]==alarm){
+  int updating = alarm->_poll_index>=0 && fd_callbacks[alarm->_poll_index]==alarm;
+  if (updating){
     // updating event flags
     DEBUGF(io, "Updating watch %s, #%d for %s", alloca_alarm_name(alarm), alarm->poll.fd, alloca_poll_events(alarm->poll.events));
   }else{
@@ -259,6 +479,14 @@ int _watch(struct __sourceloc __whence, struct sched_ent *alarm)
     fdcount++;
   }
   fds[alarm->_poll_index]=alarm->poll;
+#ifdef USE_EPOLL
+  if (epoll_is_ready())
+    epoll_watch(alarm, updating ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+#ifdef USE_EPOLL_EDGE_TRIGGERED
+  if (alarm->_ready_index)
+    ready_fds[alarm->_ready_index - 1] = alarm->poll;
+#endif
+#endif
   return 0;
 }
 
@@ -278,6 +506,10 @@ int _unwatch(struct __sourceloc __whence, struct sched_ent *alarm)
   if (index <0 || fds[index].fd!=alarm->poll.fd)
     return WHY("Attempted to unwatch a handle that is not being watched");
   
+#ifdef USE_EPOLL
+  if (epoll_is_ready())
+    epoll_unwatch(alarm);
+#endif
   fdcount--;
   if (index!=fdcount){
     // squash fds
@@ -292,6 +524,16 @@ int _unwatch(struct __sourceloc __whence, struct sched_ent *alarm)
   return 0;
 }
 
+static void fd_alarm_histogram(unsigned *histogram, time_us_t elapsed)
+{
+  unsigned bucket = 0;
+  while (elapsed > 0 && bucket < ALARM_HISTOGRAM_BUCKETS - 1){
+    elapsed >>= 1;
+    bucket++;
+  }
+  histogram[bucket]++;
+}
+
 static void call_alarm(struct sched_ent *alarm, int revents)
 {
   IN();
@@ -299,6 +541,10 @@ static void call_alarm(struct sched_ent *alarm, int revents)
     FATAL("Attempted to call with no alarm");
   struct call_stats call_stats;
   call_stats.totals = alarm->stats;
+  // the alarm may be freed or rescheduled by its own function
+  time_us_t start = gettime_us();
+  // lateness is measured from the run_before deadline
+  time_ms_t run_before = alarm->run_before;
   
   DEBUGF(io, "Calling alarm/callback %p %s with revents %x%s%s%s%s", 
     alarm, alloca_alarm_name(alarm), revents,
@@ -309,14 +555,26 @@ static void call_alarm(struct sched_ent *alarm, int revents)
   );
   if (call_stats.totals)
     fd_func_enter(__HERE__, &call_stats);
+  const char *trace_name = call_stats.totals ? call_stats.totals->name : "alarm";
+  TRACE_BEGIN("alarm", trace_name);
   
   alarm->poll.revents = revents;
   alarm->function(alarm);
+  
+  TRACE_END("alarm", trace_name);
 
   strbuf_reset(&log_context);
   
-  if (call_stats.totals)
+  if (call_stats.totals){
     fd_func_exit(__HERE__, &call_stats);
+    fd_alarm_histogram(call_stats.totals->exec_histogram, gettime_us() - start);
+    if (revents == 0 && run_before != TIME_MS_NEVER_WILL){
+      time_us_t late = start - run_before * 1000;
+      fd_alarm_histogram(call_stats.totals->late_histogram, late);
+      if (late > 0)
+	call_stats.totals->deadline_misses++;
+    }
+  }
 
   DEBUGF(io, "Alarm %p returned",alarm);
 
@@ -329,32 +587,28 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
   IN();
   
   // clear the run now list of any alarms that are overdue
-  if (run_now && run_now->run_before <= gettime_ms()){
-    struct sched_ent *alarm = run_now;
-    run_now = alarm->_next_run;
-    alarm->_scheduled=0;
-    alarm->run_after = TIME_MS_NEVER_WILL;
-    call_alarm(alarm, 0);
+  if (run_now.count && heap_first(&run_now)->run_before <= gettime_ms()){
+    call_alarm(next_run_now(), 0);
     RETURN(1);
   }
   
   // return 0 when there's nothing to do, it doesn't make sense to wait for infinity
-  if (!run_now && !wake_list && fdcount==0)
+  if (!run_now.count && !wake_list.count && fdcount==0)
     RETURN(0);
   
   time_ms_t now = gettime_ms();
   time_ms_t wait_until=TIME_MS_NEVER_WILL;
   uint8_t called_waiting = 0;
   
-  if (run_now){
+  if (run_now.count){
     wait_until = now;
   }else{
     time_ms_t next_run=TIME_MS_NEVER_WILL;
-    if(run_soon)
-      next_run = run_soon->run_after;
+    if(run_soon.count)
+      next_run = heap_first(&run_soon)->run_after;
     
-    if (wake_list)
-      wait_until = wake_list->wake_at;
+    if (wake_list.count)
+      wait_until = heap_first(&wake_list)->wake_at;
       
     if (waiting && wait_until > now){
       wait_until = waiting(now, next_run, wait_until);
@@ -366,6 +620,7 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
   // check for IO and/or wait for the next wake_at
   int wait=0;
   int r=0;
+  int used_epoll=0;
   
   {
     struct call_stats call_stats;
@@ -382,7 +637,13 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
       DEBUGF(io, "Calling poll with %dms wait", wait);
 	
       fd_func_enter(__HERE__, &call_stats);
-      r = poll(fds, fdcount, wait);
+#ifdef USE_EPOLL
+      if (epoll_start()){
+	used_epoll = 1;
+	r = epoll_poll(wait);
+      }else
+#endif
+	r = poll(fds, fdcount, wait);
       fd_func_exit(__HERE__, &call_stats);
       
       if (r==-1 && errno!=EINTR)
@@ -391,6 +652,21 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
       if (IF_DEBUG(io)) {
 	strbuf b = strbuf_alloca(1024);
 	int i;
+#ifdef USE_EPOLL
+	if (used_epoll){
+	  for (i = 0; i < r; ++i) {
+	    struct sched_ent *alarm = epoll_events[i].data.ptr;
+	    if (!alarm)
+	      continue;
+	    if (i)
+	      strbuf_puts(b, ", ");
+	    strbuf_sprintf(b, "%d:", alarm->poll.fd);
+	    strbuf_append_poll_events(b, alarm->poll.events);
+	    strbuf_puts(b, "->");
+	    strbuf_append_poll_events(b, epoll_events[i].events);
+	  }
+	}else
+#endif
 	for (i = 0; i < fdcount; ++i) {
 	  if (i)
 	    strbuf_puts(b, ", ");
@@ -399,7 +675,7 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
 	  strbuf_puts(b, "->");
 	  strbuf_append_poll_events(b, fds[i].revents);
 	}
-	DEBUGF(io, "poll(fds=(%s), fdcount=%d, ms=%d) -> %d", strbuf_str(b), fdcount, wait, r);
+	DEBUGF(io, "%s(fds=(%s), fdcount=%d, ms=%d) -> %d", fd_poll_method(), strbuf_str(b), fdcount, wait, r);
       }
       
     }else if(wait>0){
@@ -417,11 +693,25 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
   
   // We don't want a single alarm to be able to reschedule itself and starve all IO
   // So we only check for new overdue alarms if we attempted to sleep
-  if (wait && run_now && run_now->run_before <= gettime_ms())
+  if (wait && run_now.count && heap_first(&run_now)->run_before <= gettime_ms())
     RETURN(1);
   
   // process all watched IO handles once (we need to be fair)
-  if (r>0) {
+  if (r>0 && used_epoll) {
+#ifdef USE_EPOLL
+    // only the handles with events, an alarm that is unwatched by an earlier callback is skipped
+    int i;
+    for (i = 0; i < epoll_event_count; i++){
+      struct sched_ent *alarm = epoll_events[i].data.ptr;
+      if (alarm){
+	epoll_events[i].data.ptr = NULL;
+	call_alarm(alarm, epoll_events[i].events);
+      }
+    }
+    epoll_event_count = 0;
+    move_run_list();
+#endif
+  }else if (r>0) {
     int i;
     for(i=fdcount -1;i>=0;i--){
       if (fd_callbacks[i] && fd_callbacks[i]->poll.fd == fds[i].fd && fds[i].revents) {
@@ -436,13 +726,9 @@ int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeu
     // time may have passed while processing IO, or processing IO could trigger a new overdue alarm
     move_run_list();
     
-  }else if (run_now){
+  }else if (run_now.count){
     // No IO, no overdue alarms but another alarm is runnable? run a single alarm before polling again
-    struct sched_ent *alarm = run_now;
-    run_now = alarm->_next_run;
-    alarm->_scheduled=0;
-    alarm->run_after = TIME_MS_NEVER_WILL;
-    call_alarm(alarm, 0);
+    call_alarm(next_run_now(), 0);
   }
   
   RETURN(1);
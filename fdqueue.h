@@ -60,6 +60,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "log.h"
 #include "debug.h"
 
+// histogram bucket 0 counts 0us, bucket n counts [2^(n-1), 2^n)us, and the last bucket counts everything longer
+#define ALARM_HISTOGRAM_BUCKETS 24
+
 struct profile_total {
   struct profile_total *_next;
   int _initialised;
@@ -68,6 +71,13 @@ struct profile_total {
   time_ms_t total_time;
   time_ms_t child_time;
   int calls;
+  // when called as an alarm; how long did it run, how long after its run_before deadline did it start
+  // (0 if it started in time), and how often did it start after that deadline? these are never cleared
+  unsigned exec_histogram[ALARM_HISTOGRAM_BUCKETS];
+  unsigned late_histogram[ALARM_HISTOGRAM_BUCKETS];
+  unsigned deadline_misses;
+  // if set, calls are recorded as spans in the event trace
+  const char *trace_category;
 };
 
 struct call_stats{
@@ -82,9 +92,11 @@ struct sched_ent;
 typedef void (*ALARM_FUNCP) (struct sched_ent *alarm);
 
 struct sched_ent{
-  struct sched_ent *_next_wake;
-  struct sched_ent *_prev_wake;
-  struct sched_ent *_next_run;
+  // position in the run_soon or run_now heap, and in the wake heap, counting from 1 (0 = not present)
+  unsigned _run_index;
+  unsigned _wake_index;
+  // alarms with the same time are run in the order they were scheduled
+  uint64_t _sequence;
   uint8_t _scheduled;
   
   ALARM_FUNCP function;
@@ -105,6 +117,8 @@ struct sched_ent{
   
   struct profile_total *stats;
   int _poll_index;
+  // position in the list of edge triggered watches that may still be ready, counting from 1 (0 = not present)
+  unsigned _ready_index;
 };
 
 #define STRUCT_SCHED_ENT_UNUSED {\
@@ -154,17 +168,27 @@ int _unwatch(struct __sourceloc, struct sched_ent *alarm);
 #define unwatch(alarm)    _unwatch(__WHENCE__, alarm)
 int fd_poll2(time_ms_t (*waiting)(time_ms_t, time_ms_t, time_ms_t), void (*wokeup)());
 #define fd_poll() fd_poll2(NULL, NULL)
+// wait for file handles in this thread with poll(2), as if built with --disable-epoll
+void fd_disable_epoll();
+const char *fd_poll_method();
 
 /* function timing routines */
 int fd_clearstats();
 int fd_showstats();
+struct strbuf;
+void fd_alarm_stats_json(struct strbuf *b);
 int fd_checkalarms();
 int fd_func_enter(struct __sourceloc, struct call_stats *this_call);
 int fd_func_exit(struct __sourceloc, struct call_stats *this_call);
 void dump_stack(int log_level);
 unsigned fd_depth();
 
-#define IN() static struct profile_total _aggregate_stats={NULL,0,__FUNCTION__,0,0,0,0}; \
+#define IN() static struct profile_total _aggregate_stats={.name=__FUNCTION__}; \
+    struct call_stats _this_call={.totals=&_aggregate_stats}; \
+    fd_func_enter(__HERE__, &_this_call);
+
+// as for IN(), but also records a span in the event trace
+#define IN_TRACE(CATEGORY) static struct profile_total _aggregate_stats={.name=__FUNCTION__, .trace_category=(CATEGORY)}; \
     struct call_stats _this_call={.totals=&_aggregate_stats}; \
     fd_func_enter(__HERE__, &_this_call);
 
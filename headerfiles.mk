@@ -16,6 +16,7 @@ HDRS=	fifo.h \
 	meshmb.h \
 	message_ply.h \
 	nibble_tree.h \
+	trace.h \
 	serval_types.h \
 	serval.h \
 	server.h \
@@ -36,8 +36,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "mem.h"
 #include "version_servald.h"
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #define BOUNDARY_STRING_MAXLEN  70 // legislated limit from RFC-1341
 
+// Chunked transfer encoding: "%08x\r\n" before each chunk, "\r\n" after it, and room is always kept
+// for the final "0\r\n\r\n".
+#define CHUNK_HEADER_LEN 10
+#define CHUNK_FRAMING (CHUNK_HEADER_LEN + 2 + 5)
+
 /* The (struct http_request).verb field points to one of these static strings, so that a simple
  * equality test can be used, eg, (r->verb == HTTP_VERB_GET) instead of a strcmp().
  *
@@ -101,32 +110,92 @@ static int http_request_parse_header(struct http_request *r);
 static int http_request_start_body(struct http_request *r);
 static int http_request_parse_body_form_data(struct http_request *r);
 static void http_request_start_response(struct http_request *r);
+static void http_compressor_release(struct http_request *r);
+static void http_request_free_arena(struct http_request *r);
+static void http_request_parse(struct http_request *r);
 
-void http_request_init(struct http_request *r, int sockfd)
+struct http_connection_stats http_connection_stats;
+struct http_memory_stats http_memory_stats;
+
+void http_connection_status_html(strbuf b)
+{
+  strbuf_sprintf(b, "HTTP connections: %"PRIu64", requests: %"PRIu64", on reused connections: %"PRIu64", pipelined: %"PRIu64"<br>",
+    http_connection_stats.connections,
+    http_connection_stats.requests,
+    http_connection_stats.reused,
+    http_connection_stats.pipelined);
+  strbuf_sprintf(b, "HTTP request memory: %"PRIu64" bytes, peak: %"PRIu64" bytes, refused: %"PRIu64"<br>",
+    http_memory_stats.in_use,
+    http_memory_stats.peak,
+    http_memory_stats.refused);
+}
+
+/* Prepare to parse a new request, starting with any bytes of it that have already been received.
+ */
+static void http_request_start_receiving(struct http_request *r, const char *received, size_t len)
 {
-  assert(sockfd != -1);
   r->request_header.content_length = CONTENT_LENGTH_UNKNOWN;
   r->request_content_remaining = CONTENT_LENGTH_UNKNOWN;
   r->response.header.content_length = CONTENT_LENGTH_UNKNOWN;
   r->response.header.resource_length = CONTENT_LENGTH_UNKNOWN;
   r->response.header.minor_version = 1;
-  r->alarm.stats = &http_server_stats;
-  r->alarm.function = http_server_poll;
-  assert(r->idle_timeout >= 0);
-  if (r->idle_timeout == 0)
-    r->idle_timeout = 10000; // 10 seconds
-  r->alarm.poll.fd = sockfd;
   r->alarm.poll.events = POLLIN;
   r->phase = RECEIVE;
   r->reserved = r->buffer;
   // Put aside a few bytes for reserving strings, so that the path and query parameters can be
   // reserved ok.
   r->received = r->decode_ptr = r->end_received = r->end = r->parsed = r->cursor = r->buffer + sizeof(void*) * (1 + NELS(r->query_parameters));
+  assert(len <= (size_t)(r->buffer + sizeof r->buffer - r->received));
+  if (len) {
+    memmove(r->received, received, len);
+    r->decode_ptr = r->end_received = r->end = r->received + len;
+  }
   r->parser = http_request_parse_verb;
   watch(&r->alarm);
   http_request_set_idle_timeout(r);
 }
 
+void http_request_init(struct http_request *r, int sockfd)
+{
+  assert(sockfd != -1);
+  r->alarm.stats = &http_server_stats;
+  r->alarm.function = http_server_poll;
+  assert(r->idle_timeout >= 0);
+  if (r->idle_timeout == 0)
+    r->idle_timeout = 10000; // 10 seconds
+  r->alarm.poll.fd = sockfd;
+  ++http_connection_stats.connections;
+  http_request_start_receiving(r, NULL, 0);
+}
+
+/* Once a response has been sent on a persistent connection, clear away the finished request and
+ * start parsing the next one on the same connection.  If the client has already sent some or all
+ * of the next request, then parse it straight away.
+ */
+static void http_request_reset(struct http_request *r)
+{
+  assert(r->phase == TRANSMIT);
+  assert(r->keep_alive);
+  assert(r->reset);
+  r->reset(r);
+  http_compressor_release(r);
+  http_request_free_response_buffer(r);
+  http_request_free_arena(r);
+  const char *pipelined = r->pipelined;
+  size_t pipelined_length = r->pipelined_length;
+  HTTP_REQUEST_PARSER *handle_first_line = r->handle_first_line;
+  HTTP_REQUEST_PARSER *handle_headers = r->handle_headers;
+  bzero(&r->verb, offsetof(struct http_request, buffer) - offsetof(struct http_request, verb));
+  r->handle_first_line = handle_first_line;
+  r->handle_headers = handle_headers;
+  http_request_start_receiving(r, pipelined, pipelined_length);
+  if (pipelined_length) {
+    IDEBUGF(r->debug, "Parsing %zu bytes of pipelined request", pipelined_length);
+    ++http_connection_stats.pipelined;
+    http_request_parse(r);
+  }
+}
+
 static void http_request_set_idle_timeout(struct http_request *r)
 {
   assert(r->phase == RECEIVE || r->phase == TRANSMIT);
@@ -147,6 +216,94 @@ void http_request_free_response_buffer(struct http_request *r)
   r->response_buffer_size = 0;
 }
 
+/* Request memory is allocated from blocks that are only freed when the request is finished, so that
+ * handlers need not free it themselves, and so that each request's memory can be limited.  Small
+ * allocations share a block; large ones get a block to themselves.
+ */
+struct http_arena_block {
+  struct http_arena_block *next;
+  size_t size; // of data[]
+  size_t used;
+  uint64_t data[];
+};
+
+#define HTTP_ARENA_BLOCK_SIZE 4096
+#define HTTP_ARENA_ALIGN(n) (((n) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/* Return a pointer to 'size' bytes that stay allocated until the request is finished, or NULL if
+ * the request's memory limit would be exceeded or the system is out of memory.
+ */
+void *http_request_alloc(struct http_request *r, size_t size)
+{
+  size = HTTP_ARENA_ALIGN(size);
+  struct http_arena_block *block = r->arena;
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = size > HTTP_ARENA_BLOCK_SIZE ? size : HTTP_ARENA_BLOCK_SIZE;
+    size_t alloc_size = sizeof *block + block_size;
+    if (r->memory_limit && r->arena_size + alloc_size > r->memory_limit) {
+      ++http_memory_stats.refused;
+      WHYF("HTTP request memory limit of %zu bytes exceeded, %zu in use, %zu wanted", r->memory_limit, r->arena_size, size);
+      return NULL;
+    }
+    if ((block = emalloc(alloc_size)) == NULL)
+      return NULL;
+    block->size = block_size;
+    block->used = 0;
+    // Keep the block with the most room at the head of the list, where the next allocation goes.
+    if (r->arena && r->arena->size - r->arena->used > block_size - size) {
+      block->next = r->arena->next;
+      r->arena->next = block;
+    } else {
+      block->next = r->arena;
+      r->arena = block;
+    }
+    r->arena_size += alloc_size;
+    http_memory_stats.in_use += alloc_size;
+    if (http_memory_stats.in_use > http_memory_stats.peak)
+      http_memory_stats.peak = http_memory_stats.in_use;
+  }
+  void *ptr = (char *) block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+/* Resize memory got from http_request_alloc().  If it was the last allocation in its block and the
+ * block has room, then it grows in place, otherwise it is copied and the old space is not reused
+ * until the request is finished.
+ */
+void *http_request_realloc(struct http_request *r, void *ptr, size_t old_size, size_t new_size)
+{
+  if (ptr == NULL)
+    return http_request_alloc(r, new_size);
+  struct http_arena_block *block = r->arena;
+  old_size = HTTP_ARENA_ALIGN(old_size);
+  if (   block
+      && (char *) ptr + old_size == (char *) block->data + block->used
+      && block->used - old_size + HTTP_ARENA_ALIGN(new_size) <= block->size
+  ) {
+    block->used = block->used - old_size + HTTP_ARENA_ALIGN(new_size);
+    return ptr;
+  }
+  void *new_ptr = http_request_alloc(r, new_size);
+  if (new_ptr)
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  return new_ptr;
+}
+
+static void http_request_free_arena(struct http_request *r)
+{
+  if (r->arena_size)
+    IDEBUGF(r->debug, "Free %zu bytes of request memory", r->arena_size);
+  while (r->arena) {
+    struct http_arena_block *block = r->arena;
+    r->arena = block->next;
+    free(block);
+  }
+  assert(http_memory_stats.in_use >= r->arena_size);
+  http_memory_stats.in_use -= r->arena_size;
+  r->arena_size = 0;
+}
+
 int http_request_set_response_bufsize(struct http_request *r, size_t bufsiz)
 {
   // Don't allocate a new buffer if the existing one contains content.
@@ -163,9 +320,8 @@ int http_request_set_response_bufsize(struct http_request *r, size_t bufsiz)
   }
   if (bufsiz != r->response_buffer_size) {
     http_request_free_response_buffer(r);
-    if ((r->response_buffer = emalloc(bufsiz)) == NULL)
+    if ((r->response_buffer = http_request_alloc(r, bufsiz)) == NULL)
       return -1;
-    r->response_free_buffer = free;
     r->response_buffer_size = bufsiz;
     IDEBUGF(r->debug, "Allocated response buffer %zu bytes", r->response_buffer_size);
   }
@@ -188,7 +344,9 @@ void http_request_finalise(struct http_request *r)
   if (r->finalise)
     r->finalise(r);
   r->finalise = NULL;
+  http_compressor_release(r);
   http_request_free_response_buffer(r);
+  http_request_free_arena(r);
   r->phase = DONE;
   OUT();
 }
@@ -202,6 +360,26 @@ struct substring {
 
 const struct substring substring_NULL = { NULL, NULL };
 
+static int _substring_equals_nocase(struct substring str, const char *text)
+{
+  const char *p;
+  for (p = str.start; p < str.end && *text; ++p, ++text)
+    if (toupper(*p) != toupper(*text))
+      return 0;
+  return p == str.end && *text == '\0';
+}
+
+/* Return true unless an HTTP quality value is zero, eg, "0", "0.0" or "0.000".
+ */
+static int strn_to_qvalue_nonzero(struct substring value)
+{
+  const char *p;
+  for (p = value.start; p < value.end; ++p)
+    if (*p != '0' && *p != '.')
+      return 1;
+  return 0;
+}
+
 #if 0
 static int _matches(struct substring str, const char *text)
 {
@@ -536,6 +714,17 @@ static size_t _skip_token(struct http_request *r, struct substring *str)
   return r->cursor - start;
 }
 
+/* Skip a given token, ignoring case, if it is not just the start of a longer token.
+ */
+static int _skip_token_nocase(struct http_request *r, const char *eol, const char *token)
+{
+  char *const start = r->cursor;
+  if (_skip_literal_nocase(r, token) && (r->cursor == eol || !is_http_token(*r->cursor)))
+    return 1;
+  r->cursor = start;
+  return 0;
+}
+
 static size_t _parse_token(struct http_request *r, char *dst, size_t dstsiz)
 {
   struct substring str;
@@ -991,7 +1180,7 @@ static int http_request_start_parsing_headers(struct http_request *r)
  *
  * If the end of headers is parsed (blank line), then sets r->parser to the next parsing function
  * and returns 0.  If a single header line is successfully parsed, returns 0 after advancing
- * r->parsed.  If parsing cannot complete due to running out of data, returns 0 without changing
+ * r->parsed.  If parsing cannot complete due to running out of data, returns 100 without changing
  * r->parser, so this function will be called again once more data has been read.  Returns a 4nn or
  * 5nn HTTP result code if parsing fails.  Returns -1 if an unexpected error occurs.
  *
@@ -1000,7 +1189,8 @@ static int http_request_start_parsing_headers(struct http_request *r)
 static int http_request_parse_header(struct http_request *r)
 {
   DEBUG_DUMP_PARSER(r);
-  _skip_to_eol(r);
+  if (!_skip_to_eol(r))
+    return 100; // read more and try again
   const char *const eol = r->cursor;
   _skip_eol(r);
   if (eol == r->parsed) { // if EOL is at start of line (ie, blank line)...
@@ -1133,6 +1323,53 @@ static int http_request_parse_header(struct http_request *r)
     goto malformed;
   }
   _rewind(r);
+  if (_skip_literal_nocase(r, "Connection:")) {
+    // A comma-separated list of options, of which only "close" and "keep-alive" matter here.
+    while (_skip_optional_space(r) && r->cursor < eol) {
+      if (_skip_token_nocase(r, eol, "close"))
+	r->request_header.connection_close = 1;
+      else if (_skip_token_nocase(r, eol, "keep-alive"))
+	r->request_header.connection_keep_alive = 1;
+      else if (!_skip_token(r, NULL) && !_skip_literal(r, ","))
+	goto malformed;
+    }
+    r->cursor = nextline;
+    _commit(r);
+    return 0;
+  }
+  _rewind(r);
+  if (_skip_literal_nocase(r, "Accept-Encoding:")) {
+    // A comma-separated list of content codings, each with optional parameters, of which only a
+    // quality of zero ("q=0") matters here, meaning "not acceptable".
+    while (_skip_optional_space(r) && r->cursor < eol) {
+      if (_skip_literal(r, ","))
+	continue;
+      struct substring coding;
+      if (!_skip_token(r, &coding))
+	goto malformed;
+      int acceptable = 1;
+      while (_skip_optional_space(r) && _skip_literal(r, ";")) {
+	struct substring name, value;
+	_skip_optional_space(r);
+	if (!(_skip_token(r, &name) && _skip_literal(r, "=") && _skip_token(r, &value)))
+	  goto malformed;
+	if (_substring_equals_nocase(name, "q"))
+	  acceptable = strn_to_qvalue_nonzero(value);
+      }
+      if (!acceptable)
+	continue;
+      if (_substring_equals_nocase(coding, "gzip") || _substring_equals_nocase(coding, "x-gzip"))
+	r->request_header.accept_gzip = 1;
+      else if (_substring_equals_nocase(coding, "deflate"))
+	r->request_header.accept_deflate = 1;
+      else if (_substring_equals_nocase(coding, "*"))
+	r->request_header.accept_gzip = r->request_header.accept_deflate = 1;
+    }
+    r->cursor = nextline;
+    _commit(r);
+    return 0;
+  }
+  _rewind(r);
   if (_skip_literal_nocase(r, "Origin:")) {
     if (r->request_header.origin.null || r->request_header.origin.scheme[0]) {
       IDEBUGF(r->debug, "Skipping duplicate HTTP header Origin: %s", alloca_toprint(50, sol, r->end - sol));
@@ -1361,12 +1598,17 @@ static int http_request_start_body(struct http_request *r)
   if (r->request_header.content_length != CONTENT_LENGTH_UNKNOWN) {
     size_t unparsed = r->end - r->parsed;
     if (unparsed > r->request_header.content_length) {
-      IDEBUGF(r->debug, "Malformed request: already read %zu bytes past end of content",
-	(size_t)(unparsed - r->request_header.content_length));
-      return 431; // Request Header Fields Too Large
+      // The client has already sent the start of its next request, so set it aside until this
+      // request has been answered.
+      assert(r->decoder == NULL);
+      assert(r->end == r->end_received);
+      r->pipelined = r->parsed + r->request_header.content_length;
+      r->pipelined_length = r->end_received - r->pipelined;
+      r->end = r->decode_ptr = r->end_received = r->pipelined;
+      IDEBUGF(r->debug, "Received %zu bytes past end of content", r->pipelined_length);
+      unparsed = r->request_header.content_length;
     }
-    else
-      r->request_content_remaining = r->request_header.content_length - unparsed;
+    r->request_content_remaining = r->request_header.content_length - unparsed;
   }
 
   if (r->handle_headers){
@@ -1833,7 +2075,15 @@ static void http_request_receive(struct http_request *r)
   // We got some data, so reset the inactivity timer and invoke the parsing state machine to process
   // it.  The state machine invokes the caller-supplied callback functions.
   http_request_set_idle_timeout(r);
-  // Parse the unparsed and received data.
+  http_request_parse(r);
+  OUT();
+}
+
+/* Parse the unparsed and received data, and start the response once the request is complete.
+ */
+static void http_request_parse(struct http_request *r)
+{
+  IN();
   bool_t decode_more=1;
 
   while (r->phase == RECEIVE) {
@@ -1920,6 +2170,185 @@ static void http_request_receive(struct http_request *r)
   OUT();
 }
 
+#ifdef HAVE_ZLIB
+
+// A smaller window and state than the zlib defaults, to keep each connection's compressor to about
+// 64 KiB, which costs little compression on the short JSON records that REST lists are made of.
+#define COMPRESS_WINDOW_BITS 13
+#define COMPRESS_MEM_LEVEL 6
+
+// The least output room worth offering to deflate(3), which must be able to append a whole sync
+// flush marker.
+#define COMPRESS_MIN_ROOM 64
+
+/* Generated content is compressed as it is sent: the compressor takes the place of the content
+ * generator, calling the real generator to fill its input buffer, and deflating the input into the
+ * response buffer, flushing at the end of every call so that nothing is held back from the client.
+ */
+struct http_compressor {
+  z_stream stream;
+  unsigned char *input;
+  size_t input_size;
+  size_t input_length;
+  size_t input_need;
+  bool_t eof;
+  bool_t flushing;
+};
+
+static int http_compressor_init(z_stream *stream, int level, int gzip)
+{
+  bzero(stream, sizeof *stream);
+  if (level > Z_BEST_COMPRESSION)
+    level = Z_BEST_COMPRESSION;
+  int ret = deflateInit2(stream, level, Z_DEFLATED, COMPRESS_WINDOW_BITS + (gzip ? 16 : 0), COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+  if (ret != Z_OK)
+    return WHYF("deflateInit2() failed: %s", stream->msg ? stream->msg : "unknown error");
+  return 0;
+}
+
+static int http_compressor_start(struct http_request *r, int gzip)
+{
+  assert(r->compressor == NULL);
+  struct http_compressor *c = emalloc_zero(sizeof *c);
+  if (c == NULL)
+    return -1;
+  c->input_size = r->flush_size ? r->flush_size : 8192;
+  if ((c->input = emalloc(c->input_size)) == NULL) {
+    free(c);
+    return -1;
+  }
+  if (http_compressor_init(&c->stream, r->compress_level, gzip) == -1) {
+    free(c->input);
+    free(c);
+    return -1;
+  }
+  r->compressor = c;
+  return 0;
+}
+
+static void http_compressor_release(struct http_request *r)
+{
+  struct http_compressor *c = r->compressor;
+  if (c) {
+    deflateEnd(&c->stream);
+    free(c->input);
+    free(c);
+    r->compressor = NULL;
+  }
+}
+
+static int http_compressor_generate(struct http_request *r, unsigned char *buf, size_t bufsz, struct http_content_generator_result *result)
+{
+  struct http_compressor *c = r->compressor;
+  assert(c != NULL);
+  if (bufsz < COMPRESS_MIN_ROOM) {
+    result->need = COMPRESS_MIN_ROOM;
+    return 1;
+  }
+  // Top up the input from the real content generator, unless deflate(3) still has output pending
+  // from the last flush, in which case it must be called again with no new input.
+  while (!c->eof && !c->flushing && r->phase != PAUSE) {
+    if (c->input_need > c->input_size - c->input_length) {
+      size_t size = c->input_length + c->input_need;
+      unsigned char *input = erealloc(c->input, size);
+      if (input == NULL)
+	return -1;
+      c->input = input;
+      c->input_size = size;
+    }
+    size_t space = c->input_size - c->input_length;
+    if (space == 0)
+      break;
+    struct http_content_generator_result gen;
+    bzero(&gen, sizeof gen);
+    int ret = r->response.content_generator(r, c->input + c->input_length, space, &gen);
+    if (ret == -1)
+      return -1;
+    assert(gen.generated <= space);
+    c->input_length += gen.generated;
+    c->input_need = gen.need;
+    if (r->phase != PAUSE && ret == 0)
+      c->eof = 1;
+    if (gen.generated || c->input_need <= space)
+      break;
+  }
+  if (c->input_length == 0 && !c->eof && !c->flushing)
+    return 1; // paused with nothing to compress
+  c->stream.next_in = c->input;
+  c->stream.avail_in = c->input_length;
+  c->stream.next_out = buf;
+  c->stream.avail_out = bufsz;
+  int ret = deflate(&c->stream, c->eof ? Z_FINISH : Z_SYNC_FLUSH);
+  if (ret == Z_STREAM_ERROR)
+    return WHY("deflate() failed");
+  // Keep any input that did not fit into the output for next time.
+  size_t consumed = c->input_length - c->stream.avail_in;
+  memmove(c->input, c->input + consumed, c->stream.avail_in);
+  c->input_length = c->stream.avail_in;
+  c->flushing = c->stream.avail_out == 0;
+  result->generated = bufsz - c->stream.avail_out;
+  result->need = COMPRESS_MIN_ROOM;
+  IDEBUGF(r->debug, "Compressed %zu bytes of content into %zu bytes", consumed, result->generated);
+  return ret == Z_STREAM_END ? 0 : 1;
+}
+
+/* Compress all of a static response's content at once into a newly allocated buffer.  Return the
+ * compressed size if it is smaller than the original, otherwise 0.
+ */
+static size_t http_compress_static(struct http_request *r, int gzip, const char *content, size_t length, unsigned char **compressed)
+{
+  *compressed = NULL;
+  z_stream stream;
+  if (http_compressor_init(&stream, r->compress_level, gzip) == -1)
+    return 0;
+  size_t size = deflateBound(&stream, length);
+  size_t compressed_length = 0;
+  if ((*compressed = emalloc(size)) != NULL) {
+    stream.next_in = (unsigned char *) content;
+    stream.avail_in = length;
+    stream.next_out = *compressed;
+    stream.avail_out = size;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out < length)
+      compressed_length = stream.total_out;
+    else {
+      free(*compressed);
+      *compressed = NULL;
+    }
+  }
+  deflateEnd(&stream);
+  return compressed_length;
+}
+
+#else // !HAVE_ZLIB
+
+static void http_compressor_release(struct http_request *UNUSED(r))
+{
+}
+
+#endif // !HAVE_ZLIB
+
+/* Return true if content of the given type is likely to be made smaller by compression.  Content of
+ * other types, such as Rhizome payloads and blobs, is always sent as is, because it is usually
+ * already compressed or encrypted.
+ */
+static int http_content_type_is_compressible(const char *content_type)
+{
+  return strncmp(content_type, "text/", 5) == 0
+      || strncmp(content_type, CONTENT_TYPE_JSON, strlen(CONTENT_TYPE_JSON)) == 0;
+}
+
+/* Call the response's content generator, through the compressor if the content is being
+ * compressed.
+ */
+static int http_request_generate(struct http_request *r, unsigned char *buf, size_t bufsz, struct http_content_generator_result *result)
+{
+#ifdef HAVE_ZLIB
+  if (r->compressor)
+    return http_compressor_generate(r, buf, bufsz, result);
+#endif
+  return r->response.content_generator(r, buf, bufsz, result);
+}
+
 /* Write the current contents of the response buffer to the HTTP socket.  When no more bytes can be
  * written, return so that socket polling can continue.  Once all bytes are sent, if there is a
  * content generator function and the request is not paused, invoke it to put more content in the
@@ -1955,10 +2384,15 @@ static void http_request_send_response(struct http_request *r)
 	RETURNVOID; // nothing left to send
       }
     } else if (r->response.content_generator) {
+      // Chunked content needs room around the generated bytes for the chunk framing.
+      size_t framing = r->response_chunked ? CHUNK_FRAMING : 0;
+      // Content of unknown length is sent as it is generated, about flush_size bytes at a time
+      // (more if the generator needs it), instead of first filling the buffer.
+      size_t flush = r->response_length == CONTENT_LENGTH_UNKNOWN ? r->flush_size : 0;
       // If the buffer is smaller than the content generator needs, and it contains no unsent
       // content, then allocate a larger buffer.
-      if (r->response_buffer_need > r->response_buffer_size && unsent == 0) {
-	if (http_request_set_response_bufsize(r, r->response_buffer_need) == -1) {
+      if (r->response_buffer_need + framing > r->response_buffer_size && unsent == 0) {
+	if (http_request_set_response_bufsize(r, r->response_buffer_need + framing) == -1) {
 	  WHYF("HTTP response truncated at offset=%"PRIhttp_size_t" due to insufficient buffer space",
 	      r->response_sent);
 	  http_request_finalise(r);
@@ -1976,32 +2410,54 @@ static void http_request_send_response(struct http_request *r)
       // more content.
       assert(r->response_buffer_length <= r->response_buffer_size);
       size_t unfilled = r->response_buffer_size - r->response_buffer_length;
-      if (unfilled > 0 && unfilled >= r->response_buffer_need) {
+      if (unfilled > framing && unfilled - framing >= r->response_buffer_need && !(flush && unsent >= flush)) {
 	// The content generator must fill or partly fill the part of the buffer we indicate and
 	// return the number of bytes appended.  If it returns zero, it means it has no more
 	// content (EOF), and must not be called again.  If the return value exceeds the buffer size
 	// we supply, it gives the amount of free space the generator needs in order to append; the
 	// generator will not append any bytes until that much free space is available.  If returns
 	// -1, it means an unrecoverable error occurred, and the generator must not be called again.
+	char *chunk = r->response_buffer + r->response_buffer_length;
+	size_t room = unfilled - framing;
+	if (flush) {
+	  size_t limit = flush > r->response_buffer_need ? flush : r->response_buffer_need;
+	  if (room > limit)
+	    room = limit;
+	}
 	struct http_content_generator_result result;
 	bzero(&result, sizeof result);
-	int ret = r->response.content_generator(r, (unsigned char *) r->response_buffer + r->response_buffer_length, unfilled, &result);
+	int ret = http_request_generate(r, (unsigned char *) chunk + (framing ? CHUNK_HEADER_LEN : 0), room, &result);
 	if (ret == -1) {
 	  WHY("Content generation error, closing connection");
 	  http_request_finalise(r);
 	  RETURNVOID;
 	}
-	assert(result.generated <= unfilled);
+	assert(result.generated <= room);
+	if (framing && result.generated) {
+	  // A fixed-width chunk size, so that the header can be written after the content.
+	  char header[CHUNK_HEADER_LEN + 1];
+	  assert(result.generated <= UINT32_MAX);
+	  sprintf(header, "%08"PRIx32"\r\n", (uint32_t) result.generated);
+	  memcpy(chunk, header, CHUNK_HEADER_LEN);
+	  memcpy(chunk + CHUNK_HEADER_LEN + result.generated, "\r\n", 2);
+	  r->response_buffer_length += CHUNK_HEADER_LEN + 2;
+	}
 	r->response_buffer_length += result.generated;
 	r->response_buffer_need = result.need;
-	if (result.generated == 0 && result.need <= unfilled && r->phase != PAUSE) {
+	if (result.generated == 0 && result.need <= room && r->phase != PAUSE) {
 	  WHYF("HTTP response generator produced no content at offset %"PRIhttp_size_t" (ret=%d)", r->response_sent, ret);
 	  http_request_finalise(r);
 	  RETURNVOID;
 	}
 	IDEBUGF(r->debug, "Generated HTTP %zu bytes of content, need %zu bytes of buffer (ret=%d)", result.generated, result.need, ret);
-	if (r->phase != PAUSE && ret == 0)
+	if (r->phase != PAUSE && ret == 0) {
 	  r->response.content_generator = NULL; // ensure we never invoke again
+	  if (framing) {
+	    // The last chunk, always left room for by the framing.
+	    memcpy(r->response_buffer + r->response_buffer_length, "0\r\n\r\n", 5);
+	    r->response_buffer_length += 5;
+	  }
+	}
 	continue;
       }
     } else if (remaining != CONTENT_LENGTH_UNKNOWN && unsent < remaining) {
@@ -2046,6 +2502,11 @@ static void http_request_send_response(struct http_request *r)
     if ((size_t) written < (size_t) unsent)
       RETURNVOID;
   }
+  if (r->keep_alive && r->phase == TRANSMIT) {
+    IDEBUG(r->debug, "Done, waiting for next request");
+    http_request_reset(r);
+    RETURNVOID;
+  }
   IDEBUG(r->debug, "Done, closing connection");
   http_request_finalise(r);
   OUT();
@@ -2055,7 +2516,8 @@ static void _http_request_start_transmitting(struct http_request *r)
 {
   assert(r->phase == RECEIVE || r->phase == PAUSE);
   r->phase = TRANSMIT;
-  r->alarm.poll.events = POLLIN|POLLOUT;
+  // On a persistent connection, leave any following request unread until this response is sent.
+  r->alarm.poll.events = r->keep_alive ? POLLOUT : POLLIN|POLLOUT;
   watch(&r->alarm);
   http_request_set_idle_timeout(r);
 }
@@ -2323,7 +2785,7 @@ static int _render_response(struct http_request *r)
   assert(hr.header.content_type != NULL);
   assert(hr.header.content_type[0]);
   strbuf_sprintf(sb, "HTTP/1.%d %03u %s\r\n", hr.header.minor_version, hr.status_code, hr.reason);
-  strbuf_puts(sb, "Connection: Close\r\n");
+  strbuf_puts(sb, r->keep_alive ? "Connection: keep-alive\r\n" : "Connection: Close\r\n");
   strbuf_sprintf(sb, "Server: servald %s\r\n", version_servald);
   strbuf_sprintf(sb, "Content-Type: %s", hr.header.content_type);
   if (hr.header.boundary) {
@@ -2350,6 +2812,12 @@ static int _render_response(struct http_request *r)
   }
   if (hr.header.content_length != CONTENT_LENGTH_UNKNOWN)
     strbuf_sprintf(sb, "Content-Length: %"PRIhttp_size_t"\r\n", hr.header.content_length);
+  else if (r->response_chunked)
+    strbuf_puts(sb, "Transfer-Encoding: chunked\r\n");
+  if (hr.header.content_encoding) {
+    strbuf_sprintf(sb, "Content-Encoding: %s\r\n", hr.header.content_encoding);
+    strbuf_puts(sb, "Vary: Accept-Encoding\r\n");
+  }
   if (hr.header.allow_origin.null || hr.header.allow_origin.scheme[0]) {
     strbuf_puts(sb, "Access-Control-Allow-Origin: ");
     if (hr.header.allow_origin.null) {
@@ -2415,6 +2883,17 @@ static int _render_response(struct http_request *r)
  */
 static void http_request_render_response(struct http_request *r)
 {
+  // Generated content of unknown length is sent in chunks to HTTP/1.1 clients, so they can tell
+  // where it ends without waiting for the connection to close.  Older clients can only be sent
+  // such content on a connection that closes afterwards.
+  r->response_chunked = 0;
+  if (!r->response.content && r->response.content_generator
+    && r->response.header.content_length == CONTENT_LENGTH_UNKNOWN) {
+    if (r->version_major == 1 && r->version_minor >= 1 && r->response.header.minor_version >= 1)
+      r->response_chunked = 1;
+    else
+      r->keep_alive = 0;
+  }
   // If there is no response buffer allocated yet, use the available part of the in-struct buffer.
   http_request_set_response_bufsize(r, 1);
   // Try rendering the response into the existing buffer.  This will discover the length of the
@@ -2430,11 +2909,36 @@ static void http_request_render_response(struct http_request *r)
   }
 }
 
+/* Return true if the connection can be left open for another request after this one is answered:
+ * the server must support it, the client must not have asked to close, and all of this request
+ * must have been read, so that the next one can be found.
+ */
+static int http_request_is_persistent(struct http_request *r)
+{
+  if (!r->reset || r->version_major != 1 || r->request_header.connection_close)
+    return 0;
+  if (r->version_minor == 0 && !r->request_header.connection_keep_alive)
+    return 0;
+  return r->request_content_remaining == 0 && r->decoder == NULL && r->parsed == r->end;
+}
+
 static void http_request_start_response(struct http_request *r)
 {
   IN();
   assert(r->phase == RECEIVE);
   _release_reserved(r);
+  ++http_connection_stats.requests;
+  if (r->request_count++)
+    ++http_connection_stats.reused;
+  r->keep_alive = http_request_is_persistent(r);
+  if (r->keep_alive && r->pipelined_length) {
+    // Keep the start of the next request out of the way of the response, at the start of the
+    // buffer where the reserved strings were.
+    memmove(r->buffer, r->pipelined, r->pipelined_length);
+    r->pipelined = r->buffer;
+    r->reserved = r->buffer + r->pipelined_length;
+  } else
+    r->pipelined_length = 0;
   if (r->response.content || r->response.content_generator) {
     assert(r->response.header.content_type != NULL);
     assert(r->response.header.content_type[0]);
@@ -2454,14 +2958,52 @@ static void http_request_start_response(struct http_request *r)
     r->response.content = NULL;
     r->response.content_generator = NULL;
   }
+#ifdef HAVE_ZLIB
+  unsigned char *compressed = NULL;
+  if (   r->compress_level
+      && (r->request_header.accept_gzip || r->request_header.accept_deflate)
+      && r->response.header.content_encoding == NULL
+      && (r->response.content || r->response.content_generator)
+      && http_content_type_is_compressible(r->response.header.content_type)
+  ) {
+    // Prefer gzip, which unlike deflate, all clients agree on how to decode.
+    int gzip = r->request_header.accept_gzip;
+    struct http_response_headers *h = &r->response.header;
+    if (r->response.content_generator && h->content_length == CONTENT_LENGTH_UNKNOWN) {
+      if (http_compressor_start(r, gzip) == 0)
+	h->content_encoding = gzip ? "gzip" : "deflate";
+    } else if (   r->response.content
+	       && h->content_length >= r->compress_min_size
+	       && h->content_range_start == 0
+	       && h->content_length == h->resource_length
+    ) {
+      size_t length = http_compress_static(r, gzip, r->response.content, h->content_length, &compressed);
+      if (length) {
+	IDEBUGF(r->debug, "Compressed %"PRIhttp_size_t" bytes of static content into %zu bytes", h->content_length, length);
+	r->response.content = (const char *) compressed;
+	h->content_length = h->resource_length = length;
+	h->content_encoding = gzip ? "gzip" : "deflate";
+      }
+    }
+  }
+#endif
   // If the response cannot be rendered, then render a 500 Server Error instead.  If that fails,
   // then just close the connection.
   http_request_render_response(r);
+#ifdef HAVE_ZLIB
+  // The rendered response holds its own copy of static content.
+  if (compressed) {
+    free(compressed);
+    r->response.content = NULL;
+  }
+#endif
   if (r->response_buffer == NULL) {
     WHY("Cannot render HTTP response, sending 500 Server Error instead");
+    http_compressor_release(r);
     r->response.status_code = 500;
     r->response.content = NULL;
     r->response.content_generator = NULL;
+    r->response.header.content_encoding = NULL;
     http_request_render_response(r);
     if (r->response_buffer == NULL) {
       WHY("Cannot render HTTP 500 Server Error response, closing connection");
@@ -104,6 +104,10 @@ struct http_request_headers {
   struct http_client_authorization authorization;
   bool_t expect:1;
   bool_t chunked:1;
+  bool_t connection_close:1;
+  bool_t connection_keep_alive:1;
+  bool_t accept_gzip:1;
+  bool_t accept_deflate:1;
 };
 
 struct http_response_headers {
@@ -112,6 +116,7 @@ struct http_response_headers {
   http_size_t content_range_start; // range_end = range_start + content_length - 1
   http_size_t resource_length; // size of entire resource
   const char *content_type; // "type/subtype"
+  const char *content_encoding; // "gzip" or "deflate" if compressed, otherwise NULL
   const char *boundary;
   struct http_origin allow_origin;
   const char *allow_methods;
@@ -170,9 +175,13 @@ struct http_mime_handler {
 };
 
 struct http_request;
+struct http_compressor;
+struct http_arena_block;
 
 void http_request_init(struct http_request *r, int sockfd);
 void http_request_free_response_buffer(struct http_request *r);
+void *http_request_alloc(struct http_request *r, size_t size);
+void *http_request_realloc(struct http_request *r, void *ptr, size_t old_size, size_t new_size);
 int http_request_set_response_bufsize(struct http_request *r, size_t bufsiz);
 void http_request_finalise(struct http_request *r);
 void http_request_pause_response(struct http_request *r, time_ms_t until);
@@ -181,6 +190,29 @@ void http_request_response_static(struct http_request *r, int result, const char
 void http_request_response_generated(struct http_request *r, int result, const char *mime_type, HTTP_CONTENT_GENERATOR *);
 void http_request_simple_response(struct http_request *r, uint16_t result, const char *body);
 
+/* Counts of connections accepted and requests answered by all HTTP servers.  A request is "reused"
+ * if it was not the first on its connection, and "pipelined" if it had already been received
+ * before the previous response was finished.
+ */
+struct http_connection_stats {
+  uint64_t connections;
+  uint64_t requests;
+  uint64_t reused;
+  uint64_t pipelined;
+};
+extern struct http_connection_stats http_connection_stats;
+
+/* Bytes of request memory (see http_request_alloc()) held by all requests now, the most ever held
+ * at once, and the number of allocations refused because a request reached its memory limit.
+ */
+struct http_memory_stats {
+  uint64_t in_use;
+  uint64_t peak;
+  uint64_t refused;
+};
+extern struct http_memory_stats http_memory_stats;
+void http_connection_status_html(strbuf b);
+
 typedef int (HTTP_CONTENT_GENERATOR_STRBUF_CHUNKER)(struct http_request *, strbuf);
 int generate_http_content_from_strbuf_chunks(struct http_request *, char *, size_t, struct http_content_generator_result *, HTTP_CONTENT_GENERATOR_STRBUF_CHUNKER *);
 
@@ -193,6 +225,10 @@ struct http_request {
   enum http_request_phase { RECEIVE, TRANSMIT, PAUSE, DONE } phase;
   void (*finalise)(struct http_request *);
   void (*release)(void*);
+  // If set, the connection is kept open after each response that the client
+  // will accept on a persistent connection, and this is called to release
+  // any per-request state before the next request is parsed.
+  void (*reset)(struct http_request *);
   // Identify request from others being run.  Monotonic counter feeds it.  Only
   // used for debugging when we write post-<uuid>.log files for multi-part form
   // requests.
@@ -205,6 +241,13 @@ struct http_request {
   time_ms_t initiate_time; // time connection was initiated
   time_ms_t idle_timeout; // disconnect if no bytes received for this long
   struct socket_address client_addr; // caller may supply this
+  size_t flush_size; // if non-zero, most generated content of unknown length to send at once
+  int compress_level; // if non-zero, compress text content for clients that accept it
+  size_t compress_min_size; // smallest static content worth compressing
+  size_t memory_limit; // if non-zero, most bytes of request memory one request may hold
+  unsigned request_count; // number of responses started on this connection
+  // Everything from here up to buffer[] is cleared between requests, except
+  // the handle_first_line and handle_headers callbacks.
   // The parsed HTTP request is accumulated into the following fields.
   const char *verb; // points to nul terminated static string, "GET", "PUT", etc.
   const char *path; // points into buffer; nul terminated
@@ -255,6 +298,17 @@ struct http_request {
   size_t response_buffer_length;
   size_t response_buffer_sent;
   void (*response_free_buffer)(void*);
+  bool_t keep_alive; // leave the connection open once the response is sent
+  bool_t response_chunked; // send generated content with chunked transfer encoding
+  // Start of the next request, if the client sent it before this one was
+  // answered.
+  char *pipelined;
+  size_t pipelined_length;
+  // Compresses generated content on its way to the response buffer.
+  struct http_compressor *compressor;
+  // Request memory, all released at once when the request is finished.
+  struct http_arena_block *arena;
+  size_t arena_size;
   // This buffer is used during RECEIVE and TRANSMIT phase.
   char buffer[8 * 1024];
 };
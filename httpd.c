@@ -199,6 +199,22 @@ static unsigned int http_request_uuid_counter = 0;
 static httpd_request * current_httpd_requests = NULL;
 unsigned int current_httpd_request_count = 0;
 
+static void httpd_unwatch(httpd_request *r);
+
+static void httpd_server_release_request(httpd_request *r)
+{
+  rhizome_bundle_result_free(&r->bundle_result);
+  if (r->manifest) {
+    rhizome_manifest_free(r->manifest);
+    r->manifest = NULL;
+  }
+  if (r->finalise_union) {
+    r->finalise_union(r);
+    r->finalise_union = NULL;
+  }
+  httpd_unwatch(r);
+}
+
 static void httpd_server_finalise_http_request(struct http_request *hr)
 {
   httpd_request *r = (httpd_request *) hr;
@@ -223,15 +239,19 @@ static void httpd_server_finalise_http_request(struct http_request *hr)
   if (current_httpd_requests == NULL) {
     assert(current_httpd_request_count == 0);
   }
-  rhizome_bundle_result_free(&r->bundle_result);
-  if (r->manifest) {
-    rhizome_manifest_free(r->manifest);
-    r->manifest = NULL;
-  }
-  if (r->finalise_union) {
-    r->finalise_union(r);
-    r->finalise_union = NULL;
-  }
+  httpd_server_release_request(r);
+}
+
+/* Between requests on a persistent connection, return the request to the state it was in when
+ * the connection was accepted.
+ */
+static void httpd_server_reset_http_request(struct http_request *hr)
+{
+  httpd_request *r = (httpd_request *) hr;
+  httpd_server_release_request(r);
+  bzero(&r->manifest, sizeof *r - offsetof(httpd_request, manifest));
+  r->payload_status = INVALID_RHIZOME_PAYLOAD_STATUS; // will cause FATAL unless set
+  r->bundle_result = INVALID_RHIZOME_BUNDLE_RESULT; // will cause FATAL unless set
 }
 
 void httpd_server_poll(struct sched_ent *alarm)
@@ -271,7 +291,12 @@ void httpd_server_poll(struct sched_ent *alarm)
 	request->http.disable_tx = INDIRECT_CONFIG_DEBUG(nohttptx);
 	request->http.finalise = httpd_server_finalise_http_request;
 	request->http.release = free;
+	request->http.reset = httpd_server_reset_http_request;
 	request->http.idle_timeout = RHIZOME_IDLE_TIMEOUT;
+	request->http.flush_size = config.api.restful.flush_size;
+	request->http.compress_level = config.api.restful.compress_level;
+	request->http.compress_min_size = config.api.restful.compress_min_size;
+	request->http.memory_limit = config.api.restful.request_memory_limit;
 	http_request_init(&request->http, sock);
       }
     }
@@ -281,14 +306,150 @@ void httpd_server_poll(struct sched_ent *alarm)
   }
 }
 
-static void trigger_rhizome_bundle_added(rhizome_manifest *m)
+#define WATCH_BUCKETS 64
+
+static struct httpd_watch *watch_buckets[WATCH_BUCKETS];
+static unsigned watching_count = 0; // requests with at least one watch
+struct httpd_watch_stats httpd_watch_stats;
+
+void httpd_watch_status_html(strbuf b)
+{
+  strbuf_sprintf(b, "HTTP requests waiting for bundles: %u, bundles added: %"PRIu64", requests woken: %"PRIu64", not woken: %"PRIu64"<br>",
+    watching_count,
+    httpd_watch_stats.bundles,
+    httpd_watch_stats.woken,
+    httpd_watch_stats.skipped);
+}
+
+// FNV-1a, over the service name (if any) followed by the identifier (if any).
+static uint32_t watch_key(const char *service, const unsigned char *id, size_t idlen)
+{
+  uint32_t hash = 2166136261u;
+  if (service)
+    for (; *service; ++service)
+      hash = (hash ^ (unsigned char) *service) * 16777619u;
+  hash = (hash ^ 0xff) * 16777619u;
+  size_t i;
+  for (i = 0; i < idlen; ++i)
+    hash = (hash ^ id[i]) * 16777619u;
+  return hash;
+}
+
+// A conversation is the same whichever way round its two parties are given.
+static uint32_t watch_conversation_key(const char *service, const sid_t *sid1, const sid_t *sid2)
 {
-  httpd_request *r;
-  for (r = current_httpd_requests; r; r = r->next) {
-    if (r->trigger_rhizome_bundle_added) {
+  unsigned char id[SID_SIZE];
+  unsigned i;
+  for (i = 0; i < SID_SIZE; ++i)
+    id[i] = sid1->binary[i] ^ sid2->binary[i];
+  return watch_key(service, id, sizeof id);
+}
+
+static void httpd_watch(httpd_request *r, uint32_t key)
+{
+  unsigned i;
+  for (i = 0; i < HTTPD_WATCHES && r->watch[i].request; ++i)
+    ;
+  assert(i < HTTPD_WATCHES);
+  if (i == 0)
+    ++watching_count;
+  struct httpd_watch *w = &r->watch[i];
+  struct httpd_watch **bucket = &watch_buckets[key % WATCH_BUCKETS];
+  w->request = r;
+  w->key = key;
+  w->prev = NULL;
+  w->next = *bucket;
+  if (w->next)
+    w->next->prev = w;
+  *bucket = w;
+}
+
+static void httpd_unwatch(httpd_request *r)
+{
+  if (r->watch[0].request) {
+    assert(watching_count > 0);
+    --watching_count;
+  }
+  unsigned i;
+  for (i = 0; i < HTTPD_WATCHES && r->watch[i].request; ++i) {
+    struct httpd_watch *w = &r->watch[i];
+    if (w->next)
+      w->next->prev = w->prev;
+    if (w->prev)
+      w->prev->next = w->next;
+    else {
+      assert(watch_buckets[w->key % WATCH_BUCKETS] == w);
+      watch_buckets[w->key % WATCH_BUCKETS] = w->next;
+    }
+  }
+  bzero(r->watch, sizeof r->watch);
+}
+
+/* Every added bundle wakes the request.
+ */
+void httpd_watch_all_bundles(httpd_request *r)
+{
+  httpd_watch(r, watch_key(NULL, NULL, 0));
+}
+
+/* Every added bundle of the given service wakes the request.
+ */
+void httpd_watch_service(httpd_request *r, const char *service)
+{
+  httpd_watch(r, watch_key(service, NULL, 0));
+}
+
+/* Every new version of the given bundle wakes the request.
+ */
+void httpd_watch_bundle(httpd_request *r, const rhizome_bid_t *bid)
+{
+  httpd_watch(r, watch_key(NULL, bid->binary, sizeof bid->binary));
+}
+
+/* Every added bundle of the given service between the two parties, in either direction, wakes
+ * the request.
+ */
+void httpd_watch_conversation(httpd_request *r, const char *service, const sid_t *sid1, const sid_t *sid2)
+{
+  httpd_watch(r, watch_conversation_key(service, sid1, sid2));
+}
+
+/* Call the trigger of every request that watches the given key, unless another of its watches
+ * already woke it for this bundle.  Keys that fall into the same bucket are told apart by
+ * comparing the whole key; requests whose keys are equal by chance are woken needlessly, so
+ * triggers must still check that the bundle is the one they want.
+ */
+static unsigned wake_watchers(uint32_t key, rhizome_manifest *m)
+{
+  unsigned woken = 0;
+  struct httpd_watch *w = watch_buckets[key % WATCH_BUCKETS];
+  while (w) {
+    struct httpd_watch *next = w->next;
+    httpd_request *r = w->request;
+    if (w->key == key && r->trigger_rhizome_bundle_added && r->watch_woken != httpd_watch_stats.bundles) {
+      r->watch_woken = httpd_watch_stats.bundles;
       (*r->trigger_rhizome_bundle_added)(r, m);
+      ++woken;
     }
+    w = next;
   }
+  return woken;
+}
+
+static void trigger_rhizome_bundle_added(rhizome_manifest *m)
+{
+  unsigned waiting = watching_count;
+  ++httpd_watch_stats.bundles;
+  unsigned woken = wake_watchers(watch_key(NULL, NULL, 0), m);
+  woken += wake_watchers(watch_key(NULL, m->keypair.public_key.binary, sizeof m->keypair.public_key.binary), m);
+  if (m->service) {
+    woken += wake_watchers(watch_key(m->service, NULL, 0), m);
+    if (m->has_sender && m->has_recipient)
+      woken += wake_watchers(watch_conversation_key(m->service, &m->sender, &m->recipient), m);
+  }
+  httpd_watch_stats.woken += woken;
+  if (waiting > woken)
+    httpd_watch_stats.skipped += waiting - woken;
 }
 
 DEFINE_TRIGGER(bundle_add, trigger_rhizome_bundle_added);
@@ -417,7 +578,7 @@ int form_buf_malloc_accumulate(httpd_request *r, const char *partname, struct fo
   if (len == 0)
     return 0;
   size_t newlen = f->length + len;
-  if (newlen > f->size_limit) {
+  if (f->size_limit && newlen > f->size_limit) {
     DEBUGF(httpd, "form part \"%s\" overflow, %zu bytes exceeds limit %zu by %zu",
 	   partname, newlen, f->size_limit, (size_t)(newlen - f->size_limit)
       );
@@ -427,23 +588,30 @@ int form_buf_malloc_accumulate(httpd_request *r, const char *partname, struct fo
     return 400;
   }
   if (newlen > f->buffer_alloc_size) {
-    if ((f->buffer = erealloc(f->buffer, newlen)) == NULL) {
+    // Grow by doubling, because space given up by a move is not reused until the request ends.
+    size_t size = f->buffer_alloc_size * 2;
+    if (size < newlen)
+      size = newlen;
+    if (f->size_limit && size > f->size_limit)
+      size = f->size_limit;
+    char *buffer = http_request_realloc(&r->http, f->buffer, f->buffer_alloc_size, size);
+    if (buffer == NULL) {
       http_request_simple_response(&r->http, 500, NULL);
       return 500;
     }
-    f->buffer_alloc_size = newlen;
+    f->buffer = buffer;
+    f->buffer_alloc_size = size;
   }
   memcpy(f->buffer + f->length, buf, len);
   f->length = newlen;
   return 0;
 }
 
+/* The buffer is request memory (see http_request_alloc()), so is freed with the request.
+ */
 void form_buf_malloc_release(struct form_buf_malloc *f)
 {
-  if (f->buffer) {
-    free(f->buffer);
-    f->buffer = NULL;
-  }
+  f->buffer = NULL;
   f->buffer_alloc_size = 0;
   f->length = 0;
   f->size_limit = 0;
@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "keyring.h"
 #include "meshms.h"
 #include "os.h"
+#include "trace.h"
 
 int is_httpd_server_running();
 
@@ -45,6 +46,27 @@ struct form_buf_malloc {
 struct httpd_request;
 struct meshmb_session;
 
+/* A request's subscription to added Rhizome bundles, kept in a hash index by key so that adding
+ * a bundle only wakes the requests that are waiting for it.
+ */
+struct httpd_watch {
+  struct httpd_request *request; // NULL if unused
+  struct httpd_watch *next;
+  struct httpd_watch *prev;
+  uint32_t key;
+};
+
+#define HTTPD_WATCHES 2
+
+struct httpd_watch_stats {
+  uint64_t bundles; // bundles added
+  uint64_t woken; // requests woken by them
+  uint64_t skipped; // requests waiting on other bundles, which were not woken
+};
+
+extern struct httpd_watch_stats httpd_watch_stats;
+void httpd_watch_status_html(strbuf b);
+
 int form_buf_malloc_init(struct form_buf_malloc *, size_t size_limit);
 int form_buf_malloc_accumulate(struct httpd_request *, const char *partname, struct form_buf_malloc *, const char *, size_t);
 void form_buf_malloc_release(struct form_buf_malloc *);
@@ -53,11 +75,16 @@ typedef struct httpd_request
 {
   struct http_request http; // MUST BE FIRST ELEMENT
 
-  /* Doubly-linked list of current requests.  Used to pass triggers to requests.
+  /* Doubly-linked list of current requests.
    */
   struct httpd_request *next;
   struct httpd_request *prev;
 
+  /* Which added bundles to call trigger_rhizome_bundle_added for, set by httpd_watch_*().
+   */
+  struct httpd_watch watch[HTTPD_WATCHES];
+  uint64_t watch_woken; // the last added bundle (counting from 1) that woke this request
+
   /* For requests/responses that pertain to a single manifest.
    */
   rhizome_manifest *manifest;
@@ -148,6 +175,10 @@ typedef struct httpd_request
     */
     struct rhizome_read read_state;
 
+    /* For responses that export the event trace.
+    */
+    struct trace_cursor trace;
+
     /* For responses that list SIDs.
     */
     struct {
@@ -194,6 +225,13 @@ typedef struct httpd_request
       struct meshms_message_iterator iter;
       unsigned dirty;
       int finished;
+      // For a page of messages; the message before which to start (both offsets zero for the
+      // newest) and the timestamp in effect there, and the most messages to list (zero for no limit)
+      uint64_t before_my_offset;
+      uint64_t before_their_offset;
+      uint64_t before_timestamp;
+      uint32_t limit;
+      uint32_t listed;
     }
       msglist;
 
@@ -209,6 +247,27 @@ typedef struct httpd_request
     }
       sendmsg;
 
+    /* For responses that send a batch of MeshMS messages.
+    */
+    struct {
+      // Which part is currently being received
+      const char *current_part;
+      // The recipient of the message parts that follow, as received
+      char recipient_text[SID_STRLEN + 1];
+      size_t recipient_text_len;
+      bool_t received_recipient;
+      sid_t recipient;
+      // The text of every message received so far, one after another
+      struct form_buf_malloc text;
+      // Where the text of the message part being received starts
+      size_t message_start;
+      // The messages received so far, in request memory
+      struct meshms_batch_message *messages;
+      unsigned count;
+      unsigned alloc;
+    }
+      sendmsgs;
+
     struct{
       struct message_ply_read ply_reader;
       enum list_phase phase;
@@ -241,6 +300,24 @@ typedef struct httpd_request
       size_t offset;
     }
       file;
+
+    /* For responses that stream events as they happen.
+    */
+    struct {
+      unsigned types; // EVENT_ bits
+      char *service; // if not NULL, only bundles of this service
+      bool_t recipient_set; // if set, only MeshMS messages to sid1
+      // Events waiting to be sent
+      char *queue;
+      size_t queue_length;
+      size_t queue_size;
+      unsigned lost; // events dropped because the queue was full
+      time_ms_t keepalive_time;
+      // Doubly-linked list of requests waiting for peer events
+      struct httpd_request *next_peer_listener;
+      struct httpd_request *prev_peer_listener;
+    }
+      events;
   } u;
 
 } httpd_request;
@@ -263,6 +340,11 @@ DECLARE_SECTION(struct http_handler, httpd);
     .parser=FUNC\
   }
 
+void httpd_watch_all_bundles(httpd_request *r);
+void httpd_watch_service(httpd_request *r, const char *service);
+void httpd_watch_bundle(httpd_request *r, const rhizome_bid_t *bid);
+void httpd_watch_conversation(httpd_request *r, const char *service, const sid_t *sid1, const sid_t *sid2);
+
 int is_http_header_complete(const char *buf, size_t len, size_t read_since_last_call);
 int authorize_restful(struct http_request *r);
 int http_response_content_type(httpd_request *r, uint16_t result, const char *what, const struct mime_content_type *ct);
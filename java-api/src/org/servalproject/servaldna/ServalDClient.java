@@ -59,6 +59,7 @@ import java.io.UnsupportedEncodingException;
 import java.net.HttpURLConnection;
 import java.net.URL;
 import java.net.URLConnection;
+import java.util.Map;
 import java.util.Vector;
 
 public class ServalDClient implements ServalDHttpConnectionFactory {
@@ -191,6 +192,11 @@ public class ServalDClient implements ServalDHttpConnectionFactory {
 		return MeshMSCommon.sendMessage(this, sid1, sid2, text);
 	}
 
+	public MeshMSStatus meshmsSendMessages(SubscriberId sid1, Map<SubscriberId, ? extends Iterable<String>> messages) throws IOException, ServalDInterfaceException, MeshMSException
+	{
+		return MeshMSCommon.sendMessages(this, sid1, messages);
+	}
+
 	public MeshMSStatus meshmsMarkAllConversationsRead(SubscriberId sid1) throws IOException, ServalDInterfaceException, MeshMSException
 	{
 		return MeshMSCommon.markAllConversationsRead(this, sid1);
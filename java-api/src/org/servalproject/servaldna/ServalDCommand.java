@@ -747,6 +747,18 @@ public class ServalDCommand
 				message);
 	}
 
+	@Deprecated
+	public static void sendMessages(final SubscriberId sender, final SubscriberId recipient, String... messages) throws ServalDFailureException {
+		String[] args = new String[5 + messages.length];
+		args[0] = "meshms";
+		args[1] = "send";
+		args[2] = "messages";
+		args[3] = sender.toHex();
+		args[4] = recipient.toHex();
+		System.arraycopy(messages, 0, args, 5, messages.length);
+		command(args);
+	}
+
 	@Deprecated
 	public static void readMessage(final SubscriberId sender, final SubscriberId recipient) throws ServalDFailureException {
 		command("meshms", "read", "messages",
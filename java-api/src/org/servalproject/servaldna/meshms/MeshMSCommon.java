@@ -22,6 +22,7 @@ package org.servalproject.servaldna.meshms;
 
 import org.servalproject.json.JSONInputException;
 import org.servalproject.json.JSONTokeniser;
+import org.servalproject.servaldna.AbstractId;
 import org.servalproject.servaldna.PostHelper;
 import org.servalproject.servaldna.ServalDFailureException;
 import org.servalproject.servaldna.ServalDHttpConnectionFactory;
@@ -31,6 +32,9 @@ import org.servalproject.servaldna.SubscriberId;
 import java.io.IOException;
 import java.net.HttpURLConnection;
 import java.net.URL;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Map;
 
 public class MeshMSCommon
 {
@@ -67,6 +71,7 @@ public class MeshMSCommon
 		public String http_status_message;
 		public MeshMSStatus meshms_status_code;
 		public String meshms_status_message;
+		public List<SubscriberId> failed_recipients;
 	}
 
 	protected static Status decodeRestfulStatus(JSONTokeniser json) throws IOException, ServalDInterfaceException
@@ -91,6 +96,16 @@ public class MeshMSCommon
 				json.consume(JSONTokeniser.Token.COLON);
 				status.meshms_status_message = json.consume(String.class);
 				tok = json.nextToken();
+				if (tok == JSONTokeniser.Token.COMMA) {
+					json.consume("failed_recipients");
+					json.consume(JSONTokeniser.Token.COLON);
+					List<String> hexes = new ArrayList<String>();
+					json.consumeArray(hexes, String.class);
+					status.failed_recipients = new ArrayList<SubscriberId>();
+					for (String hex : hexes)
+						status.failed_recipients.add(new SubscriberId(hex));
+					tok = json.nextToken();
+				}
 			}
 			json.match(tok, JSONTokeniser.Token.END_OBJECT);
 			json.consume(JSONTokeniser.Token.EOF);
@@ -99,6 +114,9 @@ public class MeshMSCommon
 		catch (JSONInputException e) {
 			throw new ServalDInterfaceException("malformed JSON status response", e);
 		}
+		catch (AbstractId.InvalidHexException e) {
+			throw new ServalDInterfaceException("invalid JSON status response", e);
+		}
 	}
 
 	protected static void throwRestfulResponseExceptions(Status status, URL url) throws MeshMSException, ServalDFailureException
@@ -106,6 +124,8 @@ public class MeshMSCommon
 		if (status.meshms_status_code == null) {
 			throw new ServalDFailureException("missing meshms_status_code from " + url);
 		}
+		if (status.failed_recipients != null)
+			throw new MeshMSSendFailedException(url, status.failed_recipients);
 		switch (status.meshms_status_code) {
 		case OK:
 		case UPDATED:
@@ -144,6 +164,28 @@ public class MeshMSCommon
 		return status.meshms_status_code;
 	}
 
+	public static MeshMSStatus sendMessages(ServalDHttpConnectionFactory connector, SubscriberId sid1, Map<SubscriberId, ? extends Iterable<String>> messages) throws IOException, ServalDInterfaceException, MeshMSException
+	{
+		HttpURLConnection conn = connector.newServalDHttpConnection("/restful/meshms/" + sid1.toHex() + "/sendmessages");
+		PostHelper helper = new PostHelper(conn);
+		helper.connect();
+		for (Map.Entry<SubscriberId, ? extends Iterable<String>> entry : messages.entrySet()) {
+			helper.writeField("recipient", entry.getKey());
+			for (String text : entry.getValue())
+				helper.writeField("message", text);
+		}
+		helper.close();
+		// If only some recipients' messages were sent, the error response says which ones were not.
+		if (conn.getResponseCode() == HttpURLConnection.HTTP_INTERNAL_ERROR && "application/json".equals(conn.getContentType())) {
+			Status status = decodeRestfulStatus(new JSONTokeniser(conn.getErrorStream()));
+			throwRestfulResponseExceptions(status, conn.getURL());
+		}
+		JSONTokeniser json = MeshMSCommon.receiveRestfulResponse(conn, HttpURLConnection.HTTP_CREATED);
+		Status status = decodeRestfulStatus(json);
+		throwRestfulResponseExceptions(status, conn.getURL());
+		return status.meshms_status_code;
+	}
+
 	public static MeshMSStatus markAllConversationsRead(ServalDHttpConnectionFactory connector, SubscriberId sid1) throws IOException, ServalDInterfaceException, MeshMSException
 	{
 		HttpURLConnection conn = connector.newServalDHttpConnection("/restful/meshms/" + sid1.toHex() + "/readall");
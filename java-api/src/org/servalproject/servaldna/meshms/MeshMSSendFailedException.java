@@ -0,0 +1,41 @@
+/**
+ * Copyright (C) 2026 Serval Project Inc.
+ *
+ * This file is part of Serval Software (http://www.servalproject.org)
+ *
+ * Serval Software is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this source code; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+package org.servalproject.servaldna.meshms;
+
+import org.servalproject.servaldna.SubscriberId;
+
+import java.net.URL;
+import java.util.List;
+
+/**
+ * Thrown when only some of a batch of messages was sent.  The messages to every recipient not in
+ * failedRecipients were sent, so only those to the failed recipients should be sent again.
+ */
+public class MeshMSSendFailedException extends MeshMSException
+{
+	public final List<SubscriberId> failedRecipients;
+
+	public MeshMSSendFailedException(URL url, List<SubscriberId> failedRecipients) {
+		super("MeshMS messages not sent to " + failedRecipients.size() + " recipient(s)", url);
+		this.failedRecipients = failedRecipients;
+	}
+
+}
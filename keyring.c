@@ -19,7 +19,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include <stdio.h>
+#include <inttypes.h>
+#include <ctype.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "serval.h"
 #include "conf.h"
 #include "constants.h"
@@ -33,6 +37,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "rotbuf.h"
 #include "route_link.h"
 #include "commandline.h"
+#include "strbuf.h"
 
 static keyring_file *keyring_open_or_create(const char *path, int writeable);
 static int keyring_initialise(keyring_file *k);
@@ -214,29 +219,178 @@ keypair *keyring_identity_keytype(const keyring_identity *id, unsigned keytype)
   return kp;
 }
 
+/* Every identity in a keyring is hashed by its SID, signing key and DID, so that the lookups made
+ * for each incoming packet, MeshMS operation and REST request don't scan the whole identity list.
+ * Each bucket is a chain of identities in the same order as the identity list.
+ */
+#define KEYRING_INDEX_MIN_SIZE (16)
+
+#define INDEX_APPEND(HEAD, ID, LINK) do { \
+    keyring_identity **_p = (HEAD); \
+    while (*_p) \
+      _p = &(*_p)->LINK; \
+    *_p = (ID); \
+    (ID)->LINK = NULL; \
+  } while (0)
+
+#define INDEX_REMOVE(HEAD, ID, LINK) do { \
+    keyring_identity **_p = (HEAD); \
+    while (*_p && *_p != (ID)) \
+      _p = &(*_p)->LINK; \
+    if (*_p) \
+      *_p = (ID)->LINK; \
+    (ID)->LINK = NULL; \
+  } while (0)
+
+// Public keys are uniformly distributed, so their leading bytes make a good hash.
+static unsigned keyring_hash_key(const uint8_t *key)
+{
+  return key[0] | key[1] << 8 | key[2] << 16 | (unsigned)key[3] << 24;
+}
+
+// FNV-1a, folding case to match the strcasecmp() comparison of DIDs.
+static unsigned keyring_hash_did(const char *did)
+{
+  unsigned hash = 2166136261u;
+  for (; *did; ++did)
+    hash = (hash ^ (unsigned char)tolower((unsigned char)*did)) * 16777619u;
+  return hash;
+}
+
+static const char *keyring_identity_did(const keyring_identity *id)
+{
+  keypair *kp = keyring_identity_keytype(id, KEYTYPE_DID);
+  return kp && kp->private_key[0] ? (const char *)kp->private_key : NULL;
+}
+
+static void keyring_index_add_did(keyring_file *k, keyring_identity *id)
+{
+  const char *did = keyring_identity_did(id);
+  if (k->index_size && did)
+    INDEX_APPEND(&k->did_index[keyring_hash_did(did) & (k->index_size - 1)], id, did_next);
+}
+
+static void keyring_index_remove_did(keyring_file *k, keyring_identity *id)
+{
+  const char *did = keyring_identity_did(id);
+  if (k->index_size && did)
+    INDEX_REMOVE(&k->did_index[keyring_hash_did(did) & (k->index_size - 1)], id, did_next);
+}
+
+static void keyring_index_add(keyring_file *k, keyring_identity *id)
+{
+  if (!k->index_size)
+    return;
+  unsigned mask = k->index_size - 1;
+  if (id->box_pk)
+    INDEX_APPEND(&k->sid_index[keyring_hash_key(id->box_pk->binary) & mask], id, sid_next);
+  if (id->sign_keypair)
+    INDEX_APPEND(&k->sign_index[keyring_hash_key(id->sign_keypair->public_key.binary) & mask], id, sign_next);
+  keyring_index_add_did(k, id);
+}
+
+static void keyring_index_remove(keyring_file *k, keyring_identity *id)
+{
+  assert(k->identity_count > 0);
+  k->identity_count--;
+  if (!k->index_size)
+    return;
+  unsigned mask = k->index_size - 1;
+  if (id->box_pk)
+    INDEX_REMOVE(&k->sid_index[keyring_hash_key(id->box_pk->binary) & mask], id, sid_next);
+  if (id->sign_keypair)
+    INDEX_REMOVE(&k->sign_index[keyring_hash_key(id->sign_keypair->public_key.binary) & mask], id, sign_next);
+  keyring_index_remove_did(k, id);
+}
+
+/* Rehash every identity into a table of the given size.  If the new table cannot be allocated, the
+ * old one stays in use; it still works, with longer chains.
+ */
+static void keyring_index_resize(keyring_file *k, unsigned size)
+{
+  keyring_identity **buckets = emalloc_zero(sizeof(keyring_identity *) * size * 3);
+  if (!buckets)
+    return;
+  free(k->sid_index);
+  k->index_size = size;
+  k->sid_index = buckets;
+  k->sign_index = buckets + size;
+  k->did_index = buckets + size * 2;
+  keyring_identity *id;
+  for (id = k->identities; id; id = id->next)
+    keyring_index_add(k, id);
+}
+
+/* Must be called after the identity has been appended to the identity list. */
+static void keyring_index_insert(keyring_file *k, keyring_identity *id)
+{
+  k->identity_count++;
+  if (k->identity_count > k->index_size) {
+    unsigned size = k->index_size;
+    keyring_index_resize(k, size ? size * 2 : KEYRING_INDEX_MIN_SIZE);
+    if (k->index_size != size)
+      return;
+  }
+  keyring_index_add(k, id);
+}
+
+static int is_did_wildcard(const char *did)
+{
+  return !did[0] || (did[0]=='*' && did[1]==0);
+}
+
+/* Wildcard searches visit every identity in the list.  Searches for a specific DID only visit the
+ * identities in the DID's hash chain, so the iterator must not be moved between calls.
+ */
 keypair *keyring_find_did(keyring_iterator *it, const char *did)
 {
   keypair *kp;
+  keyring_file *k = it->file;
+  if (!is_did_wildcard(did) && k->index_size) {
+    keyring_identity *id = it->identity
+      ? it->identity->did_next
+      : k->did_index[keyring_hash_did(did) & (k->index_size - 1)];
+    for (; id; id = id->did_next) {
+      if ((kp = keyring_identity_keytype(id, KEYTYPE_DID)) && strcasecmp(did, (char *)kp->private_key) == 0) {
+	it->identity = id;
+	it->keypair = kp;
+	return kp;
+      }
+    }
+    it->identity = NULL;
+    it->keypair = NULL;
+    return NULL;
+  }
   while((kp=keyring_next_keytype(it, KEYTYPE_DID))){
-    if ((!did[0])
-	||(did[0]=='*'&&did[1]==0)
-	||(!strcasecmp(did,(char *)kp->private_key))
-    ) {
+    if (is_did_wildcard(did) || !strcasecmp(did,(char *)kp->private_key))
       return kp;
-    }
   }
   return NULL;
 }
 
 keyring_identity *keyring_find_identity_sid(keyring_file *k, const sid_t *sidp){
-  keyring_identity *id = k->identities;
+  keyring_identity *id;
+  if (k->index_size) {
+    id = k->sid_index[keyring_hash_key(sidp->binary) & (k->index_size - 1)];
+    while(id && cmp_sid_t(id->box_pk,sidp)!=0)
+      id = id->sid_next;
+    return id;
+  }
+  id = k->identities;
   while(id && (!id->box_pk || cmp_sid_t(id->box_pk,sidp)!=0))
     id = id->next;
   return id;
 }
 
 keyring_identity *keyring_find_identity(keyring_file *k, const identity_t *sign){
-  keyring_identity *id = k->identities;
+  keyring_identity *id;
+  if (k->index_size) {
+    id = k->sign_index[keyring_hash_key(sign->binary) & (k->index_size - 1)];
+    while(id && cmp_identity_t(&id->sign_keypair->public_key, sign)!=0)
+      id = id->sign_next;
+    return id;
+  }
+  id = k->identities;
   while(id && (!id->box_pk || cmp_identity_t(&id->sign_keypair->public_key, sign)!=0))
     id = id->next;
   return id;
@@ -272,6 +426,15 @@ static void wipestr(char *str)
     *str++ = ' ';
 }
 
+// Put a dummy no-op trigger callback into the "identity_release" trigger section,
+// otherwise if no other object provides one, the link will fail with errors like:
+// undefined reference to `__start_tr_identity_release'
+// undefined reference to `__stop_tr_identity_release'
+
+static void __dummy_on_identity_release();
+DEFINE_TRIGGER(identity_release, __dummy_on_identity_release);
+static void __dummy_on_identity_release() {}
+
 void keyring_free(keyring_file *k)
 {
   if (!k) return;
@@ -310,8 +473,10 @@ void keyring_free(keyring_file *k)
   while(k->identities){
     keyring_identity *i = k->identities;
     k->identities=i->next;
+    CALL_TRIGGER(identity_release, i);
     keyring_free_identity(i);
   }
+  free(k->sid_index);
   
   /* Wipe everything, just to be sure. */
   bzero(k,sizeof(keyring_file));
@@ -327,6 +492,8 @@ int keyring_release_identities_by_pin(keyring_file *f, const char *pin)
     keyring_identity *id = (*i);
     if (id->PKRPin && strcmp(id->PKRPin, pin) == 0){
       (*i) = id->next;
+      keyring_index_remove(f, id);
+      CALL_TRIGGER(identity_release, id);
       keyring_free_identity(id);
     }else{
       i=&id->next;
@@ -342,6 +509,8 @@ int keyring_release_subscriber(keyring_file *k, const sid_t *sid)
     keyring_identity *id = (*i);
     if (cmp_sid_t(id->box_pk,sid)==0){
       (*i) = id->next;
+      keyring_index_remove(k, id);
+      CALL_TRIGGER(identity_release, id);
       keyring_free_identity(id);
       return 0;
     }
@@ -1216,34 +1385,30 @@ static int keyring_finalise_identity(uint8_t *dirty, keyring_identity *id)
 }
 
 
-/* Read the slot, and try to decrypt it.  Decryption is symmetric with encryption, so the same
+/* Try to decrypt a copy of one slot's page.  Decryption is symmetric with encryption, so the same
  * function is used for munging the slot before making use of it, whichever way we are going.  Once
  * munged, we then need to verify that the slot is valid, and if so unpack the details of the
- * identity.
+ * identity.  Only reads the keyring, so may be called from several threads at once.
  */
-static int keyring_decrypt_pkr(keyring_file *k, const char *pin, int slot_number)
+static keyring_identity *keyring_decrypt_pkr(const keyring_file *k, const char *pin, unsigned slot_number, const unsigned char *page)
 {
-  DEBUGF(keyring, "k=%p, pin=%s slot_number=%d", k, alloca_str_toprint(pin), slot_number);
+  DEBUGF(keyring, "k=%p, pin=%s slot_number=%u", k, alloca_str_toprint(pin), slot_number);
   unsigned char slot[KEYRING_PAGE_SIZE];
+  unsigned char hash[crypto_hash_sha512_BYTES];
   keyring_identity *id=NULL;
 
-  /* 1. Read slot. */
-  if (fseeko(k->file,slot_number*KEYRING_PAGE_SIZE,SEEK_SET))
-    return WHY_perror("fseeko");
-  if (fread(slot, KEYRING_PAGE_SIZE, 1, k->file) != 1)
-    return WHY_perror("fread");
-  /* 2. Decrypt data from slot. */
+  memcpy(slot, page, KEYRING_PAGE_SIZE);
+  /* 1. Decrypt data from slot. */
   if (keyring_munge_block(slot, KEYRING_PAGE_SIZE, k->KeyRingSalt, k->KeyRingSaltLen, k->KeyRingPin, pin)) {
     WHYF("keyring_munge_block() failed, slot=%u", slot_number);
     goto kdp_safeexit;
   }
-  /* 3. Unpack contents of slot into a new identity in the provided context. */
+  /* 2. Unpack contents of slot into a new identity in the provided context. */
   DEBUGF(keyring, "unpack slot %u", slot_number);
   if (((id = keyring_unpack_identity(slot, pin)) == NULL))
     goto kdp_safeexit; // Not a valid slot
   id->slot = slot_number;
-  /* 4. Verify that slot is self-consistent (check MAC) */
-  unsigned char hash[crypto_hash_sha512_BYTES];
+  /* 3. Verify that slot is self-consistent (check MAC) */
   if (keyring_identity_mac(id, slot, hash))
     goto kdp_safeexit;
   /* compare hash to record */
@@ -1255,11 +1420,8 @@ static int keyring_decrypt_pkr(keyring_file *k, const char *pin, int slot_number
     }
     goto kdp_safeexit;
   }
-
-  if (keyring_commit_identity(k, id)!=1)
-    goto kdp_safeexit;
-
-  return 0;
+  bzero(slot,KEYRING_PAGE_SIZE);
+  return id;
 
  kdp_safeexit:
   /* Clean up any potentially sensitive data before exiting */
@@ -1267,9 +1429,71 @@ static int keyring_decrypt_pkr(keyring_file *k, const char *pin, int slot_number
   bzero(hash,crypto_hash_sha512_BYTES);
   if (id)
     keyring_free_identity(id);
-  return 1;
+  return NULL;
 }
 
+/* The occupied slots of a keyring, and the identities that a PIN unlocks from them.
+ */
+struct keyring_trial {
+  const keyring_file *k;
+  const char *pin;
+  const unsigned char *pages; // the whole keyring file
+  const unsigned *slots;
+  keyring_identity **found;
+  unsigned count;
+  unsigned next;
+};
+
+static void keyring_trial_slots(struct keyring_trial *trial)
+{
+  unsigned i;
+#ifdef HAVE_PTHREAD
+  while ((i = __atomic_fetch_add(&trial->next, 1, __ATOMIC_RELAXED)) < trial->count)
+#else
+  for (i = 0; i < trial->count; i++)
+#endif
+    trial->found[i] = keyring_decrypt_pkr(trial->k, trial->pin, trial->slots[i], trial->pages + trial->slots[i] * KEYRING_PAGE_SIZE);
+}
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+#define KEYRING_TRIAL_THREADS 8
+#define KEYRING_TRIAL_SLOTS_PER_THREAD 16
+
+static void *keyring_trial_thread(void *context)
+{
+  keyring_trial_slots((struct keyring_trial *)context);
+  return NULL;
+}
+
+/* Spread the trial decryption over a few threads, since every slot costs a key derivation and a
+ * couple of scalar multiplications.  Logging is not thread safe, so keyring debug output forces
+ * all slots to be tried on this thread.
+ */
+static void keyring_trial_parallel(struct keyring_trial *trial)
+{
+  pthread_t threads[KEYRING_TRIAL_THREADS];
+  unsigned thread_count = 0;
+  if (!IF_DEBUG(keyring)) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned wanted = trial->count / KEYRING_TRIAL_SLOTS_PER_THREAD;
+    if (cpus > 0 && wanted > (unsigned)cpus - 1)
+      wanted = cpus - 1;
+    if (wanted > KEYRING_TRIAL_THREADS)
+      wanted = KEYRING_TRIAL_THREADS;
+    while (thread_count < wanted
+      && pthread_create(&threads[thread_count], NULL, keyring_trial_thread, trial) == 0)
+      thread_count++;
+  }
+  keyring_trial_slots(trial);
+  while (thread_count)
+    pthread_join(threads[--thread_count], NULL);
+}
+#else
+#define keyring_trial_parallel(T) keyring_trial_slots(T)
+#endif
+
 /* Try all valid slots with the PIN and see if we find any identities with that PIN.
    We might find more than one. */
 int keyring_enter_pin(keyring_file *k, const char *pin)
@@ -1291,9 +1515,16 @@ int keyring_enter_pin(keyring_file *k, const char *pin)
   }
   if (identitiesFound)
     RETURN(identitiesFound);
-    
+
+  unsigned slot_count = k->file_size / KEYRING_PAGE_SIZE;
+  if (slot_count == 0)
+    RETURN(0);
+  unsigned *slots = emalloc(sizeof(unsigned) * slot_count);
+  if (!slots)
+    RETURN(0);
+  unsigned count = 0;
   unsigned slot;
-  for(slot=0;slot<k->file_size/KEYRING_PAGE_SIZE;slot++) {
+  for(slot=0;slot<slot_count;slot++) {
     /* slot zero is the BAM and salt, so skip it */
     if (slot&(KEYRING_BAM_BITS-1)) {
       /* Not a BAM slot, so examine */
@@ -1310,14 +1541,72 @@ int keyring_enter_pin(keyring_file *k, const char *pin)
       int position=slot&(KEYRING_BAM_BITS-1);
       int byte=position>>3;
       int bit=position&7;
-      if (b->bitmap[byte]&(1<<bit)) {
-	/* Slot is occupied, so check it.
-	    We have to check it for each keyring context (ie keyring pin) */
-	if (keyring_decrypt_pkr(k, pin, slot) == 0)
-	  ++identitiesFound;
-      }
+      if (b->bitmap[byte]&(1<<bit))
+	slots[count++] = slot;
+    }
+  }
+
+  /* Read the whole file at once, rather than seeking to every occupied slot. */
+  size_t file_bytes = slot_count * KEYRING_PAGE_SIZE;
+  unsigned char *pages = NULL;
+  int mapped = 0;
+  keyring_identity **found = NULL;
+  if (count == 0)
+    goto kep_done;
+  if (fflush(k->file) == -1)
+    WHYF_perror("fflush(%d)", fileno(k->file));
+  pages = mmap(NULL, file_bytes, PROT_READ, MAP_PRIVATE, fileno(k->file), 0);
+  if (pages != MAP_FAILED)
+    mapped = 1;
+  else {
+    DEBUGF(keyring, "mmap(%d) failed, reading instead - %s", fileno(k->file), strerror(errno));
+    if ((pages = emalloc(file_bytes)) == NULL)
+      goto kep_done;
+    if (fseeko(k->file, 0, SEEK_SET)) {
+      WHY_perror("fseeko");
+      goto kep_done;
+    }
+    if (fread(pages, file_bytes, 1, k->file) != 1) {
+      WHY_perror("fread");
+      goto kep_done;
     }
   }
+  if ((found = emalloc_zero(sizeof(keyring_identity *) * count)) == NULL)
+    goto kep_done;
+
+  /* Slot is occupied, so check it.
+      We have to check it for each keyring context (ie keyring pin) */
+  struct keyring_trial trial = {
+    .k = k,
+    .pin = pin,
+    .pages = pages,
+    .slots = slots,
+    .found = found,
+    .count = count,
+    .next = 0
+  };
+  keyring_trial_parallel(&trial);
+
+  /* Add the identities we found in slot order. */
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    if (!found[i])
+      continue;
+    if (keyring_commit_identity(k, found[i])==1)
+      ++identitiesFound;
+    else
+      keyring_free_identity(found[i]);
+  }
+
+kep_done:
+  if (mapped)
+    munmap(pages, file_bytes);
+  else if (pages) {
+    bzero(pages, file_bytes);
+    free(pages);
+  }
+  free(found);
+  free(slots);
 
   if (k->dirty)
     keyring_commit(k);
@@ -1378,6 +1667,7 @@ static int keyring_commit_identity(keyring_file *k, keyring_identity *id)
     i=&(*i)->next;
 
   *i=id;
+  keyring_index_insert(k, id);
   add_subscriber(id);
   return 1;
 }
@@ -1459,7 +1749,9 @@ keyring_identity *keyring_create_identity(keyring_file *k, const char *pin)
 
 static int write_random_slot(keyring_file *k, unsigned slot)
 {
-  if (test_slot(k, slot)!=0)
+  // An occupied slot beyond the end of the file belongs to an identity that has not been written
+  // yet, so it must still be filled to extend the file up to it.
+  if (test_slot(k, slot)!=0 && (off_t)(KEYRING_PAGE_SIZE * slot) < (off_t)k->file_size)
     return 0;
 
   DEBUGF(keyring, "Fill slot %u with randomness", slot);
@@ -1504,8 +1796,11 @@ void keyring_destroy_identity(keyring_file *k, keyring_identity *id)
   keyring_identity **i = &k->identities;
   while (*i && *i != id)
     i = &(*i)->next;
-  if (*i == id)
+  if (*i == id) {
     *i = id->next;
+    keyring_index_remove(k, id);
+    CALL_TRIGGER(identity_release, id);
+  }
 }
 
 int keyring_commit(keyring_file *k)
@@ -1603,8 +1898,10 @@ int keyring_commit(keyring_file *k)
   return errorCount ? WHYF("%u errors commiting keyring to disk", errorCount) : 0;
 }
 
-int keyring_set_did(keyring_identity *id, const char *did, const char *name)
+int keyring_set_did(keyring_file *k, keyring_identity *id, const char *did, const char *name)
 {
+  keyring_index_remove_did(k, id);
+
   /* Find where to put it */
   keypair *kp = id->keypairs;
   while(kp){
@@ -1617,8 +1914,10 @@ int keyring_set_did(keyring_identity *id, const char *did, const char *name)
   
   /* allocate if needed */
   if (!kp){
-    if ((kp = keyring_alloc_keypair(KEYTYPE_DID, 0)) == NULL)
+    if ((kp = keyring_alloc_keypair(KEYTYPE_DID, 0)) == NULL) {
+      keyring_index_add_did(k, id);
       return -1;
+    }
     keyring_identity_add_keypair(id, kp);
     DEBUG(keyring, "Created DID record for identity");
   }
@@ -1639,6 +1938,7 @@ int keyring_set_did(keyring_identity *id, const char *did, const char *name)
     dump("{keyring} storing did",&kp->private_key[0],32);
     dump("{keyring} storing name",&kp->public_key[0],64);
   }
+  keyring_index_add_did(k, id);
   return 0;
 }
 
@@ -1922,52 +2222,153 @@ keyring_file *keyring_open_instance_cli(const struct cli_parsed *parsed)
   can indeed be reused.
 */
 
-/* XXX We need a more efficient implementation than a linear list, but it will
-   do for now. */
+/* The cache is a hash table of (known, unknown) key pairs, with a least-recently-used list running
+ * through all the records, so that a node talking to many peers evicts the peers it has not heard
+ * from for longest, rather than a random one.  Its size is configured by mdp.nm_cache_size.
+ */
 struct nm_record {
-  /* 96 bytes per record */
+  /* 96 bytes of key material per record */
   sid_t known_key;
   sid_t unknown_key;
   unsigned char nm_bytes[crypto_box_BEFORENMBYTES];
+  struct nm_record *hash_next;
+  struct nm_record *lru_prev;
+  struct nm_record *lru_next;
 };
 
-unsigned nm_slots_used=0;
-/* 512 x 96 bytes = 48KB, not too big */
-#define NM_CACHE_SLOTS 512
-struct nm_record nm_cache[NM_CACHE_SLOTS];
+struct nm_cache_stats nm_cache_stats;
+
+static struct nm_record *nm_records = NULL;
+static struct nm_record **nm_buckets = NULL;
+static unsigned nm_record_count = 0;
+static unsigned nm_bucket_count = 0;
+static unsigned nm_slots_used = 0;
+// most recently used first
+static struct nm_record *nm_lru_head = NULL;
+static struct nm_record *nm_lru_tail = NULL;
+
+static int nm_cache_configure()
+{
+  unsigned record_count = config.mdp.nm_cache_size;
+  if (record_count == nm_record_count)
+    return 0;
+  // at least as many buckets as records, and a power of 2
+  unsigned bucket_count = 1;
+  while (bucket_count < record_count)
+    bucket_count <<= 1;
+  struct nm_record *records = emalloc_zero(sizeof(struct nm_record) * record_count);
+  if (!records)
+    return -1;
+  struct nm_record **buckets = emalloc_zero(sizeof(struct nm_record *) * bucket_count);
+  if (!buckets) {
+    free(records);
+    return -1;
+  }
+  DEBUGF(keyring, "Caching up to %u shared secrets", record_count);
+  if (nm_records) {
+    bzero(nm_records, sizeof(struct nm_record) * nm_record_count);
+    free(nm_records);
+    free(nm_buckets);
+  }
+  nm_records = records;
+  nm_buckets = buckets;
+  nm_record_count = record_count;
+  nm_bucket_count = bucket_count;
+  nm_slots_used = 0;
+  nm_lru_head = nm_lru_tail = NULL;
+  return 0;
+}
+
+static struct nm_record **nm_bucket(const sid_t *known, const sid_t *unknown)
+{
+  // public keys are uniformly distributed, so their leading bytes make a good hash
+  uint32_t hash = read_uint32(&known->binary[0]) ^ read_uint32(&unknown->binary[0]);
+  return &nm_buckets[hash & (nm_bucket_count - 1)];
+}
+
+static void nm_lru_unlink(struct nm_record *r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    nm_lru_head = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    nm_lru_tail = r->lru_prev;
+  r->lru_prev = r->lru_next = NULL;
+}
+
+static void nm_lru_push(struct nm_record *r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = nm_lru_head;
+  if (nm_lru_head)
+    nm_lru_head->lru_prev = r;
+  else
+    nm_lru_tail = r;
+  nm_lru_head = r;
+}
 
 unsigned char *keyring_get_nm_bytes(const uint8_t *box_sk, const sid_t *box_pk, const sid_t *unknown_sidp)
 {
   IN();
+  if (nm_cache_configure() == -1)
+    RETURN(NULL);
 
   /* See if we have it cached already */
-  unsigned i;
-  for(i=0;i<nm_slots_used;i++){
-    if (cmp_sid_t(&nm_cache[i].known_key, box_pk) != 0) continue;
-    if (cmp_sid_t(&nm_cache[i].unknown_key, unknown_sidp) != 0) continue;
-    RETURN(nm_cache[i].nm_bytes);
-  }
-
-  /* Not in the cache, so prepare to cache it (or return failure if known is not
-     in fact a known key */
-  /* work out where to store it */
-  if (nm_slots_used<NM_CACHE_SLOTS) {
-    i=nm_slots_used; nm_slots_used++; 
-  } else {
-    i=randombytes_uniform(NM_CACHE_SLOTS);
+  struct nm_record **bucket = nm_bucket(box_pk, unknown_sidp);
+  struct nm_record *r;
+  for (r = *bucket; r; r = r->hash_next) {
+    if (cmp_sid_t(&r->unknown_key, unknown_sidp) == 0 && cmp_sid_t(&r->known_key, box_pk) == 0) {
+      nm_cache_stats.hits++;
+      if (r != nm_lru_head) {
+	nm_lru_unlink(r);
+	nm_lru_push(r);
+      }
+      RETURN(r->nm_bytes);
+    }
   }
+  nm_cache_stats.misses++;
 
-  /* calculate and store */
-  nm_cache[i].known_key = *box_pk;
-  nm_cache[i].unknown_key = *unknown_sidp;
-  if (crypto_box_beforenm(nm_cache[i].nm_bytes, unknown_sidp->binary, box_sk)){
+  unsigned char nm_bytes[crypto_box_BEFORENMBYTES];
+  if (crypto_box_beforenm(nm_bytes, unknown_sidp->binary, box_sk)){
     WHY("crypto_box_beforenm failed");
     RETURN(NULL);
   }
-  RETURN(nm_cache[i].nm_bytes);
+
+  /* Store it in an unused record, or evict the least recently used one */
+  if (nm_slots_used < nm_record_count)
+    r = &nm_records[nm_slots_used++];
+  else {
+    r = nm_lru_tail;
+    nm_lru_unlink(r);
+    struct nm_record **p = nm_bucket(&r->known_key, &r->unknown_key);
+    while (*p != r)
+      p = &(*p)->hash_next;
+    *p = r->hash_next;
+    nm_cache_stats.evictions++;
+  }
+  r->known_key = *box_pk;
+  r->unknown_key = *unknown_sidp;
+  bcopy(nm_bytes, r->nm_bytes, sizeof nm_bytes);
+  bzero(nm_bytes, sizeof nm_bytes);
+  r->hash_next = *bucket;
+  *bucket = r;
+  nm_lru_push(r);
+  RETURN(r->nm_bytes);
   OUT();
 }
 
+void keyring_nm_cache_status_html(struct strbuf *b)
+{
+  strbuf_sprintf(b, "Shared secrets cached: %u of %u, hits: %"PRIu64", misses: %"PRIu64", evictions: %"PRIu64"<br>",
+    nm_slots_used, nm_record_count,
+    nm_cache_stats.hits,
+    nm_cache_stats.misses,
+    nm_cache_stats.evictions);
+}
+
 static int cmp_identity_ptrs(const keyring_identity *const *a, const keyring_identity *const *b)
 {
   if (a==b)
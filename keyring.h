@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "serval_types.h" // for sid_t
 #include "os.h" // for time_ms_t
+#include "trigger.h"
 
 struct cli_parsed;
 #include "xprintf.h"
@@ -55,6 +56,10 @@ typedef struct keyring_identity {
   const sid_t *box_pk;
   const sign_keypair_t *sign_keypair;
   struct keyring_identity *next;
+  // chains through the owning keyring_file's hash indexes
+  struct keyring_identity *sid_next;
+  struct keyring_identity *sign_next;
+  struct keyring_identity *did_next;
   keypair *keypairs;
 } keyring_identity;
 
@@ -78,6 +83,12 @@ typedef struct keyring_file {
   unsigned char *KeyRingSalt;
   int KeyRingSaltLen;
   keyring_identity *identities;
+  // identities hashed by SID, signing key and DID, index_size (a power of 2) buckets each
+  unsigned identity_count;
+  unsigned index_size;
+  keyring_identity **sid_index;
+  keyring_identity **sign_index;
+  keyring_identity **did_index;
   FILE *file;
   size_t file_size;
   uint8_t dirty;
@@ -123,7 +134,7 @@ keyring_file *keyring_create_instance();
 keyring_file *keyring_open_instance(const char *pin);
 keyring_file *keyring_open_instance_cli(const struct cli_parsed *parsed);
 int keyring_enter_pin(keyring_file *k, const char *pin);
-int keyring_set_did(keyring_identity *id, const char *did, const char *name);
+int keyring_set_did(keyring_file *k, keyring_identity *id, const char *did, const char *name);
 int keyring_set_pin(keyring_identity *id, const char *pin);
 int keyring_sign_message(struct keyring_identity *identity, unsigned char *content, size_t buffer_len, size_t *content_len);
 int keyring_send_identity_request(struct subscriber *subscriber);
@@ -131,6 +142,9 @@ int keyring_send_identity_request(struct subscriber *subscriber);
 int keyring_commit(keyring_file *k);
 keyring_identity *keyring_inmemory_identity();
 void keyring_free_identity(keyring_identity *id);
+// Called on the main thread for every unlocked identity that leaves the keyring, ie, when it is
+// locked, destroyed or its keyring is closed.
+DECLARE_TRIGGER(identity_release, const keyring_identity *id);
 keyring_identity *keyring_create_identity(keyring_file *k, const char *pin);
 void keyring_destroy_identity(keyring_file *k, keyring_identity *id);
 void keyring_identity_extract(const keyring_identity *id, const char **didp, const char **namep);
@@ -139,6 +153,15 @@ int keyring_dump(keyring_file *k, XPRINTF xpf, int include_secret);
 
 unsigned char *keyring_get_nm_bytes(const uint8_t *box_sk, const sid_t *box_pk, const sid_t *unknown_sidp);
 
+struct nm_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+extern struct nm_cache_stats nm_cache_stats;
+struct strbuf;
+void keyring_nm_cache_status_html(struct strbuf *b);
+
 struct internal_mdp_header;
 struct overlay_buffer;
 int keyring_send_unlock(struct subscriber *subscriber);
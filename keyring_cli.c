@@ -18,6 +18,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include "lang.h"
 #include "cli.h"
 #include "serval_types.h"
@@ -28,6 +31,9 @@
 #include "mdp_client.h"
 #include "commandline.h"
 #include "keyring.h"
+#include "instance.h"
+#include "crypto.h"
+#include "mem.h"
 
 DEFINE_FEATURE(cli_keyring);
 
@@ -286,7 +292,7 @@ static int app_keyring_set_did(const struct cli_parsed *parsed, struct cli_conte
   keyring_identity *id = keyring_find_identity_sid(keyring, &sid);
   if (!id)
     return WHY("No matching SID");
-  if (keyring_set_did(id, did, name))
+  if (keyring_set_did(keyring, id, did, name))
     return WHY("Could not set DID");
   if (set_pin && keyring_set_pin(id, new_pin))
     return WHY("Could not set new pin");
@@ -478,3 +484,123 @@ end:
   return ret;
 }
 
+
+DEFINE_CMD(app_keyring_test, 0,
+  "Time unlocking and searching keyrings of 10, 100 and 1000 identities",
+  "test","keyring","[<identities>]");
+static int app_keyring_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *max_arg;
+  if (cli_arg(parsed, "identities", &max_arg, cli_uint, "1000") == -1)
+    return -1;
+  unsigned max = atoi(max_arg);
+  // benchmark a scratch keyring file in the instance directory
+  const char *keyring_path = "benchmark.keyring";
+  char path[1024];
+  if (!FORMF_SERVAL_ETC_PATH(path, "%s", keyring_path))
+    return -1;
+  const char *saved_env = getenv("SERVALD_KEYRING_PATH");
+  setenv("SERVALD_KEYRING_PATH", keyring_path, 1);
+  int ret = 0;
+  unsigned count;
+  for (count = 10; count <= max && ret == 0; count *= 10) {
+    unlink(path);
+    time_ms_t start = gettime_ms();
+    keyring_file *k = keyring_create_instance();
+    if (!k) {
+      ret = WHY("Could not create keyring");
+      break;
+    }
+    unsigned i;
+    for (i = 0; i < count; i++) {
+      if (!keyring_create_identity(k, "benchmark")) {
+	ret = WHY("Could not create identity");
+	break;
+      }
+    }
+    if (ret == 0 && keyring_commit(k) == -1)
+      ret = WHY("Could not write keyring");
+    keyring_free(k);
+    if (ret)
+      break;
+    time_ms_t created = gettime_ms();
+    if (!(k = keyring_open_instance(""))) {
+      ret = WHY("Could not open keyring");
+      break;
+    }
+    int found = keyring_enter_pin(k, "benchmark");
+    time_ms_t unlocked = gettime_ms();
+    // look every identity up 100 times by SID and by signing key
+    unsigned lookups = 0;
+    keyring_identity *id;
+    for (i = 0; i < 100 && ret == 0; i++) {
+      for (id = k->identities; id; id = id->next) {
+	if (keyring_find_identity_sid(k, id->box_pk) != id
+	  || keyring_find_identity(k, &id->sign_keypair->public_key) != id) {
+	  ret = WHYF("Lookup of %s failed", alloca_tohex_sid_t(*id->box_pk));
+	  break;
+	}
+	lookups += 2;
+      }
+    }
+    time_ms_t searched = gettime_ms();
+    keyring_free(k);
+    cli_printf(context, "%u identities: created in %"PRId64"ms, unlocked %d in %"PRId64"ms, %u lookups in %"PRId64"ms\n",
+      count, created - start, found, unlocked - created, lookups, searched - unlocked);
+    if (ret == 0 && found != (int)count)
+      ret = WHYF("Expected to unlock %u identities, found %d", count, found);
+  }
+  unlink(path);
+  if (saved_env)
+    setenv("SERVALD_KEYRING_PATH", saved_env, 1);
+  else
+    unsetenv("SERVALD_KEYRING_PATH");
+  return ret;
+}
+
+DEFINE_CMD(app_nm_cache_test, 0,
+  "Time encrypting packets to 1, 16, 256 and 4096 peers, using the cache of shared secrets",
+  "test","sharedsecrets","[<packets>]");
+static int app_nm_cache_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *packets_arg;
+  if (cli_arg(parsed, "packets", &packets_arg, cli_uint, "20000") == -1)
+    return -1;
+  unsigned packets = atoi(packets_arg);
+  const unsigned max_peers = 4096;
+  sid_t my_pk;
+  uint8_t my_sk[crypto_box_SECRETKEYBYTES];
+  crypto_box_keypair(my_pk.binary, my_sk);
+  sid_t *peers = emalloc(sizeof(sid_t) * max_peers);
+  if (!peers)
+    return -1;
+  uint8_t peer_sk[crypto_box_SECRETKEYBYTES];
+  unsigned i;
+  for (i = 0; i < max_peers; i++)
+    crypto_box_keypair(peers[i].binary, peer_sk);
+  uint8_t plain[1024];
+  uint8_t cipher[sizeof plain + crypto_box_MACBYTES];
+  uint8_t nonce[crypto_box_NONCEBYTES];
+  bzero(plain, sizeof plain);
+  bzero(nonce, sizeof nonce);
+  int ret = 0;
+  unsigned count;
+  for (count = 1; count <= max_peers && ret == 0; count *= 16) {
+    struct nm_cache_stats before = nm_cache_stats;
+    time_ms_t start = gettime_ms();
+    for (i = 0; i < packets; i++) {
+      // each packet goes to a peer chosen at random
+      const unsigned char *k = keyring_get_nm_bytes(my_sk, &my_pk, &peers[randombytes_uniform(count)]);
+      if (!k || crypto_box_easy_afternm(cipher, plain, sizeof plain, nonce, k)) {
+	ret = WHY("Could not encrypt packet");
+	break;
+      }
+    }
+    time_ms_t elapsed = gettime_ms() - start;
+    cli_printf(context, "%u peers: %u packets in %"PRId64"ms (%"PRId64"/s), cache hits %"PRIu64", misses %"PRIu64"\n",
+      count, i, elapsed, elapsed ? (int64_t)i * 1000 / elapsed : 0,
+      nm_cache_stats.hits - before.hits, nm_cache_stats.misses - before.misses);
+  }
+  free(peers);
+  return ret;
+}
@@ -33,6 +33,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <stdint.h>
 #include <dirent.h>
 #include <assert.h>
+#include <signal.h>
 
 #include "version_servald.h"
 #include "instance.h"
@@ -103,6 +104,47 @@ static time_t _log_file_start_time;
 static char _log_file_buf[8192];
 static struct strbuf _log_file_strbuf = STRUCT_STRBUF_EMPTY;
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+/* Static variables for writing the log file from a background thread.
+ *
+ * Formatted log lines are copied into a ring of bytes, each prefixed by its length, and a writer
+ * thread copies them into the log file.  Like the rest of this file, the ring assumes that only one
+ * thread produces log messages at a time, so the head and tail counters are the only shared state.
+ * When the ring is full, whole lines are dropped and counted, and the writer thread logs the count
+ * when it next catches up.
+ *
+ * The writer thread only uses the stream it was handed, and only while holding the busy flag.  The
+ * log file is never closed until the writer has written everything queued, gone idle, and let go
+ * of the stream.  If the writer thread dies, log lines go straight to the file as if async logging
+ * were disabled.
+ */
+static struct {
+  pid_t pid; // the process that started the writer thread
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t idle;
+  FILE *file; // the stream the writer thread writes to, protected by mutex
+  int busy; // set while the writer thread is using file, protected by mutex
+  int writer_alive; // cleared when the writer thread exits, protected by mutex
+  char *buf;
+  size_t size;
+  size_t head; // total bytes queued
+  size_t tail; // total bytes written
+  int sleeping;
+  int wake[2];
+  unsigned dropped_lines;
+  size_t dropped_bytes;
+} _log_async;
+static int _log_async_enabled();
+static void _log_async_queue(const char *lines, size_t len, int overrun);
+static void _log_async_drain();
+#else
+#define _log_async_enabled() (0)
+#define _log_async_queue(lines, len, overrun)
+#define _log_async_drain()
+#endif
+
 #ifdef ANDROID
 /* Static variables for sending log output to the Android log.
  *
@@ -592,6 +634,7 @@ static void _rotate_log_file(_log_iterator *it)
       _compute_file_start_time(it);
       if (it->file_start_time != _log_file_start_time) {
 	// Close the current log file, which will cause _open_log_file() to open the next one.
+	_log_async_drain();
 	if (_log_file)
 	  fclose(_log_file);
 	_log_file = NULL;
@@ -603,7 +646,13 @@ static void _rotate_log_file(_log_iterator *it)
 
 static void _flush_log_file()
 {
+  if (_log_file && _log_file != NO_FILE && strbuf_len(&_log_file_strbuf) != 0 && _log_async_enabled()) {
+    _log_async_queue(strbuf_str(&_log_file_strbuf), strbuf_len(&_log_file_strbuf), strbuf_overrun(&_log_file_strbuf));
+    strbuf_reset(&_log_file_strbuf);
+  }
   if (_log_file && _log_file != NO_FILE && strbuf_len(&_log_file_strbuf) != 0) {
+    // if the writer thread was stopped by a configuration change, let it finish with the file first
+    _log_async_drain();
     fprintf(_log_file, "%s%s%s",
 	strbuf_len(&_log_file_strbuf) ? strbuf_str(&_log_file_strbuf) : "",
 	strbuf_len(&_log_file_strbuf) ? "\n" : "",
@@ -613,6 +662,184 @@ static void _flush_log_file()
   }
 }
 
+#ifdef HAVE_PTHREAD
+
+static void _log_async_read(size_t offset, void *dst, size_t len)
+{
+  size_t i = offset % _log_async.size;
+  size_t n = len < _log_async.size - i ? len : _log_async.size - i;
+  memcpy(dst, &_log_async.buf[i], n);
+  memcpy((char *)dst + n, _log_async.buf, len - n);
+}
+
+static void _log_async_write(size_t offset, const void *src, size_t len)
+{
+  size_t i = offset % _log_async.size;
+  size_t n = len < _log_async.size - i ? len : _log_async.size - i;
+  memcpy(&_log_async.buf[i], src, n);
+  memcpy(_log_async.buf, (const char *)src + n, len - n);
+}
+
+static void *_log_async_writer(void *UNUSED(arg))
+{
+  sigset_t set;
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  char line[sizeof _log_file_buf + 20];
+  while (1) {
+    pthread_mutex_lock(&_log_async.mutex);
+    FILE *file = _log_async.file;
+    _log_async.busy = 1;
+    pthread_mutex_unlock(&_log_async.mutex);
+    size_t tail = _log_async.tail;
+    if (file) {
+      unsigned dropped_lines = __atomic_exchange_n(&_log_async.dropped_lines, 0, __ATOMIC_SEQ_CST);
+      size_t dropped_bytes = __atomic_exchange_n(&_log_async.dropped_bytes, 0, __ATOMIC_SEQ_CST);
+      if (dropped_lines)
+	fprintf(file, "WARN:  LOG DROPPED %u lines (%zu bytes) while the log writer was busy\n", dropped_lines, dropped_bytes);
+      size_t head = __atomic_load_n(&_log_async.head, __ATOMIC_ACQUIRE);
+      while (tail != head) {
+	uint32_t len;
+	_log_async_read(tail, &len, sizeof len);
+	_log_async_read(tail + sizeof len, line, len);
+	fwrite(line, len, 1, file);
+	tail += sizeof len + len;
+	__atomic_store_n(&_log_async.tail, tail, __ATOMIC_RELEASE);
+      }
+      fflush(file);
+    }
+    pthread_mutex_lock(&_log_async.mutex);
+    _log_async.busy = 0;
+    pthread_cond_broadcast(&_log_async.idle);
+    pthread_mutex_unlock(&_log_async.mutex);
+    // go to sleep, unless something was queued while we were looking
+    __atomic_store_n(&_log_async.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_log_async.head, __ATOMIC_SEQ_CST) != tail
+      || __atomic_load_n(&_log_async.dropped_lines, __ATOMIC_SEQ_CST)) {
+      __atomic_store_n(&_log_async.sleeping, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    char c;
+    if (read(_log_async.wake[0], &c, 1) == -1 && errno != EINTR)
+      break;
+  }
+  // let _log_async_drain() know that nobody will ever write the rest of the queue
+  pthread_mutex_lock(&_log_async.mutex);
+  _log_async.writer_alive = 0;
+  pthread_cond_broadcast(&_log_async.idle);
+  pthread_mutex_unlock(&_log_async.mutex);
+  return NULL;
+}
+
+static void _log_async_wake()
+{
+  if (__atomic_exchange_n(&_log_async.sleeping, 0, __ATOMIC_SEQ_CST)) {
+    char c = 0;
+    if (write(_log_async.wake[1], &c, 1) == -1) {
+      // the writer thread will still wake up for the next line
+    }
+  }
+}
+
+static int _log_async_enabled()
+{
+  if (cf_limbo || !config.log.file.async)
+    return 0;
+  pid_t pid = getpid();
+  if (_log_async.pid == pid)
+    return __atomic_load_n(&_log_async.writer_alive, __ATOMIC_SEQ_CST);
+  // start the writer thread in this process, discarding anything queued by our parent, whose
+  // writer thread was not copied into this process by fork(2)
+  if (_log_async.pid) {
+    close(_log_async.wake[0]);
+    close(_log_async.wake[1]);
+    _log_async.pid = 0;
+  }
+  if (_log_async.size != config.log.file.async_buffer) {
+    free(_log_async.buf);
+    _log_async.size = config.log.file.async_buffer;
+    if ((_log_async.buf = malloc(_log_async.size)) == NULL) {
+      _log_async.size = 0;
+      return 0;
+    }
+  }
+  _log_async.head = _log_async.tail = 0;
+  _log_async.sleeping = 0;
+  _log_async.dropped_lines = 0;
+  _log_async.dropped_bytes = 0;
+  _log_async.file = NULL;
+  _log_async.busy = 0;
+  _log_async.writer_alive = 1;
+  pthread_mutex_init(&_log_async.mutex, NULL);
+  pthread_cond_init(&_log_async.idle, NULL);
+  if (pipe(_log_async.wake) == -1)
+    return 0;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&_log_async.thread, &attr, _log_async_writer, NULL);
+  pthread_attr_destroy(&attr);
+  if (err) {
+    close(_log_async.wake[0]);
+    close(_log_async.wake[1]);
+    return 0;
+  }
+  static int registered = 0;
+  if (!registered) {
+    atexit(_log_async_drain);
+    registered = 1;
+  }
+  _log_async.pid = pid;
+  return 1;
+}
+
+static void _log_async_queue(const char *lines, size_t len, int overrun)
+{
+  // hand the current log file to the writer thread; _log_async_drain() took back any previous one
+  if (_log_async.file != _log_file) {
+    pthread_mutex_lock(&_log_async.mutex);
+    _log_async.file = _log_file;
+    pthread_mutex_unlock(&_log_async.mutex);
+  }
+  const char *trailer = overrun ? "\nLOG OVERRUN\n" : "\n";
+  size_t trailer_len = strlen(trailer);
+  uint32_t record_len = len + trailer_len;
+  size_t head = _log_async.head;
+  size_t tail = __atomic_load_n(&_log_async.tail, __ATOMIC_ACQUIRE);
+  if (head - tail + sizeof record_len + record_len > _log_async.size) {
+    __atomic_add_fetch(&_log_async.dropped_lines, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&_log_async.dropped_bytes, record_len, __ATOMIC_SEQ_CST);
+  } else {
+    _log_async_write(head, &record_len, sizeof record_len);
+    _log_async_write(head + sizeof record_len, lines, len);
+    _log_async_write(head + sizeof record_len + len, trailer, trailer_len);
+    __atomic_store_n(&_log_async.head, head + sizeof record_len + record_len, __ATOMIC_RELEASE);
+  }
+  _log_async_wake();
+}
+
+/* Wait for the writer thread to write everything that has been queued and go idle, or to exit,
+ * then take the log file back from it, so that the file can be written directly or closed.
+ */
+static void _log_async_drain()
+{
+  if (_log_async.pid != getpid())
+    return;
+  pthread_mutex_lock(&_log_async.mutex);
+  while ( _log_async.file
+      && _log_async.writer_alive
+      && ( _log_async.busy
+	|| __atomic_load_n(&_log_async.tail, __ATOMIC_SEQ_CST) != _log_async.head
+	|| __atomic_load_n(&_log_async.dropped_lines, __ATOMIC_SEQ_CST))) {
+    _log_async_wake();
+    pthread_cond_wait(&_log_async.idle, &_log_async.mutex);
+  }
+  _log_async.file = NULL;
+  pthread_mutex_unlock(&_log_async.mutex);
+}
+
+#endif // HAVE_PTHREAD
+
 /* Discard any unwritten log messages and close the log file immediately.  This should be called in
  * any child process immediately after fork() to prevent any buffered log messages from being
  * written twice into the log file.
@@ -622,6 +849,7 @@ static void _flush_log_file()
 void close_log_file()
 {
   strbuf_reset(&_log_file_strbuf);
+  _log_async_drain();
   if (_log_file && _log_file != NO_FILE)
     fclose(_log_file);
   _log_file = NULL;
@@ -655,6 +883,7 @@ void logFlush()
   _log_iterator_start(&it);
   while (_log_iterator_advance(&it))
     _log_flush(&it);
+  _log_async_drain();
 }
 
 void vlogMessage(int level, struct __sourceloc whence, const char *fmt, va_list ap)
@@ -670,6 +899,8 @@ void vlogMessage(int level, struct __sourceloc whence, const char *fmt, va_list
       vxprintf(it.xpf, fmt, ap1);
       va_end(ap1);
     }
+    if (level == LOG_LEVEL_FATAL)
+      _log_async_drain();
   }
 }
 
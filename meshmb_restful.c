@@ -429,6 +429,7 @@ static int restful_meshmb_list(httpd_request *r, const char *remainder)
   assert(r->finalise_union == NULL);
   r->finalise_union = list_finalise;
   r->trigger_rhizome_bundle_added = list_on_rhizome_add;
+  httpd_watch_bundle(r, &r->bid);
   r->u.plylist.phase = LIST_HEADER;
   r->u.plylist.rowcount = 0;
   r->u.plylist.end_offset = r->ui64;
@@ -667,6 +668,9 @@ static int restful_meshmb_feedlist(httpd_request *r, const char *remainder)
   assert(r->finalise_union == NULL);
   r->finalise_union = feedlist_finalise;
   r->trigger_rhizome_bundle_added = feedlist_on_rhizome_add;
+  // Followed feeds, and this identity's own private acknowledgement bundle.
+  httpd_watch_service(r, RHIZOME_SERVICE_MESHMB);
+  httpd_watch_service(r, RHIZOME_SERVICE_PRIVATE);
   r->u.meshmb_feeds.phase = LIST_HEADER;
   r->u.meshmb_feeds.session = session;
   r->u.meshmb_feeds.generation = meshmb_flush(session->feeds);
@@ -869,6 +873,9 @@ static int restful_meshmb_activity(httpd_request *r, const char *remainder)
   assert(r->finalise_union == NULL);
   r->finalise_union = feedlist_finalise;
   r->trigger_rhizome_bundle_added = feedlist_on_rhizome_add;
+  // Followed feeds, and this identity's own private acknowledgement bundle.
+  httpd_watch_service(r, RHIZOME_SERVICE_MESHMB);
+  httpd_watch_service(r, RHIZOME_SERVICE_PRIVATE);
   r->u.meshmb_feeds.phase = LIST_HEADER;
   r->u.meshmb_feeds.session = session;
   r->u.meshmb_feeds.iterator = NULL;
@@ -31,8 +31,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "str.h"
 #include "dataformats.h"
 #include "overlay_buffer.h"
+#include "server.h"
 
 static unsigned mark_read(struct meshms_conversations *conv, const sid_t *their_sid, const uint64_t offset);
+static struct meshms_conversations *add_conv(struct meshms_conversations **conv, const sid_t *them);
 
 void meshms_free_conversations(struct meshms_conversations *conv)
 {
@@ -43,6 +45,142 @@ void meshms_free_conversations(struct meshms_conversations *conv)
   }
 }
 
+/* The daemon keeps a copy of each identity's conversation list, so that opening a conversation
+ * need not decrypt the conversation list bundle and query the database for ply bundles every time.
+ * The bundle_add trigger keeps the copy's ply sizes current, and the cached metadata then lets
+ * update_stats() scan only the records appended since.  A newer version of the list bundle that
+ * this process did not write (eg, by a CLI command) discards the copy, as does the identity leaving
+ * the keyring, so there is never more than one copy per unlocked identity.
+ */
+struct meshms_cache_entry {
+  struct meshms_cache_entry *next;
+  sid_t my_sid;
+  // the conversation list bundle that the copy was read from or written to
+  rhizome_bid_t list_bid;
+  uint64_t list_version;
+  struct meshms_conversations *conv;
+};
+
+static struct meshms_cache_entry *meshms_cache = NULL;
+
+static int copy_conversations(struct meshms_conversations **dest, const struct meshms_conversations *conv)
+{
+  *dest = NULL;
+  for (; conv; conv = conv->_next) {
+    struct meshms_conversations *n = emalloc(sizeof *n);
+    if (!n) {
+      meshms_free_conversations(*dest);
+      *dest = NULL;
+      return -1;
+    }
+    *n = *conv;
+    n->_next = NULL;
+    *dest = n;
+    dest = &n->_next;
+  }
+  return 0;
+}
+
+static struct meshms_cache_entry **cache_find(const sid_t *my_sid)
+{
+  struct meshms_cache_entry **ep = &meshms_cache;
+  while (*ep && cmp_sid_t(&(*ep)->my_sid, my_sid) != 0)
+    ep = &(*ep)->next;
+  return ep;
+}
+
+static void cache_unlink(struct meshms_cache_entry **ep)
+{
+  struct meshms_cache_entry *e = *ep;
+  *ep = e->next;
+  meshms_free_conversations(e->conv);
+  free(e);
+}
+
+static void cache_drop(const sid_t *my_sid)
+{
+  struct meshms_cache_entry **ep = cache_find(my_sid);
+  if (*ep) {
+    DEBUGF(meshms, "Dropping cached conversations of %s", alloca_tohex_sid_t(*my_sid));
+    cache_unlink(ep);
+  }
+}
+
+/* Remember the conversation list as last read or written.  If the list bundle was never loaded (the
+ * list came from the cache and nothing was written), then the cached bundle version still holds.
+ */
+static void cache_store(const keyring_identity *id, const rhizome_manifest *m, const struct meshms_conversations *conv)
+{
+  if (!serverMode)
+    return;
+  struct meshms_cache_entry **ep = cache_find(id->box_pk);
+  struct meshms_cache_entry *e = *ep;
+  if (!e) {
+    if (!m->has_id || (e = emalloc_zero(sizeof *e)) == NULL)
+      return;
+    e->my_sid = *id->box_pk;
+    *ep = e;
+  }
+  struct meshms_conversations *copy;
+  if (copy_conversations(&copy, conv) == -1) {
+    cache_unlink(ep);
+    return;
+  }
+  meshms_free_conversations(e->conv);
+  e->conv = copy;
+  if (m->has_id) {
+    e->list_bid = m->keypair.public_key;
+    e->list_version = m->version;
+  }
+}
+
+static void meshms_cache_identity_release(const keyring_identity *id)
+{
+  if (id->box_pk)
+    cache_drop(id->box_pk);
+}
+DEFINE_TRIGGER(identity_release, meshms_cache_identity_release);
+
+static void meshms_cache_bundle_added(rhizome_manifest *m)
+{
+  bool_t is_ply = m->service && strcmp(m->service, RHIZOME_SERVICE_MESHMS2) == 0 && m->has_sender && m->has_recipient;
+  struct meshms_cache_entry **ep = &meshms_cache;
+  while (*ep) {
+    struct meshms_cache_entry *e = *ep;
+    if (cmp_rhizome_bid_t(&m->keypair.public_key, &e->list_bid) == 0 && m->version > e->list_version) {
+      DEBUGF(meshms, "Conversation list of %s changed, dropping cached copy", alloca_tohex_sid_t(e->my_sid));
+      cache_unlink(ep);
+      continue;
+    }
+    // file the ply the same way as get_database_conversations()
+    const sid_t *them = NULL;
+    bool_t mine = 0;
+    if (is_ply && cmp_sid_t(&m->recipient, &e->my_sid) == 0)
+      them = &m->sender;
+    else if (is_ply && cmp_sid_t(&m->sender, &e->my_sid) == 0) {
+      them = &m->recipient;
+      mine = 1;
+    }
+    if (them) {
+      struct meshms_conversations *c = add_conv(&e->conv, them);
+      if (!c) {
+	cache_unlink(ep);
+	continue;
+      }
+      struct message_ply *p = mine ? &c->my_ply : &c->their_ply;
+      if (!p->found || p->version < m->version) {
+	p->found = p->known_bid = 1;
+	p->bundle_id = m->keypair.public_key;
+	p->version = m->version;
+	p->tail = m->tail;
+	p->size = m->filesize;
+      }
+    }
+    ep = &e->next;
+  }
+}
+DEFINE_TRIGGER(bundle_add, meshms_cache_bundle_added);
+
 static enum meshms_status get_my_conversation_bundle(const keyring_identity *id, rhizome_manifest *m)
 {
   /* Find our private key */
@@ -111,10 +249,11 @@ static enum meshms_status get_database_conversations(const keyring_identity *id,
 {
   sqlite_retry_state retry = SQLITE_RETRY_STATE_DEFAULT;
   sqlite3_stmt *statement = sqlite_prepare_bind(&retry,
-      "SELECT id, version, filesize, tail, sender, recipient"
-      " FROM manifests"
-      " WHERE service = ?2"
-      " AND (sender=?1 or recipient=?1)",
+      "SELECT manifests.id, version, filesize, tail, sender, recipient"
+      " FROM conversations, manifests"
+      " WHERE conversations.sid = ?1"
+      " AND manifests.id = conversations.id"
+      " AND service = ?2",
       SID_T, id->box_pk,
       STATIC_TEXT, RHIZOME_SERVICE_MESHMS2,
       END
@@ -242,11 +381,17 @@ static enum meshms_status update_my_stats(struct meshms_metadata *metadata, stru
       return status;
 
     reader->read.offset = reader->read.length;
-    if (message_ply_find_prev(reader, MESSAGE_BLOCK_TYPE_ACK)==0){
-      struct message_ply_ack ack;
-      message_ply_parse_ack(reader, &ack);
-      metadata->my_last_ack = ack.end_offset;
-      DEBUGF(meshms, "Found my last ack %"PRId64, metadata->my_last_ack);
+    while(message_ply_read_prev(reader) == 0){
+      // stop if we've seen these records before
+      if (reader->record_end_offset <= metadata->my_size)
+	break;
+      if (reader->type == MESSAGE_BLOCK_TYPE_ACK){
+	struct message_ply_ack ack;
+	message_ply_parse_ack(reader, &ack);
+	metadata->my_last_ack = ack.end_offset;
+	DEBUGF(meshms, "Found my last ack %"PRId64, metadata->my_last_ack);
+	break;
+      }
     }
     metadata->my_size = ply->size;
     message_ply_read_rewind(reader);
@@ -531,7 +676,7 @@ static ssize_t write_conversations(struct rhizome_write *write, struct meshms_co
   return len;
 }
 
-static enum meshms_status write_known_conversations(rhizome_manifest *m, struct meshms_conversations *conv)
+static enum meshms_status write_known_conversations(const keyring_identity *id, rhizome_manifest *m, struct meshms_conversations *conv)
 {
   rhizome_manifest *mout=NULL;
   
@@ -539,6 +684,11 @@ static enum meshms_status write_known_conversations(rhizome_manifest *m, struct
   bzero(&write, sizeof(write));
   enum meshms_status status = MESHMS_STATUS_ERROR;
   
+  // the conversation list came from the cache, so its bundle has not been loaded yet
+  if (!m->has_id && meshms_failed(status = get_my_conversation_bundle(id, m)))
+    goto end;
+  status = MESHMS_STATUS_ERROR;
+
   // TODO rebalance tree...?
   
   rhizome_manifest_set_version(m, m->version + 1);
@@ -607,23 +757,35 @@ static enum meshms_status write_known_conversations(rhizome_manifest *m, struct
   }
   rhizome_bundle_result_free(&result);
 end:
-  if (meshms_failed(status))
+  if (meshms_failed(status)){
     rhizome_fail_write(&write);
+    cache_drop(id->box_pk);
+  }else if (status == MESHMS_STATUS_UPDATED)
+    cache_store(id, m, conv);
   if (mout && m!=mout)
     rhizome_manifest_free(mout);
   return status;
 }
 
+// If the list comes from the cache then 'm' is left empty, and write_known_conversations() will
+// load it if the list needs saving.
 static enum meshms_status meshms_open_list(const keyring_identity *id, rhizome_manifest *m, struct meshms_conversations **conv)
 {
   enum meshms_status status;
 
+  struct meshms_cache_entry *e = *cache_find(id->box_pk);
+  if (e){
+    DEBUGF(meshms, "Using cached conversations of %s", alloca_tohex_sid_t(*id->box_pk));
+    return copy_conversations(conv, e->conv) == -1 ? MESHMS_STATUS_ERROR : MESHMS_STATUS_OK;
+  }
   if (meshms_failed(status = get_my_conversation_bundle(id, m)))
     goto end;
   // read conversations payload
   if (meshms_failed(status = read_known_conversations(m, conv)))
     goto end;
-  status = get_database_conversations(id, conv);
+  if (meshms_failed(status = get_database_conversations(id, conv)))
+    goto end;
+  cache_store(id, m, *conv);
 end:
   return status;
 }
@@ -633,7 +795,7 @@ static enum meshms_status meshms_save_list(const keyring_identity *id, rhizome_m
   enum meshms_status status;
 
   if ((status = update_conversations(id, conv)) == MESHMS_STATUS_UPDATED)
-    status = write_known_conversations(m, *conv);
+    status = write_known_conversations(id, m, *conv);
 
   return status;
 }
@@ -667,6 +829,8 @@ enum meshms_status meshms_conversations_list(const keyring_identity *id, const s
     goto end;
 
 end:
+  if (id && meshms_failed(status))
+    cache_drop(id->box_pk);
   rhizome_manifest_free(m);
   DEBUGF(meshms, "status=%d", status);
   return status;
@@ -733,7 +897,7 @@ enum meshms_status meshms_message_iterator_open(struct meshms_message_iterator *
 	goto fail;
       if (status == MESHMS_STATUS_UPDATED)
 	// ignore failures, we can retry later anyway.
-	write_known_conversations(m, conv);
+	write_known_conversations(id, m, conv);
 
       if (meshms_failed(status = open_ply(&c->my_ply, &iter->_my_reader)))
 	goto fail;
@@ -761,6 +925,8 @@ enum meshms_status meshms_message_iterator_open(struct meshms_message_iterator *
 error:
   status = MESHMS_STATUS_ERROR;
 fail:
+  if (id)
+    cache_drop(id->box_pk);
   meshms_message_iterator_close(iter);
   meshms_free_conversations(conv);
   return status;
@@ -864,21 +1030,98 @@ enum meshms_status meshms_message_iterator_prev(struct meshms_message_iterator *
   }
 }
 
+enum meshms_status meshms_message_iterator_seek(struct meshms_message_iterator *iter, uint64_t my_offset, uint64_t their_offset)
+{
+  DEBUGF(meshms, "iter=%p, my_offset=%"PRIu64", their_offset=%"PRIu64, iter, my_offset, their_offset);
+  iter->_in_ack = 0;
+  iter->timestamp = 0;
+  if (their_offset == 0) {
+    // A sent message; re-read its record so that my ply continues from the one before it.
+    if (!iter->my_ply.found)
+      return MESHMS_STATUS_OK;
+    if (my_offset > iter->_my_reader.read.length)
+      my_offset = iter->_my_reader.read.length;
+    iter->_my_reader.read.offset = my_offset;
+    if (message_ply_read_prev(&iter->_my_reader) != 0)
+      iter->_my_reader.read.offset = 0;
+    return MESHMS_STATUS_OK;
+  }
+  if (!iter->their_ply.found)
+    return MESHMS_STATUS_OK;
+  if (my_offset == 0) {
+    // A received message that we have not acked yet; my ply is still unread.
+    iter->_my_reader.read.offset = iter->_my_reader.read.length;
+    iter->my_offset = 0;
+    iter->_end_range = iter->metadata.my_last_ack;
+  } else {
+    // A received message; re-read the ack in my ply that covers it, to find the range being read.
+    if (!iter->my_ply.found)
+      return MESHMS_STATUS_OK;
+    if (my_offset > iter->_my_reader.read.length)
+      my_offset = iter->_my_reader.read.length;
+    iter->_my_reader.read.offset = my_offset;
+    struct message_ply_ack ack;
+    if (   message_ply_read_prev(&iter->_my_reader) != 0
+	|| iter->_my_reader.type != MESSAGE_BLOCK_TYPE_ACK
+	|| message_ply_parse_ack(&iter->_my_reader, &ack) == -1
+    ) {
+      WARNF("No MeshMS2 ack at my ply offset %"PRIu64, my_offset);
+      return MESHMS_STATUS_PROTOCOL_FAULT;
+    }
+    iter->my_offset = my_offset;
+    iter->_end_range = ack.start_offset;
+  }
+  // Re-read the received message, so that their ply continues from the one before it.
+  if (their_offset > iter->_their_reader.read.length)
+    their_offset = iter->_their_reader.read.length;
+  iter->_their_reader.read.offset = their_offset;
+  if (message_ply_read_prev(&iter->_their_reader) == 0)
+    iter->_in_ack = 1;
+  return MESHMS_STATUS_OK;
+}
+
 enum meshms_status meshms_send_message(const sid_t *sender, const sid_t *recipient, const char *message, size_t message_len)
+{
+  struct meshms_outgoing outgoing = {
+    .recipient = recipient,
+    .message = message,
+    .message_len = message_len
+  };
+  return meshms_send_messages(sender, 1, &outgoing);
+}
+
+// The records to append to one recipient's ply.
+struct meshms_append {
+  struct meshms_conversations *conv;
+  struct overlay_buffer *buffer;
+  unsigned count;
+  uint8_t ack;
+  enum meshms_status status;
+};
+
+enum meshms_status meshms_send_messages(const sid_t *sender, unsigned count, struct meshms_outgoing *messages)
 {
   assert(keyring != NULL);
-  assert(message_len != 0);
-  if (message_len > MESSAGE_PLY_MAX_LEN) {
-    WHY("message too long");
-    return MESHMS_STATUS_ERROR;
+  assert(count != 0);
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    assert(messages[i].message_len != 0);
+    if (messages[i].message_len > MESSAGE_PLY_MAX_LEN) {
+      WHY("message too long");
+      return MESHMS_STATUS_ERROR;
+    }
   }
   struct meshms_conversations *conv = NULL;
   enum meshms_status status = MESHMS_STATUS_ERROR;
   rhizome_manifest *m=NULL;
+  struct meshms_append *appends = NULL;
+  unsigned nappends = 0;
 
   keyring_identity *id = keyring_find_identity_sid(keyring, sender);
-  if (!id)
-    return MESHMS_STATUS_SID_LOCKED;
+  if (!id){
+    status = MESHMS_STATUS_SID_LOCKED;
+    goto end;
+  }
 
   m = rhizome_new_manifest();
   if (!m)
@@ -886,62 +1129,104 @@ enum meshms_status meshms_send_message(const sid_t *sender, const sid_t *recipie
 
   if (meshms_failed(status = meshms_open_list(id, m, &conv)))
     goto end;
+  status = MESHMS_STATUS_ERROR;
 
-  struct meshms_conversations *c = conv;
-  while(c && cmp_sid_t(recipient, &c->them)!=0)
-    c = c->_next;
-
-  if (!c){
-    c = (struct meshms_conversations *) emalloc_zero(sizeof(struct meshms_conversations));
-    if (!c)
-      goto end;
-    c->them = *recipient;
-    c->_next = conv;
-    conv = c;
-    status = MESHMS_STATUS_UPDATED;
-  }
-
-  enum meshms_status tmp_status = update_stats(c);
-  if (meshms_failed(tmp_status))
-    return tmp_status;
-  if (tmp_status == MESHMS_STATUS_UPDATED)
-    status = tmp_status;
-
-  // construct a message payload
-  struct overlay_buffer *b = ob_new();
+  if (!(appends = emalloc_zero(sizeof(struct meshms_append) * count)))
+    goto end;
 
-  // if we didn't "know" them, or we just received a new message, we may need to add an ack now.
-  // lets do that in one hit
-  uint8_t ack = (c->metadata.my_last_ack < c->metadata.their_last_message) ? 1:0;
-  DEBUGF(meshms,"Our ack %"PRIu64", their message %"PRIu64, c->metadata.my_last_ack, c->metadata.their_last_message);
-  if (ack){
-    struct message_ply_ack ack;
-    bzero(&ack, sizeof ack);
-    ack.end_offset = c->metadata.their_last_message;
-    ack.start_offset = c->metadata.my_last_ack;
-    message_ply_append_ack(b, &ack);
+  // Gather each recipient's messages, in the order given, to append to their ply in one write.
+  for (i = 0; i < count; i++) {
+    const sid_t *recipient = messages[i].recipient;
+    struct meshms_append *a = appends;
+    while (a < appends + nappends && cmp_sid_t(recipient, &a->conv->them) != 0)
+      a++;
+    if (a == appends + nappends) {
+      struct meshms_conversations *c = conv;
+      while(c && cmp_sid_t(recipient, &c->them)!=0)
+	c = c->_next;
+      if (!c){
+	c = (struct meshms_conversations *) emalloc_zero(sizeof(struct meshms_conversations));
+	if (!c)
+	  goto end;
+	c->them = *recipient;
+	c->_next = conv;
+	conv = c;
+      }
+      enum meshms_status tmp_status = update_stats(c);
+      if (meshms_failed(tmp_status)){
+	status = tmp_status;
+	goto end;
+      }
+      if (!(a->buffer = ob_new()))
+	goto end;
+      a->conv = c;
+      nappends++;
+
+      // if we didn't "know" them, or we just received a new message, we may need to add an ack now.
+      // lets do that in one hit
+      a->ack = (c->metadata.my_last_ack < c->metadata.their_last_message) ? 1:0;
+      DEBUGF(meshms,"Our ack %"PRIu64", their message %"PRIu64, c->metadata.my_last_ack, c->metadata.their_last_message);
+      if (a->ack){
+	struct message_ply_ack ack;
+	bzero(&ack, sizeof ack);
+	ack.end_offset = c->metadata.their_last_message;
+	ack.start_offset = c->metadata.my_last_ack;
+	message_ply_append_ack(a->buffer, &ack);
+      }
+    }
+    message_ply_append_message(a->buffer, messages[i].message, messages[i].message_len);
+    message_ply_append_timestamp(a->buffer);
+    a->count++;
   }
-  message_ply_append_message(b, message, message_len);
-  message_ply_append_timestamp(b);
 
-  assert(!ob_overrun(b));
-
-  if (message_ply_append(id, RHIZOME_SERVICE_MESHMS2, recipient, &c->my_ply, b, NULL, 0, NULL)==0){
-    if (ack)
+  // One new version of each ply, however many messages it gained.  A failed ply does not stop
+  // the others, as those already written cannot be taken back.
+  unsigned written = 0;
+  for (i = 0; i < nappends; i++) {
+    struct meshms_append *a = &appends[i];
+    struct meshms_conversations *c = a->conv;
+    a->status = MESHMS_STATUS_ERROR;
+    if (ob_overrun(a->buffer))
+      continue;
+    DEBUGF(meshms, "Appending %u message(s), %zu bytes, to ply for %s", a->count, ob_position(a->buffer), alloca_tohex_sid_t(c->them));
+    if (message_ply_append(id, RHIZOME_SERVICE_MESHMS2, &c->them, &c->my_ply, a->buffer, NULL, 0, NULL)!=0){
+      WARNF("Failed to append %u message(s) to ply for %s", a->count, alloca_tohex_sid_t(c->them));
+      continue;
+    }
+    if (a->ack)
       c->metadata.my_last_ack = c->metadata.their_last_message;
-    c->metadata.my_size += ob_position(b);
+    c->metadata.my_size += ob_position(a->buffer);
+    a->status = MESHMS_STATUS_UPDATED;
+    written++;
+  }
 
-    // save known conversations since our stats will always change.
-    write_known_conversations(m, conv);
+  // save known conversations since our stats will always change, even if only some plies were
+  // written, so that the list agrees with them.
+  if (written)
+    write_known_conversations(id, m, conv);
 
+  if (written == nappends)
     status = MESHMS_STATUS_UPDATED;
-  }else{
-    status = MESHMS_STATUS_ERROR;
-  }
-
-  ob_free(b);
 
 end:
+  // Report the outcome of each message; those not reached by the append loop share the overall status.
+  for (i = 0; i < count; i++) {
+    messages[i].status = status;
+    unsigned j;
+    for (j = 0; j < nappends; j++) {
+      if (appends[j].status && cmp_sid_t(messages[i].recipient, &appends[j].conv->them) == 0) {
+	messages[i].status = appends[j].status;
+	break;
+      }
+    }
+  }
+  if (appends){
+    for (i = 0; i < nappends; i++)
+      ob_free(appends[i].buffer);
+    free(appends);
+  }
+  if (id && meshms_failed(status))
+    cache_drop(id->box_pk);
   if (m)
     rhizome_manifest_free(m);
   meshms_free_conversations(conv);
@@ -983,8 +1268,10 @@ enum meshms_status meshms_mark_read(const sid_t *sender, const sid_t *recipient,
   changed += mark_read(conv, recipient, offset);
   DEBUGF(meshms, "changed=%u", changed);
   if (changed)
-    status = write_known_conversations(m, conv);
+    status = write_known_conversations(id, m, conv);
 end:
+  if (id && meshms_failed(status))
+    cache_drop(id->box_pk);
   if (m)
     rhizome_manifest_free(m);
   meshms_free_conversations(conv);
@@ -155,6 +155,15 @@ enum meshms_status meshms_message_iterator_open(struct meshms_message_iterator *
 void meshms_message_iterator_close(struct meshms_message_iterator *);
 enum meshms_status meshms_message_iterator_prev(struct meshms_message_iterator *);
 
+/* Continue an iteration from an earlier one, so that the next call to
+ * meshms_message_iterator_prev() advances to the message before the one that
+ * had the given 'my_offset' and 'their_offset' fields.  Reads at most one
+ * record from each ply, so listing a page of older messages costs the same
+ * however far back it starts.  The 'timestamp' field is zero until the next
+ * timestamp record, so a caller that saved it with the offsets should restore it.
+ */
+enum meshms_status meshms_message_iterator_seek(struct meshms_message_iterator *, uint64_t my_offset, uint64_t their_offset);
+
 /* Append a message ('message_len' bytes of UTF8 at 'message') to the sender's
  * ply in the conversation between 'sender' and 'recipient'.  If no
  * conversation (ply bundle) exists, then create it.  Returns
@@ -164,6 +173,28 @@ enum meshms_status meshms_message_iterator_prev(struct meshms_message_iterator *
 
 enum meshms_status meshms_send_message(const sid_t *sender, const sid_t *recipient, const char *message, size_t message_len);
 
+/* Append a batch of messages from 'sender', as if by meshms_send_message()
+ * for each in turn, but with all of each recipient's messages appended to
+ * their ply in a single write.  So each ply gets one new manifest version and
+ * signature, and the conversation list is saved once, however many messages
+ * are sent.  Returns MESHMS_STATUS_UPDATED on success, any other value
+ * indicates a failure or error (which is already logged).
+ *
+ * The plies are separate bundles, so one can fail after others have been
+ * written.  Every ply is still attempted, and the conversation list is saved
+ * if any were written.  On return, each message's 'status' is
+ * MESHMS_STATUS_UPDATED if it was sent, otherwise the reason it was not, so a
+ * caller can resend just the messages that failed.
+ */
+struct meshms_outgoing {
+  const sid_t *recipient;
+  const char *message; // UTF8, including the terminating NUL
+  size_t message_len;
+  enum meshms_status status; // set by meshms_send_messages()
+};
+
+enum meshms_status meshms_send_messages(const sid_t *sender, unsigned count, struct meshms_outgoing *messages);
+
 /* Update the read offset for one or more conversations.  Returns
  * MESHMS_STATUS_UPDATED on success, any other value indicates a failure or
  * error (which is already logged).
@@ -123,15 +123,67 @@ static int app_meshms_send_message(const struct cli_parsed *parsed, struct cli_c
   return meshms_failed(status) ? status : 0;
 }
 
+DEFINE_CMD(app_meshms_send_messages, 0,
+  "Send one or more MeshMS messages from <sender_sid> to <recipient_sid>, in a single append to the conversation",
+  "meshms","send","messages" KEYRING_PIN_OPTIONS, "<sender_sid>", "<recipient_sid>", "<payload>", "...");
+static int app_meshms_send_messages(const struct cli_parsed *parsed, struct cli_context *UNUSED(context))
+{
+  const char *my_sidhex, *their_sidhex, *message;
+  if (cli_arg(parsed, "sender_sid", &my_sidhex, str_is_subscriber_id, "") == -1
+    || cli_arg(parsed, "recipient_sid", &their_sidhex, str_is_subscriber_id, "") == -1
+    || cli_arg(parsed, "payload", &message, NULL, "") == -1)
+    return -1;
+
+  sid_t my_sid, their_sid;
+  if (str_to_sid_t(&my_sid, my_sidhex) == -1)
+    return WHY("Invalid sender SID");
+  if (str_to_sid_t(&their_sid, their_sidhex) == -1)
+    return WHY("Invalid recipient SID");
+
+  unsigned nextra = (parsed->varargi == -1) ? 0 : parsed->argc - (unsigned)parsed->varargi;
+  struct meshms_outgoing messages[nextra + 1];
+  unsigned i;
+  for (i = 0; i <= nextra; i++) {
+    messages[i].recipient = &their_sid;
+    messages[i].message = i ? parsed->args[parsed->varargi + i - 1] : message;
+    // include terminating NUL
+    messages[i].message_len = strlen(messages[i].message) + 1;
+  }
+
+  if (create_serval_instance_dir() == -1)
+    return -1;
+  assert(keyring == NULL);
+  if (!(keyring = keyring_open_instance_cli(parsed)))
+    return -1;
+  if (rhizome_opendb() == -1)
+    return -1;
+
+  enum meshms_status status = meshms_send_messages(&my_sid, nextra + 1, messages);
+  return meshms_failed(status) ? status : 0;
+}
+
 DEFINE_CMD(app_meshms_list_messages, 0,
-   "List MeshMS messages between <sender_sid> and <recipient_sid>",
-   "meshms","list","messages" KEYRING_PIN_OPTIONS, "<sender_sid>","<recipient_sid>");
+   "List MeshMS messages between <sender_sid> and <recipient_sid>, at most <count>, starting before the message at <my_offset> and <their_offset>",
+   "meshms","list","messages" KEYRING_PIN_OPTIONS, "<sender_sid>","<recipient_sid>","[<count>]","[<my_offset>]","[<their_offset>]");
 static int app_meshms_list_messages(const struct cli_parsed *parsed, struct cli_context *context)
 {
-  const char *my_sidhex, *their_sidhex;
+  const char *my_sidhex, *their_sidhex, *count_str, *my_offset_str, *their_offset_str;
   if (cli_arg(parsed, "sender_sid", &my_sidhex, str_is_subscriber_id, "") == -1
-    || cli_arg(parsed, "recipient_sid", &their_sidhex, str_is_subscriber_id, "") == -1)
+    || cli_arg(parsed, "recipient_sid", &their_sidhex, str_is_subscriber_id, "") == -1
+    || cli_arg(parsed, "count", &count_str, str_is_uint64_decimal, NULL) == -1
+    || cli_arg(parsed, "my_offset", &my_offset_str, str_is_uint64_decimal, NULL) == -1
+    || cli_arg(parsed, "their_offset", &their_offset_str, str_is_uint64_decimal, NULL) == -1)
     return -1;
+  uint64_t count = 0, my_offset = 0, their_offset = 0;
+  if (count_str && !str_to_uint64(count_str, 10, &count, NULL))
+    return WHYF("count_str=%s", count_str);
+  if (my_offset_str) {
+    if (!their_offset_str)
+      return WHY("missing their_offset");
+    if (   !str_to_uint64(my_offset_str, 10, &my_offset, NULL)
+	|| !str_to_uint64(their_offset_str, 10, &their_offset, NULL))
+      return WHYF("my_offset_str=%s their_offset_str=%s", my_offset_str, their_offset_str);
+  }
   if (create_serval_instance_dir() == -1)
     return -1;
   assert(keyring == NULL);
@@ -154,9 +206,23 @@ static int app_meshms_list_messages(const struct cli_parsed *parsed, struct cli_
   cli_start_table(context, NELS(names), names);
   bool_t marked_delivered = 0;
   bool_t marked_read = 0;
+  bool_t resumed_after_sent = 0;
+  if (my_offset || their_offset) {
+    if (meshms_failed(status = meshms_message_iterator_seek(&iter, my_offset, their_offset))) {
+      meshms_message_iterator_close(&iter);
+      return status;
+    }
+    // Don't repeat the markers if they were listed before the message we continue from.  The ACK
+    // marker precedes our newest message that they have received, the read marker precedes their
+    // newest message that we have read.
+    marked_delivered = my_offset && iter.metadata.their_last_ack >= my_offset;
+    marked_read = their_offset && iter.metadata.read_offset >= their_offset;
+    resumed_after_sent = !their_offset;
+  }
   time_s_t now = gettime();
   int id = 0;
-  while ((status = meshms_message_iterator_prev(&iter)) == MESHMS_STATUS_UPDATED) {
+  uint64_t listed = 0;
+  while ((!count || listed < count) && (status = meshms_message_iterator_prev(&iter)) == MESHMS_STATUS_UPDATED) {
     switch (iter.type) {
       case MESSAGE_SENT:
 	if (iter.delivered && !marked_delivered){
@@ -175,19 +241,23 @@ static int app_meshms_list_messages(const struct cli_parsed *parsed, struct cli_
 	cli_put_long(context, iter.timestamp ? (long)(now - iter.timestamp):(long)-1, ":");
 	cli_put_string(context, ">", ":");
 	cli_put_string(context, iter.text, "\n");
+	++listed;
 	break;
       case ACK_RECEIVED:
 	break;
       case MESSAGE_RECEIVED:
-	if (iter.read && !marked_read) {
+	// After one of our messages, a newer read message may already have been listed, unless
+	// this is the one the read marker points to.
+	if (iter.read && !marked_read && (!resumed_after_sent || iter.their_offset >= iter.metadata.read_offset)) {
 	  cli_put_long(context, id++, ":");
 	  cli_put_long(context, iter.metadata.read_offset, ":");
 	  cli_put_long(context, 0, ":");
 	  cli_put_long(context, iter.timestamp ? (long)(now - iter.timestamp):(long)-1, ":");
 	  cli_put_string(context, "MARK", ":");
 	  cli_put_string(context, "read", "\n");
-	  marked_read = 1;
 	}
+	if (iter.read)
+	  marked_read = 1;
 	// TODO new message format here
 	cli_put_long(context, id++, ":");
 	cli_put_long(context, iter.my_offset, ":");
@@ -195,9 +265,13 @@ static int app_meshms_list_messages(const struct cli_parsed *parsed, struct cli_
 	cli_put_long(context, iter.timestamp ? (long)(now - iter.timestamp):(long)-1, ":");
 	cli_put_string(context, "<", ":");
 	cli_put_string(context, iter.text, "\n");
+	++listed;
 	break;
     }
   }
+  // stopping at <count> leaves the status of the last message read
+  if (status == MESHMS_STATUS_UPDATED)
+    status = MESHMS_STATUS_OK;
   if (!meshms_failed(status))
     cli_end_table(context, id);
   meshms_message_iterator_close(&iter);
@@ -47,6 +47,13 @@ static void finalise_union_meshms_sendmessage(httpd_request *r)
   form_buf_malloc_release(&r->u.sendmsg.message);
 }
 
+static void finalise_union_meshms_sendmessages(httpd_request *r)
+{
+  form_buf_malloc_release(&r->u.sendmsgs.text);
+  // the messages array is request memory, so is freed with the request
+  r->u.sendmsgs.messages = NULL;
+}
+
 #define MAX_TOKEN_LEN 21
 #define MESHMS_TOKEN_STRLEN (BASE64_ENCODED_LEN(MAX_TOKEN_LEN))
 #define alloca_meshms_token(pos) meshms_token_to_str(alloca(MESHMS_TOKEN_STRLEN + 1), (pos))
@@ -94,6 +101,48 @@ blank:
   return 1;
 }
 
+/* A page token is the position of the last message in a page, as the 'my_offset' and 'their_offset'
+ * that meshms_message_iterator_seek() needs to continue from it, and the timestamp in effect there.
+ */
+#define MAX_PAGE_TOKEN_LEN 30
+#define MESHMS_PAGE_TOKEN_STRLEN (BASE64_ENCODED_LEN(MAX_PAGE_TOKEN_LEN))
+#define alloca_meshms_page_token(iter) meshms_page_token_to_str(alloca(MESHMS_PAGE_TOKEN_STRLEN + 1), (iter))
+
+static char *meshms_page_token_to_str(char *buf, const struct meshms_message_iterator *iter)
+{
+  uint8_t tmp[MAX_PAGE_TOKEN_LEN];
+  int ofs = 0;
+  ofs += pack_uint(tmp + ofs, iter->my_offset);
+  ofs += pack_uint(tmp + ofs, iter->their_offset);
+  ofs += pack_uint(tmp + ofs, iter->timestamp);
+  assert(ofs <= MAX_PAGE_TOKEN_LEN);
+  size_t n = base64url_encode(buf, tmp, ofs);
+  assert(n <= MESHMS_PAGE_TOKEN_STRLEN);
+  buf[n] = '\0';
+  return buf;
+}
+
+static int strn_to_meshms_page_token(const char *str, httpd_request *r, const char **afterp)
+{
+  uint8_t token[MAX_PAGE_TOKEN_LEN];
+  size_t token_len = base64url_decode(token, sizeof token, str, 0, afterp, 0, NULL);
+
+  size_t ofs = 0;
+  int unpacked;
+  if ((unpacked = unpack_uint(token + ofs, token_len - ofs, &r->u.msglist.before_my_offset)) == -1)
+    return 0;
+  ofs += unpacked;
+  if ((unpacked = unpack_uint(token + ofs, token_len - ofs, &r->u.msglist.before_their_offset)) == -1)
+    return 0;
+  ofs += unpacked;
+  if ((unpacked = unpack_uint(token + ofs, token_len - ofs, &r->u.msglist.before_timestamp)) == -1)
+    return 0;
+  if ((!r->u.msglist.before_my_offset && !r->u.msglist.before_their_offset) || **afterp != '/')
+    return 0;
+  (*afterp)++;
+  return 1;
+}
+
 static int http_request_meshms_response(struct httpd_request *r, uint16_t result, const char *message, enum meshms_status status)
 {
   uint16_t meshms_result = 0;
@@ -144,6 +193,7 @@ static HTTP_HANDLER restful_meshms_conversationlist_json;
 static HTTP_HANDLER restful_meshms_messagelist_json;
 static HTTP_HANDLER restful_meshms_newsince_messagelist_json;
 static HTTP_HANDLER restful_meshms_sendmessage;
+static HTTP_HANDLER restful_meshms_sendmessages;
 static HTTP_HANDLER restful_meshms_read_all_conversations;
 static HTTP_HANDLER restful_meshms_read_all_messages;
 static HTTP_HANDLER restful_meshms_read_to_offset;
@@ -172,12 +222,24 @@ static int restful_meshms_(httpd_request *r, const char *remainder)
       content_length = 0;
       remainder = "";
     }
+    else if (strcmp(remainder, "/sendmessages") == 0) {
+      handler = restful_meshms_sendmessages;
+      verb = HTTP_VERB_POST;
+      remainder = "";
+    }
     else if (*remainder == '/' && parse_sid_t(&r->sid2, remainder + 1, -1, &end) != -1) {
       remainder = end;
       if (strcmp(remainder, "/messagelist.json") == 0) {
 	handler = restful_meshms_messagelist_json;
 	remainder = "";
       }
+      else if (   str_startswith(remainder, "/before/", &end)
+	       && strn_to_meshms_page_token(end, r, &end)
+	       && strcmp(end, "messagelist.json") == 0
+      ) {
+	handler = restful_meshms_messagelist_json;
+	remainder = "";
+      }
       else if (strcmp(remainder, "/newsince/messagelist.json") == 0){
 	handler = restful_meshms_newsince_messagelist_json;
 	remainder = "";
@@ -352,9 +414,16 @@ static int restful_meshms_messagelist_json(httpd_request *r, const char *remaind
 {
   if (*remainder)
     return 404;
+  const char *limit = http_request_get_query_param(&r->http, "limit");
+  r->u.msglist.limit = 0;
+  if (limit && (!str_to_uint32(limit, 10, &r->u.msglist.limit, NULL) || r->u.msglist.limit == 0)) {
+    http_request_simple_response(&r->http, 400, "Invalid limit");
+    return 400;
+  }
   assert(r->finalise_union == NULL);
   r->finalise_union = finalise_union_meshms_messagelist;
   r->u.msglist.rowcount = 0;
+  r->u.msglist.listed = 0;
   r->u.msglist.phase = LIST_HEADER;
   r->u.msglist.token.which_ply = NEITHER_PLY;
   r->u.msglist.token.offset = 0;
@@ -363,6 +432,18 @@ static int restful_meshms_messagelist_json(httpd_request *r, const char *remaind
   enum meshms_status status;
   if (meshms_failed(status = reopen_meshms_message_iterator(r)))
     return http_request_meshms_response(r, 0, NULL, status);
+  if (!r->u.msglist.finished && (r->u.msglist.before_my_offset || r->u.msglist.before_their_offset)) {
+    // The ACK row has already been listed if the page before this one ended at or after the
+    // latest message they received.
+    if (r->u.msglist.before_my_offset && r->u.msglist.latest.their_ack >= r->u.msglist.before_my_offset)
+      r->u.msglist.token.their_ack = r->u.msglist.latest.their_ack;
+    if (meshms_failed(status = meshms_message_iterator_seek(&r->u.msglist.iter, r->u.msglist.before_my_offset, r->u.msglist.before_their_offset)))
+      return http_request_meshms_response(r, 0, NULL, status);
+    r->u.msglist.iter.timestamp = r->u.msglist.before_timestamp;
+    if (meshms_failed(status = meshms_message_iterator_prev(&r->u.msglist.iter)))
+      return http_request_meshms_response(r, 0, NULL, status);
+    r->u.msglist.finished = status != MESHMS_STATUS_UPDATED;
+  }
   http_request_response_generated(&r->http, 200, CONTENT_TYPE_JSON, restful_meshms_messagelist_json_content);
   return 1;
 }
@@ -374,6 +455,7 @@ static int restful_meshms_newsince_messagelist_json(httpd_request *r, const char
   assert(r->finalise_union == NULL);
   r->finalise_union = finalise_union_meshms_messagelist;
   r->trigger_rhizome_bundle_added = on_rhizome_bundle_added;
+  httpd_watch_conversation(r, RHIZOME_SERVICE_MESHMS2, &r->sid1, &r->sid2);
   r->u.msglist.rowcount = 0;
   r->u.msglist.phase = LIST_HEADER;
   r->u.msglist.dirty = 1;
@@ -549,6 +631,12 @@ static int restful_meshms_messagelist_json_content_chunk(struct http_request *hr
 	  }
 	  if (!strbuf_overrun(b)) {
 	    r->u.msglist.rowcount+=rows;
+	    r->u.msglist.listed+=rows;
+	    if (r->u.msglist.limit && r->u.msglist.listed >= r->u.msglist.limit) {
+	      // leave the iterator on the last message listed, for the "next" token
+	      r->u.msglist.phase = LIST_END;
+	      return 1;
+	    }
 	    enum meshms_status status;
 	    if (meshms_failed(status = meshms_message_iterator_prev(&r->u.msglist.iter)))
 	      return http_request_meshms_response(r, 0, NULL, status);
@@ -560,7 +648,15 @@ static int restful_meshms_messagelist_json_content_chunk(struct http_request *hr
       }
       // fall through...
     case LIST_END:
-      strbuf_puts(b, "\n]\n}\n");
+      strbuf_puts(b, "\n]");
+      if (r->u.msglist.limit) {
+	strbuf_puts(b, ",\n\"next\":");
+	if (r->u.msglist.finished)
+	  strbuf_json_null(b);
+	else
+	  strbuf_json_string(b, alloca_meshms_page_token(&r->u.msglist.iter));
+      }
+      strbuf_puts(b, "\n}\n");
       if (!strbuf_overrun(b))
 	r->u.msglist.phase = LIST_DONE;
       // fall through...
@@ -696,6 +792,206 @@ static int restful_meshms_sendmessage_end(struct http_request *hr)
   return http_request_meshms_response(r, 201, "Message sent", status);
 }
 
+/* A batch of messages is sent as a "recipient" part, naming the SID that the "message" parts
+ * following it are sent to, then another "recipient" part for the next conversation, and so on.
+ * All the messages are appended once the request body has arrived, by meshms_send_messages().
+ */
+
+struct meshms_batch_message {
+  sid_t recipient;
+  size_t start; // in r->u.sendmsgs.text
+  size_t length;
+};
+
+static HTTP_REQUEST_PARSER restful_meshms_sendmessages_end;
+static int send_batch_part_start(struct http_request *);
+static int send_batch_part_end(struct http_request *);
+static int send_batch_part_header(struct http_request *, const struct mime_part_headers *);
+static int send_batch_part_body(struct http_request *, char *, size_t);
+
+static int restful_meshms_sendmessages(httpd_request *r, const char *remainder)
+{
+  if (*remainder)
+    return 404;
+  assert(r->finalise_union == NULL);
+  r->finalise_union = finalise_union_meshms_sendmessages;
+  bzero(&r->u.sendmsgs, sizeof r->u.sendmsgs);
+  // The total size of the batch is bounded by the request memory limit.
+  form_buf_malloc_init(&r->u.sendmsgs.text, 0);
+  r->http.form_data.handle_mime_part_start = send_batch_part_start;
+  r->http.form_data.handle_mime_part_end = send_batch_part_end;
+  r->http.form_data.handle_mime_part_header = send_batch_part_header;
+  r->http.form_data.handle_mime_body = send_batch_part_body;
+  r->http.handle_content_end = restful_meshms_sendmessages_end;
+  return 1;
+}
+
+static char PART_RECIPIENT[] = "recipient";
+
+static int send_batch_part_start(struct http_request *hr)
+{
+  httpd_request *r = (httpd_request *) hr;
+  assert(r->u.sendmsgs.current_part == NULL);
+  return 0;
+}
+
+static int send_batch_part_end(struct http_request *hr)
+{
+  httpd_request *r = (httpd_request *) hr;
+  if (r->u.sendmsgs.current_part == PART_RECIPIENT) {
+    if (strn_to_sid_t(&r->u.sendmsgs.recipient, r->u.sendmsgs.recipient_text, r->u.sendmsgs.recipient_text_len) == -1)
+      return http_response_form_part(r, 400, "Invalid", PART_RECIPIENT, r->u.sendmsgs.recipient_text, r->u.sendmsgs.recipient_text_len);
+    r->u.sendmsgs.received_recipient = 1;
+    DEBUGF(httpd, "received %s = %s", PART_RECIPIENT, alloca_tohex_sid_t(r->u.sendmsgs.recipient));
+  }
+  else if (r->u.sendmsgs.current_part == PART_MESSAGE) {
+    size_t length = r->u.sendmsgs.text.length - r->u.sendmsgs.message_start;
+    if (length == 0)
+      return http_response_form_part(r, 400, "Invalid (empty)", PART_MESSAGE, NULL, 0);
+    if (r->u.sendmsgs.count == r->u.sendmsgs.alloc) {
+      unsigned alloc = r->u.sendmsgs.alloc ? r->u.sendmsgs.alloc * 2 : 16;
+      struct meshms_batch_message *messages = http_request_realloc(&r->http, r->u.sendmsgs.messages,
+	  sizeof(struct meshms_batch_message) * r->u.sendmsgs.alloc,
+	  sizeof(struct meshms_batch_message) * alloc);
+      if (!messages) {
+	http_request_simple_response(&r->http, 500, NULL);
+	return 500;
+      }
+      r->u.sendmsgs.messages = messages;
+      r->u.sendmsgs.alloc = alloc;
+    }
+    struct meshms_batch_message *msg = &r->u.sendmsgs.messages[r->u.sendmsgs.count++];
+    msg->recipient = r->u.sendmsgs.recipient;
+    msg->start = r->u.sendmsgs.message_start;
+    msg->length = length;
+    DEBUGF(httpd, "received %s = %s", PART_MESSAGE, alloca_toprint(-1, r->u.sendmsgs.text.buffer + msg->start, length));
+  } else
+    FATALF("current_part = %s", alloca_str_toprint(r->u.sendmsgs.current_part));
+  r->u.sendmsgs.current_part = NULL;
+  return 0;
+}
+
+static int send_batch_part_header(struct http_request *hr, const struct mime_part_headers *h)
+{
+  httpd_request *r = (httpd_request *) hr;
+  if (!h->content_disposition.type[0])
+    return http_response_content_disposition(r, 415, "Missing", h->content_disposition.type);
+  if (strcmp(h->content_disposition.type, "form-data") != 0)
+    return http_response_content_disposition(r, 415, "Unsupported", h->content_disposition.type);
+  if (strcmp(h->content_disposition.name, PART_RECIPIENT) == 0) {
+    // TODO enforce correct content type
+    r->u.sendmsgs.current_part = PART_RECIPIENT;
+    r->u.sendmsgs.received_recipient = 0;
+    r->u.sendmsgs.recipient_text_len = 0;
+    return 0;
+  }
+  if (strcmp(h->content_disposition.name, PART_MESSAGE) != 0)
+    return http_response_form_part(r, 415, "Unsupported", h->content_disposition.name, NULL, 0);
+  if (!r->u.sendmsgs.received_recipient)
+    return http_response_form_part(r, 400, "Missing", PART_RECIPIENT, NULL, 0);
+  r->u.sendmsgs.current_part = PART_MESSAGE;
+  r->u.sendmsgs.message_start = r->u.sendmsgs.text.length;
+  if (!h->content_type.type[0] || !h->content_type.subtype[0])
+    return http_response_content_type(r, 400, "Missing", &h->content_type);
+  if (strcmp(h->content_type.type, "text") != 0 || strcmp(h->content_type.subtype, "plain") != 0)
+    return http_response_content_type(r, 415, "Unsupported", &h->content_type);
+  if (!h->content_type.charset[0])
+    return http_response_content_type(r, 400, "Missing charset", &h->content_type);
+  if (strcmp(h->content_type.charset, "utf-8") != 0)
+    return http_response_content_type(r, 415, "Unsupported charset", &h->content_type);
+  return 0;
+}
+
+static int send_batch_part_body(struct http_request *hr, char *buf, size_t len)
+{
+  httpd_request *r = (httpd_request *) hr;
+  if (r->u.sendmsgs.current_part == PART_RECIPIENT) {
+    accumulate_text(r, PART_RECIPIENT,
+		    r->u.sendmsgs.recipient_text,
+		    sizeof r->u.sendmsgs.recipient_text,
+		    &r->u.sendmsgs.recipient_text_len,
+		    buf, len);
+  }
+  else if (r->u.sendmsgs.current_part == PART_MESSAGE) {
+    if (r->u.sendmsgs.text.length + len - r->u.sendmsgs.message_start > MESSAGE_PLY_MAX_LEN) {
+      DEBUGF(httpd, "form part \"%s\" overflow, exceeds limit %u", PART_MESSAGE, (unsigned)MESSAGE_PLY_MAX_LEN);
+      http_request_simple_response(&r->http, 400, "Overflow in \"message\" form part");
+      return 400;
+    }
+    return form_buf_malloc_accumulate(r, PART_MESSAGE, &r->u.sendmsgs.text, buf, len);
+  } else
+    FATALF("current_part = %s", alloca_str_toprint(r->u.sendmsgs.current_part));
+  return 0;
+}
+
+/* If some of the batch was sent before a failure, then the response lists the recipients whose
+ * messages were not, so that the client resends only those.  Returns -1 if out of request memory.
+ */
+static int send_batch_failed_recipients(httpd_request *r, unsigned count, const struct meshms_outgoing *messages)
+{
+  unsigned i, nfailed = 0;
+  int sent = 0;
+  for (i = 0; i < count; i++)
+    if (messages[i].status == MESHMS_STATUS_UPDATED)
+      sent = 1;
+  if (!sent)
+    return 0;
+  struct json_atom **itemv = http_request_alloc(&r->http, sizeof(struct json_atom *) * count);
+  if (!itemv)
+    return -1;
+  for (i = 0; i < count; i++) {
+    if (messages[i].status == MESHMS_STATUS_UPDATED)
+      continue;
+    // All the messages to one recipient share the fate of its ply, so list each recipient once.
+    unsigned j;
+    for (j = 0; j < i && cmp_sid_t(messages[j].recipient, messages[i].recipient) != 0; j++)
+      ;
+    if (j < i)
+      continue;
+    struct json_atom *item = http_request_alloc(&r->http, sizeof(struct json_atom));
+    char *hex = http_request_alloc(&r->http, SID_STRLEN + 1);
+    if (!item || !hex)
+      return -1;
+    item->type = JSON_STRING_NULTERM;
+    item->u.string.content = tohex(hex, SID_STRLEN, messages[i].recipient->binary);
+    itemv[nfailed++] = item;
+  }
+  r->http.response.result_extra[2].label = "failed_recipients";
+  r->http.response.result_extra[2].value.type = JSON_ARRAY;
+  r->http.response.result_extra[2].value.u.array.itemc = nfailed;
+  r->http.response.result_extra[2].value.u.array.itemv = itemv;
+  return 0;
+}
+
+static int restful_meshms_sendmessages_end(struct http_request *hr)
+{
+  httpd_request *r = (httpd_request *) hr;
+  unsigned count = r->u.sendmsgs.count;
+  if (count == 0)
+    return http_response_form_part(r, 400, "Missing", PART_MESSAGE, NULL, 0);
+  struct meshms_outgoing *messages = http_request_alloc(&r->http, sizeof(struct meshms_outgoing) * count);
+  if (!messages) {
+    http_request_simple_response(&r->http, 500, NULL);
+    return 500;
+  }
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    const struct meshms_batch_message *msg = &r->u.sendmsgs.messages[i];
+    messages[i].recipient = &msg->recipient;
+    messages[i].message = r->u.sendmsgs.text.buffer + msg->start;
+    messages[i].message_len = msg->length;
+  }
+  enum meshms_status status;
+  if (meshms_failed(status = meshms_send_messages(&r->sid1, count, messages))) {
+    if (send_batch_failed_recipients(r, count, messages) == -1) {
+      http_request_simple_response(&r->http, 500, NULL);
+      return 500;
+    }
+    return http_request_meshms_response(r, 0, NULL, status);
+  }
+  return http_request_meshms_response(r, 201, "Messages sent", status);
+}
+
 static int restful_meshms_read_all_conversations(httpd_request *r, const char *remainder)
 {
   if (*remainder)
@@ -87,6 +87,7 @@ enum tree_error_reason tree_find(struct tree_root *root, void **result, const ui
       struct tree_node *new_node = (struct tree_node *) emalloc_zero(sizeof(struct tree_node));
       if (!new_node)
 	return TREE_ERROR;
+      root->node_count++;
 
       ptr->tree_nodes[nibble] = new_node;
       ptr->is_tree |= (1<<nibble);
@@ -100,7 +101,7 @@ enum tree_error_reason tree_find(struct tree_root *root, void **result, const ui
   }
 }
 
-static int walk(struct tree_node *node, unsigned pos,
+static int walk(struct tree_root *root, struct tree_node *node, unsigned pos,
 	      uint8_t *empty, const uint8_t *binary, size_t bin_length,
 	      walk_callback callback, void *context){
   unsigned i=0, e=16;
@@ -121,9 +122,10 @@ static int walk(struct tree_node *node, unsigned pos,
   for (;i<e;i++){
     if (node->is_tree & (1<<i)){
       uint8_t child_empty=1;
-      ret = walk((struct tree_node *)node->tree_nodes[i], pos+1, &child_empty, binary, bin_length, callback, context);
+      ret = walk(root, (struct tree_node *)node->tree_nodes[i], pos+1, &child_empty, binary, bin_length, callback, context);
       if (child_empty){
 	free(node->tree_nodes[i]);
+	root->node_count--;
 	node->tree_nodes[i]=NULL;
 	node->is_tree&=~(1<<i);
       }
@@ -147,7 +149,7 @@ int tree_walk(struct tree_root *root, const uint8_t *binary, size_t bin_length,
 {
   assert(!binary || bin_length <= root->binary_length);
   uint8_t ignore;
-  return walk(&root->_root_node, 0, &ignore, binary, bin_length, callback, context);
+  return walk(root, &root->_root_node, 0, &ignore, binary, bin_length, callback, context);
 }
 
 int tree_walk_prefix(struct tree_root *root, const uint8_t *binary, size_t bin_length, walk_callback callback, void *context)
@@ -171,5 +173,5 @@ int tree_walk_prefix(struct tree_root *root, const uint8_t *binary, size_t bin_l
   }
   // walk the whole branch
   uint8_t ignore;
-  return walk(node, pos+1, &ignore, NULL, 0, callback, context);
+  return walk(root, node, pos+1, &ignore, NULL, 0, callback, context);
 }
@@ -37,6 +37,8 @@ struct tree_node{
 
 struct tree_root{
   size_t binary_length;
+  // number of tree nodes allocated below the root node, for memory accounting
+  size_t node_count;
   struct tree_node _root_node;
 };
 
@@ -127,6 +127,14 @@ time_ms_t gettime_ms()
   return nowtv.tv_sec * 1000LL + nowtv.tv_usec / 1000;
 }
 
+time_us_t gettime_us()
+{
+  struct timeval nowtv;
+  if (gettimeofday(&nowtv, NULL) == -1)
+    FATAL_perror("gettimeofday");
+  return nowtv.tv_sec * 1000000LL + nowtv.tv_usec;
+}
+
 time_s_t gettime()
 {
   struct timeval nowtv;
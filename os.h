@@ -70,6 +70,9 @@ typedef uint32_t time_s_t;
 
 time_ms_t gettime_ms();
 time_s_t gettime();
+// microseconds since the Unix epoch, for measuring short intervals
+typedef int64_t time_us_t;
+time_us_t gettime_us();
 time_ms_t sleep_ms(time_ms_t milliseconds);
 struct timeval time_ms_to_timeval(time_ms_t);
 
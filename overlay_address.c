@@ -31,6 +31,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "serval.h"
 #include "conf.h"
 #include "crypto.h"
+#include "dataformats.h"
 #include "str.h"
 #include "overlay_address.h"
 #include "overlay_buffer.h"
@@ -40,9 +41,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "route_link.h"
 #include "commandline.h"
 
-#define MAX_BPIS 1024
-#define BPI_MASK 0x3ff
-static struct broadcast bpilist[MAX_BPIS];
+/* Recently seen BPIs are remembered in a two-choice hash table of small buckets.  BPIs are random,
+ * so each half of the identifier selects one candidate bucket.  Entries are forgotten after
+ * mdp.broadcast.timeout_ms, and when both candidate buckets are full of live entries the oldest
+ * of them is evicted.
+ */
+#define BPI_BUCKET_SLOTS 4
+
+struct bpi_entry{
+  struct broadcast bpi;
+  time_ms_t seen;
+};
+
+static struct bpi_entry *bpi_table = NULL;
+static unsigned bpi_bucket_count = 0;
+struct duplicate_stats broadcast_duplicate_stats;
 
 #define OA_CODE_SELF 0xff
 #define OA_CODE_PREVIOUS 0xfe
@@ -156,31 +169,157 @@ int overlay_broadcast_generate_address(struct broadcast *addr)
   return 0;
 }
 
+static struct bpi_entry *bpi_bucket(struct bpi_entry *table, unsigned bucket_count, const struct broadcast *addr, unsigned half)
+{
+  return &table[(read_uint32(&addr->id[half * 4]) % bucket_count) * BPI_BUCKET_SLOTS];
+}
+
+/* Find the live entry for a BPI in either of its candidate buckets.  If it is not there, return
+ * the slot it should take instead: the first expired slot, or failing that the oldest live entry.
+ */
+static struct bpi_entry *bpi_find(struct bpi_entry *table, unsigned bucket_count, const struct broadcast *addr, time_ms_t expired, bool_t *found)
+{
+  struct bpi_entry *slot = NULL, *oldest = NULL;
+  unsigned b, i;
+  *found = 0;
+  for (b = 0; b < 2; b++){
+    struct bpi_entry *bucket = bpi_bucket(table, bucket_count, addr, b);
+    for (i = 0; i < BPI_BUCKET_SLOTS; i++){
+      struct bpi_entry *entry = &bucket[i];
+      if (entry->seen <= expired){
+	if (!slot)
+	  slot = entry;
+	continue;
+      }
+      if (memcmp(entry->bpi.id, addr->id, BROADCAST_LEN) == 0){
+	*found = 1;
+	return entry;
+      }
+      if (!oldest || entry->seen < oldest->seen)
+	oldest = entry;
+    }
+  }
+  return slot ? slot : oldest;
+}
+
+static int bpi_table_configure()
+{
+  unsigned bucket_count = (config.mdp.broadcast.cache_size + BPI_BUCKET_SLOTS - 1) / BPI_BUCKET_SLOTS;
+  if (bucket_count == bpi_bucket_count)
+    return 0;
+  struct bpi_entry *table = emalloc_zero(sizeof(struct bpi_entry) * BPI_BUCKET_SLOTS * bucket_count);
+  if (!table)
+    return -1;
+  DEBUGF(broadcasts, "Remembering up to %u BPIs", bucket_count * BPI_BUCKET_SLOTS);
+  if (bpi_table){
+    // carry the live entries over, keeping the newest if the table has shrunk
+    time_ms_t expired = gettime_ms() - config.mdp.broadcast.timeout_ms;
+    unsigned i;
+    for (i = 0; i < bpi_bucket_count * BPI_BUCKET_SLOTS; i++){
+      struct bpi_entry *entry = &bpi_table[i];
+      if (entry->seen <= expired)
+	continue;
+      bool_t found;
+      struct bpi_entry *slot = bpi_find(table, bucket_count, &entry->bpi, expired, &found);
+      if (slot->seen > expired){
+	broadcast_duplicate_stats.evictions++;
+	if (slot->seen >= entry->seen)
+	  continue;
+      }
+      *slot = *entry;
+    }
+    free(bpi_table);
+  }
+  bpi_table = table;
+  bpi_bucket_count = bucket_count;
+  return 0;
+}
+
 // test if the broadcast address has been seen
 int overlay_broadcast_drop_check(struct broadcast *addr)
 {
-  /* Hash the BPI and see if we have seen it recently.
+  /* Look up the BPI and see if we have seen it recently.
      If so, drop the frame.
-     The occassional failure to supress a broadcast frame is not
-     something we are going to worry about just yet.  For byzantine
-     robustness it is however required. */
-  int bpi_index=0;
-  int i;
-  for(i=0;i<BROADCAST_LEN;i++)
-    {
-      bpi_index=((bpi_index<<3)&0xfff8)+((bpi_index>>13)&0x7);
-      bpi_index^=addr->id[i];
-    }
-  bpi_index&=BPI_MASK;
-  
-  if (memcmp(bpilist[bpi_index].id, addr->id, BROADCAST_LEN)){
-    DEBUGF(broadcasts, "BPI %s is new", alloca_tohex(addr->id, BROADCAST_LEN));
-    bcopy(addr->id, bpilist[bpi_index].id, BROADCAST_LEN);
-    return 0; /* don't drop */
-  }else{
+     The occassional failure to supress a broadcast frame, when a busy
+     table has to evict an entry, is not something we are going to worry
+     about just yet.  For byzantine robustness it is however required. */
+  if (bpi_table_configure() == -1)
+    return 0;
+
+  time_ms_t now = gettime_ms();
+  time_ms_t expired = now - config.mdp.broadcast.timeout_ms;
+  bool_t found;
+  struct bpi_entry *slot = bpi_find(bpi_table, bpi_bucket_count, addr, expired, &found);
+  if (found){
+    broadcast_duplicate_stats.hits++;
     DEBUGF(broadcasts, "BPI %s is a duplicate", alloca_tohex(addr->id, BROADCAST_LEN));
     return 1; /* drop frame because we have seen this BPI recently */
   }
+
+  if (slot->seen > expired){
+    DEBUGF(broadcasts, "BPI %s evicted after %"PRId64"ms",
+	   alloca_tohex(slot->bpi.id, BROADCAST_LEN), now - slot->seen);
+    broadcast_duplicate_stats.evictions++;
+  } else {
+    struct bpi_entry *second = bpi_bucket(bpi_table, bpi_bucket_count, addr, 1);
+    if (slot >= second && slot < second + BPI_BUCKET_SLOTS && second != bpi_bucket(bpi_table, bpi_bucket_count, addr, 0))
+      broadcast_duplicate_stats.collisions++;
+  }
+
+  DEBUGF(broadcasts, "BPI %s is new", alloca_tohex(addr->id, BROADCAST_LEN));
+  slot->bpi = *addr;
+  slot->seen = now;
+  return 0; /* don't drop */
+}
+
+void overlay_broadcast_status_html(struct strbuf *b)
+{
+  strbuf_sprintf(b, "Broadcast duplicates: %"PRIu64", collisions: %"PRIu64", evictions: %"PRIu64"<br>",
+    broadcast_duplicate_stats.hits,
+    broadcast_duplicate_stats.collisions,
+    broadcast_duplicate_stats.evictions);
+}
+
+DEFINE_CMD(app_broadcast_cache_test, 0,
+  "Check that a reproducible set of <count> broadcast packet identifiers are remembered, before and after the cache doubles in size",
+  "test","broadcasts","[<count>]");
+static int app_broadcast_cache_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *count_arg;
+  if (cli_arg(parsed, "count", &count_arg, cli_uint, "256") == -1)
+    return -1;
+  unsigned count = atoi(count_arg);
+  struct broadcast *bpis = emalloc(sizeof(struct broadcast) * (count ? count : 1));
+  if (!bpis)
+    return -1;
+  srandom(1);
+  unsigned i, fresh = 0, seen = 0, kept = 0;
+  for (i = 0; i < count; i++)
+    overlay_broadcast_generate_address(&bpis[i]);
+  for (i = 0; i < count; i++)
+    if (!overlay_broadcast_drop_check(&bpis[i]))
+      fresh++;
+  for (i = 0; i < count; i++)
+    if (overlay_broadcast_drop_check(&bpis[i]))
+      seen++;
+  // growing the table must not forget anything
+  struct duplicate_stats before = broadcast_duplicate_stats;
+  config.mdp.broadcast.cache_size *= 2;
+  for (i = 0; i < count; i++)
+    if (overlay_broadcast_drop_check(&bpis[i]))
+      kept++;
+  free(bpis);
+  cli_field_name(context, "new", ":");
+  cli_put_long(context, fresh, "\n");
+  cli_field_name(context, "duplicates", ":");
+  cli_put_long(context, seen, "\n");
+  cli_field_name(context, "duplicates_after_resize", ":");
+  cli_put_long(context, kept, "\n");
+  cli_field_name(context, "collisions", ":");
+  cli_put_long(context, before.collisions, "\n");
+  cli_field_name(context, "evictions", ":");
+  cli_put_long(context, before.evictions, "\n");
+  return 0;
 }
 
 void overlay_broadcast_append(struct overlay_buffer *b, struct broadcast *broadcast)
@@ -50,6 +50,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 struct packet_rule;
 struct overlay_buffer;
+struct strbuf;
 
 // This structure supports both our own routing protocol which can store calculation details in *node 
 // or IP4 addresses reachable via any other kind of normal layer3 routing protocol, eg olsr
@@ -101,6 +102,15 @@ struct broadcast{
   unsigned char id[BROADCAST_LEN];
 };
 
+// counters for recognising repeated broadcast packets
+struct duplicate_stats{
+  uint64_t hits;
+  uint64_t collisions;
+  uint64_t evictions;
+};
+
+extern struct duplicate_stats broadcast_duplicate_stats;
+
 #define DECODE_FLAG_ENCODING_HEADER (1<<0)
 #define DECODE_FLAG_INVALID_ADDRESS (1<<1)
 #define DECODE_FLAG_DONT_EXPLAIN (1<<2)
@@ -132,6 +142,7 @@ struct network_destination *load_subscriber_address(struct subscriber *subscribe
 int process_explain(struct overlay_frame *frame);
 int overlay_broadcast_drop_check(struct broadcast *addr);
 int overlay_broadcast_generate_address(struct broadcast *addr);
+void overlay_broadcast_status_html(struct strbuf *b);
 
 void overlay_broadcast_append(struct overlay_buffer *b, struct broadcast *broadcast);
 void overlay_address_append(struct decode_context *context, struct overlay_buffer *b, struct subscriber *subscriber);
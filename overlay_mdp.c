@@ -407,6 +407,30 @@ static void overlay_mdp_decode_header(struct internal_mdp_header *header, struct
   header->source_port = port;
 }
 
+// frames between the same ports of the same pair of subscribers belong to one flow
+static uint32_t overlay_mdp_flow_hash(mdp_port_t source_port, mdp_port_t destination_port)
+{
+  return ((uint32_t)source_port << 16 | (destination_port & 0xFFFF)) * 2654435761u;
+}
+
+/* A frame we are forwarding carries its ports at the start of the payload, where we can only read
+ * them if the payload is not encrypted.  Encrypted frames are one flow per source and destination.
+ */
+void overlay_mdp_forward_flow_hash(struct overlay_frame *frame)
+{
+  if (!frame->destination || !frame->payload || (frame->modifiers & OF_CRYPTO_CIPHERED))
+    return;
+  struct overlay_buffer *plaintext = ob_slice(frame->payload, ob_position(frame->payload), ob_remaining(frame->payload));
+  if (!plaintext)
+    return;
+  ob_limitsize(plaintext, ob_remaining(frame->payload));
+  struct internal_mdp_header header;
+  overlay_mdp_decode_header(&header, plaintext);
+  if (!ob_overrun(plaintext))
+    frame->flow_hash = overlay_mdp_flow_hash(header.source_port, header.destination_port);
+  ob_free(plaintext);
+}
+
 static struct overlay_buffer *overlay_mdp_decrypt(struct internal_mdp_header *header, struct overlay_buffer *payload)
 {
   IN();
@@ -832,6 +856,7 @@ int _overlay_send_frame(struct __sourceloc whence, struct internal_mdp_header *h
   frame->resend = header->resend;
   frame->send_context = header->send_context;
   frame->send_hook = header->send_hook;
+  frame->flow_hash = overlay_mdp_flow_hash(header->source_port, header->destination_port);
   
   if (!(header->crypt_flags & MDP_FLAG_NO_CRYPT))
     frame->modifiers |= OF_CRYPTO_CIPHERED;
@@ -87,6 +87,8 @@ struct overlay_frame {
   struct broadcast broadcast_id;
   // where is this packet going next?
   struct subscriber *next_hop;
+  // frames with the same flow hash follow the same path, so streams arrive in order
+  uint32_t flow_hash;
   
   // should we force the next packet header to include our full public key?
   int source_full;
@@ -131,6 +133,7 @@ void frame_add_destination(struct overlay_frame *frame, struct subscriber *next_
 
 void mdp_init_response(const struct internal_mdp_header *in, struct internal_mdp_header *out);
 void overlay_mdp_encode_ports(struct overlay_buffer *plaintext, mdp_port_t dst_port, mdp_port_t src_port);
+void overlay_mdp_forward_flow_hash(struct overlay_frame *frame);
 int overlay_mdp_dnalookup_reply(struct subscriber *dest, mdp_port_t dest_port, 
     struct subscriber *resolved_sid, const char *uri, const char *did, const char *name);
 
@@ -131,6 +131,7 @@ int overlay_forward_payload(struct overlay_frame *f){
   struct overlay_frame *qf=op_dup(f);
   if (!qf) 
     RETURN(WHY("Could not clone frame for queuing"));
+  overlay_mdp_forward_flow_hash(qf);
   
   if (overlay_payload_enqueue(qf)) {
     op_free(qf);
@@ -320,7 +321,7 @@ int parseEnvelopeHeader(struct decode_context *context, struct overlay_interface
 int packetOkOverlay(struct overlay_interface *interface,unsigned char *packet, size_t len,
 		    struct socket_address *recvaddr)
 {
-  IN();
+  IN_TRACE("packet");
   /* 
      This function decodes overlay packets which have been assembled for delivery overy IP networks.
      IP based wireless networks have a high, but limited rate of packets that can be sent. In order 
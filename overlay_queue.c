@@ -532,7 +532,7 @@ overlay_stuff_packet(struct outgoing_packet *packet, overlay_txqueue *queue, tim
 // fill a packet from our outgoing queues and send it
 static int
 overlay_fill_send_packet(struct outgoing_packet *packet, time_ms_t now, strbuf debug) {
-  IN();
+  IN_TRACE("packet");
   int i;
   int ret=0;
     
@@ -49,6 +49,9 @@
 #include <inttypes.h> // for PRIu64 on Android
 #include "fdqueue.h"
 #include "conf.h"
+#include "strbuf.h"
+#include "strbuf_helpers.h"
+#include "trace.h"
 
 __thread struct profile_total *stats_head=NULL;
 __thread struct call_stats *current_call=NULL;
@@ -169,9 +172,51 @@ int fd_clearstats()
   return 0;
 }
 
+static void histogram_json(strbuf b, const unsigned *histogram)
+{
+  strbuf_putc(b, '[');
+  unsigned i;
+  for (i = 0; i < ALARM_HISTOGRAM_BUCKETS; i++){
+    if (i)
+      strbuf_putc(b, ',');
+    strbuf_sprintf(b, "%u", histogram[i]);
+  }
+  strbuf_putc(b, ']');
+}
+
+// describe every alarm that has been called, as a JSON object
+void fd_alarm_stats_json(strbuf b)
+{
+  strbuf_puts(b, "{\n\"buckets_us\":[0");
+  unsigned i;
+  for (i = 1; i < ALARM_HISTOGRAM_BUCKETS; i++)
+    strbuf_sprintf(b, ",%u", 1u << (i - 1));
+  strbuf_puts(b, "],\n\"alarms\":[");
+  struct profile_total *stats;
+  int first = 1;
+  for (stats = stats_head; stats; stats = stats->_next){
+    unsigned calls = 0;
+    for (i = 0; i < ALARM_HISTOGRAM_BUCKETS; i++)
+      calls += stats->exec_histogram[i];
+    if (calls == 0)
+      continue;
+    if (!first)
+      strbuf_putc(b, ',');
+    first = 0;
+    strbuf_puts(b, "\n{\"name\":");
+    strbuf_json_string(b, stats->name);
+    strbuf_sprintf(b, ",\"calls\":%u,\"deadline_misses\":%u,\"execution\":", calls, stats->deadline_misses);
+    histogram_json(b, stats->exec_histogram);
+    strbuf_puts(b, ",\"lateness\":");
+    histogram_json(b, stats->late_histogram);
+    strbuf_putc(b, '}');
+  }
+  strbuf_puts(b, "\n]\n}\n");
+}
+
 int fd_showstats()
 {
-  struct profile_total total={NULL, 0, "Total", 0,0,0,0};
+  struct profile_total total={.name="Total"};
   
   stats_head = sort(stats_head);
   
@@ -246,6 +291,8 @@ int fd_func_enter(struct __sourceloc __whence, struct call_stats *this_call)
   this_call->child_time=0;
   this_call->prev = current_call;
   current_call = this_call;
+  if (this_call->totals && this_call->totals->trace_category)
+    TRACE_BEGIN(this_call->totals->trace_category, this_call->totals->name);
   return 0;
 }
 
@@ -263,6 +310,8 @@ int fd_func_exit(struct __sourceloc __whence, struct call_stats *this_call)
   time_ms_t now = gettime_ms();
   time_ms_t elapsed = now - this_call->enter_time;
   current_call = this_call->prev;
+  if (this_call->totals && this_call->totals->trace_category)
+    TRACE_END(this_call->totals->trace_category, this_call->totals->name);
   
   if (this_call->totals && !this_call->totals->_initialised){
     this_call->totals->_initialised=1;
@@ -366,6 +366,7 @@ struct rhizome_cleanup_report {
     unsigned deleted_orphan_files;
     unsigned deleted_orphan_fileblobs;
     unsigned deleted_orphan_manifests;
+    unsigned deleted_orphan_conversations;
 };
 
 int rhizome_cleanup(struct rhizome_cleanup_report *report);
@@ -465,6 +466,13 @@ int rhizome_manifest_validate(rhizome_manifest *m);
 const char *rhizome_manifest_validate_reason(rhizome_manifest *m);
 int rhizome_manifest_parse(rhizome_manifest *m);
 int rhizome_manifest_verify(rhizome_manifest *m);
+void rhizome_manifest_cache_signature_validity(const unsigned char *hash, const unsigned char *sig, size_t sig_len, int valid);
+
+/* Queue a validated manifest to have its signature checked in a batch with others.  The callback
+ * takes over the manifest, and is called from the main loop once the batch has been checked.
+ */
+typedef void (*rhizome_verify_callback)(rhizome_manifest *m, void *context);
+void rhizome_verify_queue(rhizome_manifest *m, rhizome_verify_callback callback, void *context);
 
 void _rhizome_manifest_free(struct __sourceloc, rhizome_manifest *m);
 #define rhizome_manifest_free(m) _rhizome_manifest_free(__WHENCE__,m)
@@ -891,6 +899,8 @@ enum rhizome_payload_status rhizome_journal_pipe(struct rhizome_write *write, co
 
 int rhizome_crypt_xor_block(unsigned char *buffer, size_t buffer_size, uint64_t stream_offset, 
 			    const unsigned char *key, const unsigned char *nonce);
+int rhizome_crypt_xor_block_by_page(unsigned char *buffer, size_t buffer_size, uint64_t stream_offset,
+			    const unsigned char *key, const unsigned char *nonce);
 enum rhizome_payload_status rhizome_open_read(struct rhizome_read *read, const rhizome_filehash_t *hashp);
 ssize_t rhizome_read(struct rhizome_read *read, unsigned char *buffer, size_t buffer_length);
 ssize_t rhizome_read_buffered(struct rhizome_read *read, struct rhizome_read_buffer *buffer, unsigned char *data, size_t len);
@@ -24,6 +24,7 @@
 #include "commandline.h"
 #include "rhizome.h"
 #include "instance.h"
+#include "mem.h"
 
 DEFINE_FEATURE(cli_rhizome);
 
@@ -496,6 +497,8 @@ static int app_rhizome_clean(const struct cli_parsed *parsed, struct cli_context
   cli_put_long(context, report.deleted_orphan_fileblobs, "\n");
   cli_field_name(context, "deleted_orphan_manifests", ":");
   cli_put_long(context, report.deleted_orphan_manifests, "\n");
+  cli_field_name(context, "deleted_orphan_conversations", ":");
+  cli_put_long(context, report.deleted_orphan_conversations, "\n");
   return 0;
 }
 
@@ -784,3 +787,145 @@ static int app_rhizome_list(const struct cli_parsed *parsed, struct cli_context
   return 0;
 }
 
+
+DEFINE_CMD(app_rhizome_crypt_test, 0,
+  "Time payload encryption, page at a time and with the multi-page kernel, and check they agree",
+  "test","rhizomecrypt","[<megabytes>]");
+static int app_rhizome_crypt_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *megabytes_arg;
+  if (cli_arg(parsed, "megabytes", &megabytes_arg, cli_uint, "64") == -1)
+    return -1;
+  size_t total = (size_t)atoi(megabytes_arg) * 1024 * 1024;
+  unsigned char key[crypto_stream_xsalsa20_KEYBYTES];
+  unsigned char nonce[crypto_stream_xsalsa20_NONCEBYTES];
+  randombytes_buf(key, sizeof key);
+  randombytes_buf(nonce, sizeof nonce);
+  // start near the end of the low nonce bytes, so runs of pages cross the HSalsa20 input
+  memset(nonce + 8, 0xff, 16);
+
+  const size_t max_buffer = 64 * RHIZOME_CRYPT_PAGE_SIZE;
+  unsigned char *a = emalloc(max_buffer);
+  unsigned char *b = emalloc(max_buffer);
+  if (!a || !b) {
+    free(a);
+    free(b);
+    return -1;
+  }
+
+  // check both implementations agree, for assorted offsets and lengths
+  unsigned i;
+  for (i = 0; i < 1000; i++) {
+    size_t len = randombytes_uniform(max_buffer) + 1;
+    uint64_t offset = randombytes_uniform(64 * RHIZOME_CRYPT_PAGE_SIZE);
+    randombytes_buf(a, len);
+    bcopy(a, b, len);
+    rhizome_crypt_xor_block_by_page(a, len, offset, key, nonce);
+    rhizome_crypt_xor_block(b, len, offset, key, nonce);
+    if (memcmp(a, b, len) != 0) {
+      free(a);
+      free(b);
+      return WHYF("Mismatch at offset %"PRIu64" length %zu", offset, len);
+    }
+  }
+
+  // time each implementation over aligned and unaligned buffers
+  size_t sizes[] = {RHIZOME_CRYPT_PAGE_SIZE, 16 * RHIZOME_CRYPT_PAGE_SIZE, 1024, 3000};
+  bzero(a, max_buffer);
+  unsigned s;
+  for (s = 0; s < NELS(sizes); s++) {
+    size_t size = sizes[s];
+    unsigned impl;
+    for (impl = 0; impl < 2; impl++) {
+      time_ms_t start = gettime_ms();
+      uint64_t offset;
+      for (offset = 0; offset < total; offset += size) {
+	if (impl)
+	  rhizome_crypt_xor_block(a, size, offset, key, nonce);
+	else
+	  rhizome_crypt_xor_block_by_page(a, size, offset, key, nonce);
+      }
+      time_ms_t elapsed = gettime_ms() - start;
+      cli_printf(context, "%s, %zu byte buffers: %zuMiB in %"PRId64"ms (%"PRId64"MiB/s)\n",
+	impl ? "multi-page" : "page at a time", size, total >> 20, elapsed,
+	elapsed ? (int64_t)(total >> 20) * 1000 / elapsed : 0);
+    }
+  }
+  free(a);
+  free(b);
+  return 0;
+}
+
+struct rhizome_verify_test {
+  unsigned done;
+  unsigned imported;
+  unsigned rejected;
+};
+
+static void rhizome_verify_test_import(rhizome_manifest *m, void *context)
+{
+  struct rhizome_verify_test *test = context;
+  switch (rhizome_add_manifest_to_store(m, NULL)) {
+    case RHIZOME_BUNDLE_STATUS_NEW:
+      test->imported++;
+      break;
+    case RHIZOME_BUNDLE_STATUS_FAKE:
+      test->rejected++;
+      break;
+    default:
+      break;
+  }
+  test->done++;
+  rhizome_manifest_free(m);
+}
+
+/* Queue a batch of signed manifests, as if just received from a peer, with the signature of every
+ * tenth one spoiled, and import each one as its batch is checked.
+ */
+DEFINE_CMD(app_rhizome_verify_test, 0,
+  "Check a batch of received manifest signatures, some of them bad, and import the good ones",
+  "test","rhizomeverify","[<manifests>]");
+static int app_rhizome_verify_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *count_arg;
+  if (cli_arg(parsed, "manifests", &count_arg, cli_uint, "100") == -1)
+    return -1;
+  unsigned count = atoi(count_arg);
+  if (rhizome_opendb() == -1)
+    return -1;
+  struct rhizome_verify_test test;
+  bzero(&test, sizeof test);
+  time_ms_t now = gettime_ms();
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    rhizome_manifest *m = rhizome_new_manifest();
+    if (!m)
+      return -1;
+    unsigned char pk[crypto_sign_PUBLICKEYBYTES];
+    unsigned char sk[crypto_sign_SECRETKEYBYTES];
+    crypto_sign_keypair(pk, sk);
+    strbuf b = strbuf_local((char *)m->manifestdata, sizeof m->manifestdata);
+    strbuf_sprintf(b, "id=%s\nversion=%"PRIu64"\nfilesize=0\nservice=file\nname=verify%u\ndate=%"PRIu64"\n",
+	alloca_tohex(pk, sizeof pk), (uint64_t)now, i, (uint64_t)now);
+    size_t body_bytes = strbuf_len(b) + 1;
+    unsigned char hash[crypto_hash_sha512_BYTES];
+    crypto_hash_sha512(hash, m->manifestdata, body_bytes);
+    uint8_t *p = &m->manifestdata[body_bytes];
+    *p++ = 0x17; // CryptoSign
+    crypto_sign_detached(p, NULL, hash, sizeof hash, sk);
+    if (i % 10 == 0)
+      p[0] ^= 0x01;
+    bcopy(pk, p + crypto_sign_BYTES, sizeof pk);
+    m->manifest_all_bytes = body_bytes + 1 + crypto_sign_BYTES + sizeof pk;
+    if (rhizome_manifest_parse(m) == -1 || !rhizome_manifest_validate(m)) {
+      rhizome_manifest_free(m);
+      return WHY("Test manifest is malformed");
+    }
+    rhizome_verify_queue(m, rhizome_verify_test_import, &test);
+  }
+  while (test.done < count && fd_poll())
+    ;
+  cli_printf(context, "Imported: %u\n", test.imported);
+  cli_printf(context, "Rejected: %u\n", test.rejected);
+  return 0;
+}
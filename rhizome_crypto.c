@@ -410,9 +410,8 @@ typedef struct manifest_signature_block_cache {
 #define SIG_CACHE_SIZE 1024
 manifest_signature_block_cache sig_cache[SIG_CACHE_SIZE];
 
-static int rhizome_manifest_lookup_signature_validity(const unsigned char *hash, const unsigned char *sig, size_t sig_len)
+static manifest_signature_block_cache *rhizome_manifest_signature_cache_slot(const unsigned char *hash, const unsigned char *sig, size_t sig_len)
 {
-  IN();
   unsigned slot=0;
   unsigned i;
 
@@ -424,23 +423,41 @@ static int rhizome_manifest_lookup_signature_validity(const unsigned char *hash,
     slot=(slot<<1)+(slot&0x80000000?1:0);
     slot+=sig[i];
   }
-  slot%=SIG_CACHE_SIZE;
-
-  if (sig_cache[slot].signature_length!=sig_len || 
-      memcmp(hash, sig_cache[slot].manifest_hash, crypto_hash_sha512_BYTES) ||
-      memcmp(sig, sig_cache[slot].signature_bytes, sig_len)){
-    bcopy(hash, sig_cache[slot].manifest_hash, crypto_hash_sha512_BYTES);
-    bcopy(sig, sig_cache[slot].signature_bytes, sig_len);
-    sig_cache[slot].signature_length=sig_len;
-
-    sig_cache[slot].signature_valid=
-      crypto_sign_verify_detached(sig, hash, crypto_hash_sha512_BYTES, &sig[crypto_sign_BYTES])
-      ? -1 : 0;
+  return &sig_cache[slot % SIG_CACHE_SIZE];
+}
+
+static void rhizome_manifest_signature_cache_store(manifest_signature_block_cache *entry,
+  const unsigned char *hash, const unsigned char *sig, size_t sig_len, int valid)
+{
+  bcopy(hash, entry->manifest_hash, crypto_hash_sha512_BYTES);
+  bcopy(sig, entry->signature_bytes, sig_len);
+  entry->signature_length=sig_len;
+  entry->signature_valid=valid ? 0 : -1;
+}
+
+static int rhizome_manifest_lookup_signature_validity(const unsigned char *hash, const unsigned char *sig, size_t sig_len)
+{
+  IN();
+  manifest_signature_block_cache *entry = rhizome_manifest_signature_cache_slot(hash, sig, sig_len);
+  if (entry->signature_length!=sig_len ||
+      memcmp(hash, entry->manifest_hash, crypto_hash_sha512_BYTES) ||
+      memcmp(sig, entry->signature_bytes, sig_len)){
+    rhizome_manifest_signature_cache_store(entry, hash, sig, sig_len,
+      crypto_sign_verify_detached(sig, hash, crypto_hash_sha512_BYTES, &sig[crypto_sign_BYTES]) == 0);
   }
-  RETURN(sig_cache[slot].signature_valid);
+  RETURN(entry->signature_valid);
   OUT();
 }
 
+/* Remember the outcome of a signature check made elsewhere (eg, by the verification queue), so
+ * that rhizome_manifest_verify() finds it in the cache instead of checking the signature again.
+ */
+void rhizome_manifest_cache_signature_validity(const unsigned char *hash, const unsigned char *sig, size_t sig_len, int valid)
+{
+  assert(sig_len <= sizeof sig_cache[0].signature_bytes);
+  rhizome_manifest_signature_cache_store(rhizome_manifest_signature_cache_slot(hash, sig, sig_len), hash, sig, sig_len, valid);
+}
+
 int rhizome_manifest_extract_signature(rhizome_manifest *m, unsigned *ofs)
 {
   IN();
@@ -497,11 +514,74 @@ static void add_nonce(unsigned char *nonce, uint64_t value)
   }
 }
 
+#define SALSA20_BLOCK_BYTES 64
+
 /* Encrypt a block of a stream in-place, allowing for offsets that don't align perfectly to block
  * boundaries for efficiency the caller should use a buffer size of (n*RHIZOME_CRYPT_PAGE_SIZE).
+ *
+ * Every page is XSalsa20 encrypted with its own nonce, the payload nonce plus the page's offset.
+ * XSalsa20 is HSalsa20, deriving a subkey from the key and the first 16 bytes of the nonce,
+ * followed by Salsa20 with that subkey and the last 8 bytes of the nonce.  Consecutive pages
+ * only differ in the last bytes of their nonces, so the subkey is derived once for a run of pages
+ * and each page's keystream is XORed straight into the buffer.  A start part way into a page only
+ * needs the keystream from the Salsa20 block it falls in, so the bounce copy is a single block.
  */
 int rhizome_crypt_xor_block(unsigned char *buffer, size_t buffer_size, uint64_t stream_offset, 
 			    const unsigned char *key, const unsigned char *nonce)
+{
+  uint64_t nonce_offset = stream_offset & ~(RHIZOME_CRYPT_PAGE_SIZE -1);
+  size_t padding = stream_offset & (RHIZOME_CRYPT_PAGE_SIZE -1);
+  size_t offset=0;
+
+  unsigned char page_nonce[crypto_stream_xsalsa20_NONCEBYTES];
+  bcopy(nonce, page_nonce, sizeof page_nonce);
+  add_nonce(page_nonce, nonce_offset);
+
+  unsigned char subkey[crypto_stream_salsa20_KEYBYTES];
+  unsigned char subkey_nonce[crypto_core_hsalsa20_INPUTBYTES];
+  const unsigned char *salsa_nonce = page_nonce + crypto_core_hsalsa20_INPUTBYTES;
+
+  while(offset < buffer_size){
+    if (offset == 0 || memcmp(subkey_nonce, page_nonce, sizeof subkey_nonce) != 0){
+      bcopy(page_nonce, subkey_nonce, sizeof subkey_nonce);
+      crypto_core_hsalsa20(subkey, page_nonce, key, NULL);
+    }
+
+    size_t size = RHIZOME_CRYPT_PAGE_SIZE - padding;
+    if (size > buffer_size - offset)
+      size = buffer_size - offset;
+    uint64_t block = padding / SALSA20_BLOCK_BYTES;
+    size_t skip = padding % SALSA20_BLOCK_BYTES;
+    if (skip){
+      size_t part = SALSA20_BLOCK_BYTES - skip;
+      if (part > size)
+	part = size;
+      unsigned char temp[SALSA20_BLOCK_BYTES];
+      bcopy(buffer + offset, temp + skip, part);
+      crypto_stream_salsa20_xor_ic(temp, temp, skip + part, salsa_nonce, block, subkey);
+      bcopy(temp + skip, buffer + offset, part);
+      offset += part;
+      size -= part;
+      block++;
+    }
+    if (size){
+      crypto_stream_salsa20_xor_ic(buffer + offset, buffer + offset, size, salsa_nonce, block, subkey);
+      offset += size;
+    }
+
+    padding = 0;
+    add_nonce(page_nonce, RHIZOME_CRYPT_PAGE_SIZE);
+  }
+
+  bzero(subkey, sizeof subkey);
+  return 0;
+}
+
+/* The original page at a time implementation, which "test rhizomecrypt" measures and checks
+ * rhizome_crypt_xor_block() against.
+ */
+int rhizome_crypt_xor_block_by_page(unsigned char *buffer, size_t buffer_size, uint64_t stream_offset,
+			    const unsigned char *key, const unsigned char *nonce)
 {
   uint64_t nonce_offset = stream_offset & ~(RHIZOME_CRYPT_PAGE_SIZE -1);
   size_t offset=0;
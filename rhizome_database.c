@@ -377,6 +377,26 @@ int rhizome_opendb()
     sqlite_exec_void_loglevel(LOG_LEVEL_WARN, "PRAGMA user_version=8;", END);
   }
   
+  if (version<9){
+    // An index of MeshMS conversations by the SID of each party, so that listing an identity's
+    // conversations need not scan every manifest.
+    sqlite_exec_void_loglevel(LOG_LEVEL_WARN,
+	"CREATE TABLE IF NOT EXISTS CONVERSATIONS("
+	    "sid text not null collate nocase, "
+	    "id text not null, "
+	    "primary key(sid, id)"
+	");", END);
+    sqlite_exec_void_loglevel(LOG_LEVEL_WARN, "CREATE INDEX IF NOT EXISTS IDX_CONVERSATIONS_ID ON CONVERSATIONS(id);", END);
+    sqlite_exec_void_loglevel(LOG_LEVEL_WARN,
+	"INSERT OR IGNORE INTO CONVERSATIONS(sid, id)"
+	" SELECT sender, id FROM MANIFESTS WHERE service = ? AND sender IS NOT NULL AND recipient IS NOT NULL"
+	" UNION SELECT recipient, id FROM MANIFESTS WHERE service = ? AND sender IS NOT NULL AND recipient IS NOT NULL;",
+	STATIC_TEXT, RHIZOME_SERVICE_MESHMS2,
+	STATIC_TEXT, RHIZOME_SERVICE_MESHMS2,
+	END);
+    sqlite_exec_void_loglevel(LOG_LEVEL_WARN, "PRAGMA user_version=9;", END);
+  }
+
   // TODO recreate tables with collate nocase on all hex columns
 
   /* Future schema updates should be performed here. 
@@ -934,7 +954,7 @@ sqlite3_stmt *_sqlite_prepare_bind(struct __sourceloc __whence, int log_level, s
 
 int _sqlite_step(struct __sourceloc __whence, int log_level, sqlite_retry_state *retry, sqlite3_stmt *statement)
 {
-  IN();
+  IN_TRACE("sqlite");
   int ret = -1;
   sqlite_trace_whence = &__whence;
   while (statement) {
@@ -1329,15 +1349,22 @@ int rhizome_cleanup(struct rhizome_cleanup_report *report)
       "DELETE FROM MANIFESTS WHERE filesize > 0 AND NOT EXISTS( SELECT 1 FROM FILES WHERE MANIFESTS.filehash = FILES.id);", END);
   if (report && ret > 0)
     report->deleted_orphan_manifests += ret;
+
+  // forget conversations whose manifests are gone
+  ret = sqlite_exec_void_retry(&retry,
+      "DELETE FROM CONVERSATIONS WHERE NOT EXISTS( SELECT 1 FROM MANIFESTS WHERE MANIFESTS.id = CONVERSATIONS.id);", END);
+  if (report && ret > 0)
+    report->deleted_orphan_conversations += ret;
   
   rhizome_vacuum_db(&retry);
   
   if (report)
-    DEBUGF(rhizome, "report deleted_stale_incoming_files=%u deleted_orphan_files=%u deleted_orphan_fileblobs=%u deleted_orphan_manifests=%u",
+    DEBUGF(rhizome, "report deleted_stale_incoming_files=%u deleted_orphan_files=%u deleted_orphan_fileblobs=%u deleted_orphan_manifests=%u deleted_orphan_conversations=%u",
 	   report->deleted_stale_incoming_files,
 	   report->deleted_orphan_files,
 	   report->deleted_orphan_fileblobs,
-	   report->deleted_orphan_manifests
+	   report->deleted_orphan_manifests,
+	   report->deleted_orphan_conversations
 	  );
   RETURN(0);
   OUT();
@@ -1496,6 +1523,16 @@ enum rhizome_bundle_status rhizome_add_manifest_to_store(rhizome_manifest *m, rh
   rhizome_manifest_set_rowid(m, sqlite3_last_insert_rowid(rhizome_db));
   rhizome_manifest_set_inserttime(m, now);
 
+  if (   m->has_sender && m->has_recipient
+      && strcmp(m->service, RHIZOME_SERVICE_MESHMS2) == 0
+      && sqlite_exec_void_retry(&retry,
+	  "INSERT OR IGNORE INTO CONVERSATIONS(sid, id) VALUES(?, ?), (?, ?);",
+	  SID_T, &m->sender, RHIZOME_BID_T, &m->keypair.public_key,
+	  SID_T, &m->recipient, RHIZOME_BID_T, &m->keypair.public_key,
+	  END) == -1
+  )
+    goto rollback;
+
   if (sqlite_exec_void_retry(&retry, "COMMIT;", END) != -1){
     // This message used in tests; do not modify or remove.
     INFOF("RHIZOME ADD MANIFEST service=%s bid=%s version=%"PRIu64,
@@ -2008,7 +2045,10 @@ static int rhizome_delete_manifest_retry(sqlite_retry_state *retry, const rhizom
     return -1;
   if (_sqlite_exec(__WHENCE__, LOG_LEVEL_ERROR, retry, statement) == -1)
     return -1;
-  return sqlite3_changes(rhizome_db) ? 0 : 1;
+  int changes = sqlite3_changes(rhizome_db);
+  if (changes && sqlite_exec_void_retry(retry, "DELETE FROM conversations WHERE id = ?", RHIZOME_BID_T, bidp, END) == -1)
+    return -1;
+  return changes ? 0 : 1;
 }
 
 /* Remove a manifest and its bundle from the database, given its manifest ID.
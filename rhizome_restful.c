@@ -276,6 +276,7 @@ static int restful_rhizome_newsince(httpd_request *r, const char *remainder)
   r->u.rhlist.cursor.oldest_first = 1;
   r->u.rhlist.end_time = gettime_ms() + config.api.restful.newsince_timeout * 1000;
   r->trigger_rhizome_bundle_added = on_rhizome_bundle_added;
+  httpd_watch_all_bundles(r);
   return restful_open_cursor(r);
 }
 
@@ -455,6 +455,8 @@ static int write_data(struct rhizome_write *write_state, uint64_t file_offset, u
   if (data_size<=0)
     return 0;
   
+  IN_TRACE("rhizome");
+  
   if (file_offset != write_state->written_offset)
     WARNF("Writing file data out of order! [%"PRId64",%"PRId64"]", file_offset, write_state->written_offset);
     
@@ -462,26 +464,26 @@ static int write_data(struct rhizome_write *write_state, uint64_t file_offset, u
     size_t ofs = 0;
     // keep trying until all of the data is written.
     if (lseek64(write_state->blob_fd, (off64_t) file_offset, SEEK_SET) == -1)
-      return WHYF_perror("lseek64(%d,%"PRIu64",SEEK_SET)", write_state->blob_fd, file_offset);
+      RETURN(WHYF_perror("lseek64(%d,%"PRIu64",SEEK_SET)", write_state->blob_fd, file_offset));
     while (ofs < data_size){
       ssize_t r = write(write_state->blob_fd, buffer + ofs, (size_t)(data_size - ofs));
       if (r == -1)
-	return WHY_perror("write");
+	RETURN(WHY_perror("write"));
       DEBUGF(rhizome_store, "Wrote %zd bytes to fd %d", (size_t)r, write_state->blob_fd);
       ofs += (size_t)r;
     }
   }else{
     if (!write_state->sql_blob)
-      return WHY("Must call write_get_lock() before write_data()");
+      RETURN(WHY("Must call write_get_lock() before write_data()"));
     sqlite_retry_state retry = SQLITE_RETRY_STATE_DEFAULT;
     if (sqlite_blob_write_retry(&retry, write_state->sql_blob, buffer, data_size, file_offset) == -1)
-      return -1;
+      RETURN(-1);
   }
   
   write_state->written_offset = file_offset + data_size;
   
   DEBUGF(rhizome_store, "Wrote %"PRIu64" of %"PRIu64, file_offset + data_size, write_state->file_length);
-  return 0;
+  RETURN(0);
 }
 
 // close database locks
@@ -1190,7 +1192,7 @@ static ssize_t rhizome_read_retry(sqlite_retry_state *retry, struct rhizome_read
 // returns the number of bytes read
 ssize_t rhizome_read(struct rhizome_read *read_state, unsigned char *buffer, size_t buffer_length)
 {
-  IN();
+  IN_TRACE("rhizome");
   // hash check failed, just return an error
   if (read_state->verified == -1)
     RETURN(-1);
@@ -243,6 +243,23 @@ cleanup:
   return 0;
 }
 
+/* Import a received manifest whose payload is already stored, once its signature has been checked
+ * in a batch.
+ */
+static void sync_import_manifest(rhizome_manifest *m, void *UNUSED(context))
+{
+  enum rhizome_bundle_status add_status = rhizome_add_manifest_to_store(m, NULL);
+  if (add_status == RHIZOME_BUNDLE_STATUS_BUSY){
+    // try again with the next batch
+    rhizome_verify_queue(m, sync_import_manifest, NULL);
+    return;
+  }
+  DEBUGF(rhizome_sync_keys, "Import %s:%"PRIu64" = %s",
+    alloca_tohex_rhizome_bid_t(m->keypair.public_key), m->version,
+    rhizome_bundle_status_message_nonnull(add_status));
+  rhizome_manifest_free(m);
+}
+
 static int sync_manifest_rank(rhizome_manifest *m, struct subscriber *peer, uint8_t sending, uint64_t written_offset)
 {
   uint8_t bias = REACHABLE_BIAS;
@@ -747,19 +764,10 @@ static int process_transfer_message(struct subscriber *peer, struct rhizome_sync
 	}
 
 	switch(status){
-	  case RHIZOME_PAYLOAD_STATUS_STORED:{
-	      enum rhizome_bundle_status add_status = rhizome_add_manifest_to_store(m, NULL);
-	      if (add_status == RHIZOME_BUNDLE_STATUS_BUSY){
-		// don't consume the payload
-		rhizome_manifest_free(m);
-		rhizome_fail_write(write);
-		free(write);
-		ob_rewind(payload);
-		return 1;
-	      }
-	      DEBUGF(rhizome_sync_keys, "Already have payload, imported manifest for %s, (%s)",
-		alloca_sync_key(&key), rhizome_bundle_status_message_nonnull(add_status));
-	    }
+	  case RHIZOME_PAYLOAD_STATUS_STORED:
+	    DEBUGF(rhizome_sync_keys, "Already have payload, importing manifest for %s", alloca_sync_key(&key));
+	    rhizome_verify_queue(m, sync_import_manifest, NULL);
+	    m = NULL;
 	    break;
 
 	  case RHIZOME_PAYLOAD_STATUS_BUSY:
@@ -775,11 +783,13 @@ static int process_transfer_message(struct subscriber *peer, struct rhizome_sync
 	}
 	  
 	if (status!=RHIZOME_PAYLOAD_STATUS_NEW){
-	  DEBUGF(rhizome_sync_keys, "Ignoring manifest %s:%"PRIu64" (hash %s), (%s)",
-	    alloca_tohex_rhizome_bid_t(m->keypair.public_key),
-	    m->version,
-	    alloca_sync_key(&key), rhizome_payload_status_message_nonnull(status));
-	  rhizome_manifest_free(m);
+	  if (m){
+	    DEBUGF(rhizome_sync_keys, "Ignoring manifest %s:%"PRIu64" (hash %s), (%s)",
+	      alloca_tohex_rhizome_bid_t(m->keypair.public_key),
+	      m->version,
+	      alloca_sync_key(&key), rhizome_payload_status_message_nonnull(status));
+	    rhizome_manifest_free(m);
+	  }
 	  rhizome_fail_write(write);
 	  free(write);
 	  break;
@@ -807,15 +817,15 @@ static int process_transfer_message(struct subscriber *peer, struct rhizome_sync
 	    enum rhizome_payload_status status = rhizome_finish_write(write);
 
 	    if (status == RHIZOME_PAYLOAD_STATUS_NEW || status == RHIZOME_PAYLOAD_STATUS_STORED){
-	      enum rhizome_bundle_status add_state = rhizome_add_manifest_to_store(m, NULL);
-	      DEBUGF(rhizome_sync_keys, "Import %s = %s", 
-		alloca_sync_key(&key), rhizome_bundle_status_message_nonnull(add_state));
+	      rhizome_verify_queue(m, sync_import_manifest, NULL);
+	      m = NULL;
 	    } else {
 	      WHYF("Failed to complete payload %s %s", alloca_sync_key(&key), rhizome_payload_status_message_nonnull(status));
 	      rhizome_fail_write(write);
 	    }
 	    free(write);
-	    rhizome_manifest_free(m);
+	    if (m)
+	      rhizome_manifest_free(m);
 	    break;
 	  }
 	}
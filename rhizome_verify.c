@@ -0,0 +1,186 @@
+/*
+Serval DNA Rhizome manifest signature verification queue
+Copyright (C) 2016 Flinders University
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <unistd.h>
+#include "serval.h"
+#include "conf.h"
+#include "crypto.h"
+#include "rhizome.h"
+#include "fdqueue.h"
+#include "debug.h"
+#include "mem.h"
+
+/* Manifests received from peers wait here until a batch has accumulated, or a short time has
+ * passed, and then have their self-signatures checked together.  libsodium has no batch Ed25519
+ * verification, so a batch is spread over a few threads instead.  The outcomes are left in the
+ * manifest signature cache, where rhizome_manifest_verify() finds them when the callbacks import
+ * the manifests on the main thread.
+ */
+
+// The self-signature block: type byte, Ed25519 signature, then the signing (bundle) public key.
+#define SELF_SIGNATURE_TYPE 0x17
+#define SELF_SIGNATURE_BYTES (crypto_sign_BYTES + crypto_sign_PUBLICKEYBYTES)
+
+struct verify_item {
+  rhizome_manifest *manifest;
+  rhizome_verify_callback callback;
+  void *context;
+  unsigned char hash[crypto_hash_sha512_BYTES];
+  int valid; // -1 if no signature was checked
+};
+
+struct verify_batch {
+  struct verify_item *items;
+  unsigned count;
+  unsigned next;
+};
+
+static struct verify_item *queue = NULL;
+static unsigned queue_count = 0;
+static unsigned queue_size = 0;
+
+DEFINE_ALARM(rhizome_verify_batch);
+
+/* Only reads the manifest, so may be called from several threads at once. */
+static void verify_item(struct verify_item *item)
+{
+  const rhizome_manifest *m = item->manifest;
+  item->valid = -1;
+  if (m->selfSigned)
+    return;
+  const unsigned char *sig = m->manifestdata + m->manifest_body_bytes;
+  if (m->manifest_body_bytes + 1 + SELF_SIGNATURE_BYTES > m->manifest_all_bytes || sig[0] != SELF_SIGNATURE_TYPE)
+    return;
+  crypto_hash_sha512(item->hash, m->manifestdata, m->manifest_body_bytes);
+  item->valid = crypto_sign_verify_detached(sig + 1, item->hash, crypto_hash_sha512_BYTES, sig + 1 + crypto_sign_BYTES) == 0;
+}
+
+static void verify_batch_items(struct verify_batch *batch)
+{
+  unsigned i;
+#ifdef HAVE_PTHREAD
+  while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count)
+#else
+  for (i = 0; i < batch->count; i++)
+#endif
+    verify_item(&batch->items[i]);
+}
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+#define VERIFY_THREADS 8
+#define VERIFY_ITEMS_PER_THREAD 16
+
+static void *verify_thread(void *context)
+{
+  verify_batch_items((struct verify_batch *)context);
+  return NULL;
+}
+
+static void verify_batch_parallel(struct verify_batch *batch)
+{
+  pthread_t threads[VERIFY_THREADS];
+  unsigned thread_count = 0;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned wanted = batch->count / VERIFY_ITEMS_PER_THREAD;
+  if (cpus > 0 && wanted > (unsigned)cpus - 1)
+    wanted = cpus - 1;
+  if (wanted > VERIFY_THREADS)
+    wanted = VERIFY_THREADS;
+  while (thread_count < wanted
+    && pthread_create(&threads[thread_count], NULL, verify_thread, batch) == 0)
+    thread_count++;
+  verify_batch_items(batch);
+  while (thread_count)
+    pthread_join(threads[--thread_count], NULL);
+}
+#else
+#define verify_batch_parallel(B) verify_batch_items(B)
+#endif
+
+static void verify_flush()
+{
+  // Take the whole queue, since the callbacks may queue manifests again.
+  struct verify_batch batch = {
+    .items = queue,
+    .count = queue_count,
+    .next = 0
+  };
+  queue = NULL;
+  queue_count = queue_size = 0;
+  if (!batch.count)
+    return;
+
+  verify_batch_parallel(&batch);
+
+  unsigned i, checked = 0, failed = 0;
+  for (i = 0; i < batch.count; i++) {
+    struct verify_item *item = &batch.items[i];
+    if (item->valid == -1)
+      continue;
+    const rhizome_manifest *m = item->manifest;
+    rhizome_manifest_cache_signature_validity(item->hash,
+      m->manifestdata + m->manifest_body_bytes + 1, SELF_SIGNATURE_BYTES, item->valid);
+    checked++;
+    if (!item->valid)
+      failed++;
+  }
+  DEBUGF(rhizome, "Checked %u of %u queued manifest signatures, %u failed", checked, batch.count, failed);
+
+  for (i = 0; i < batch.count; i++)
+    batch.items[i].callback(batch.items[i].manifest, batch.items[i].context);
+  free(batch.items);
+}
+
+void rhizome_verify_batch(struct sched_ent *UNUSED(alarm))
+{
+  verify_flush();
+}
+
+void rhizome_verify_queue(rhizome_manifest *m, rhizome_verify_callback callback, void *context)
+{
+  assert(m->finalised);
+  if (queue_count == queue_size) {
+    unsigned size = queue_size ? queue_size * 2 : 16;
+    struct verify_item *items = erealloc(queue, sizeof(struct verify_item) * size);
+    if (!items) {
+      // verify it on its own
+      callback(m, context);
+      return;
+    }
+    queue = items;
+    queue_size = size;
+  }
+  queue[queue_count++] = (struct verify_item){
+    .manifest = m,
+    .callback = callback,
+    .context = context
+  };
+
+  struct sched_ent *alarm = &ALARM_STRUCT(rhizome_verify_batch);
+  time_ms_t now = gettime_ms();
+  if (queue_count >= config.rhizome.verify.batch)
+    RESCHEDULE(alarm, now, now, now);
+  else if (queue_count == 1) {
+    time_ms_t due = now + config.rhizome.verify.delay_ms;
+    RESCHEDULE(alarm, due, due, due);
+  }
+}
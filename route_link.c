@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "serval.h"
 #include "conf.h"
 #include "overlay_address.h"
+#include "dataformats.h"
 #include "overlay_buffer.h"
 #include "overlay_interface.h"
 #include "overlay_packet.h"
@@ -29,6 +30,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "server.h"
 #include "mdp_client.h"
 #include "route_link.h"
+#include "cli.h"
+#include "commandline.h"
 
 /*
 Link state routing;
@@ -42,8 +45,6 @@ Link state routing;
 
 */
 
-#define MAX_LINK_STATES 512
-
 #define FLAG_HAS_INTERFACE (1<<0)
 #define FLAG_NO_PATH (1<<1)
 #define FLAG_BROADCAST (1<<2)
@@ -52,32 +53,38 @@ Link state routing;
 #define FLAG_HAS_DROP_RATE (1<<5)
 
 #define ACK_WINDOW (16)
+// number of recent link state advertisements we remember sending to each neighbour
+#define LSA_WINDOW (32)
+// how many times will we repeat an advertisement that a neighbour hasn't acknowledged?
+#define LSA_REPEATS (4)
+// maximum number of paths we will spread unicast packets across
+#define MAX_PATHS (4)
 
 struct link{
-  struct link *_left;
-  struct link *_right;
+  // Note this must be here to match the memory layout of struct tree_record
+  size_t tree_depth;
+  sid_t receiver_sid;
 
   struct subscriber *transmitter;
-  struct link *parent;
+  // list of links, in any neighbour's tree, that share the same transmitter
+  struct link *_next_dependent;
+  struct link **_prev_dependent;
   struct network_destination *destination;
   struct subscriber *receiver;
 
   // What's the last ack we've heard so we don't process nacks twice.
   int last_ack_seq;
 
-  // neighbour path version when path scores were last updated
-  char path_version;
-
   // link quality stats;
   char link_version;
   char drop_rate;
 
-  // calculated path score;
+  // path score when this link was last considered;
   int hop_count;
   int path_drop_rate;
-
-  // loop prevention;
-  char calculating;
+  // path score along this neighbour's own chain of links back to us, for alternate paths
+  int alternate_hop_count;
+  int alternate_drop_rate;
 };
 
 // statistics of incoming half of network links
@@ -108,16 +115,23 @@ struct link_out{
   struct network_destination *destination;
 };
 
+// which packet carried one of our link state advertisements to a neighbour
+struct lsa_sent{
+  uint32_t version;
+  struct network_destination *destination;
+  int seq;
+  char acked;
+};
+
 struct neighbour{
   struct neighbour *_next;
 
   struct subscriber *subscriber;
 
-  // whenever we hear about a link change, update the version to mark all link path scores as dirty
-  char path_version;
-
   // when do we assume the link is dead because they stopped hearing us or vice versa?
   time_ms_t link_in_timeout;
+  // were routes through this neighbour last calculated while the link was alive?
+  char routable;
 
   // if a neighbour is telling the world that they are using us as a next hop, we need to send acks & nacks with high priority
   // otherwise we don't care too much about packet loss.
@@ -133,6 +147,8 @@ struct neighbour{
   // which of their mdp packets have we already heard and can be dropped as duplicates?
   int mdp_ack_sequence;
   uint64_t mdp_ack_mask;
+  // when did we last hear one? an old window is forgotten rather than trusted
+  time_ms_t mdp_ack_time;
 
   // next link update
   time_ms_t next_neighbour_update;
@@ -140,14 +156,25 @@ struct neighbour{
   int last_update_seq;
   time_ms_t rtt;
 
-  // un-balanced tree of known link states
-  struct link *root;
+  // tree of known link states, indexed by receiver sid
+  struct tree_root root;
+  // number of link records in the tree
+  unsigned link_count;
 
   // list of incoming link stats
   struct link_in *links, *best_link;
   
   // list of outgoing links
   struct link_out *out_links;
+
+  // which of our recent link state advertisements have they heard?
+  struct lsa_sent lsa_sent[LSA_WINDOW];
+};
+
+// a neighbour with a path to a subscriber, and the share of packets it should carry
+struct path{
+  struct subscriber *next_hop;
+  unsigned weight;
 };
 
 // one struct per subscriber, where we track all routing information, allocated on first use
@@ -156,14 +183,34 @@ struct link_state{
   struct subscriber *next_hop;
   struct subscriber *transmitter;
   int hop_count;
-  int route_version;
+  int path_drop_rate;
   // if a neighbour is free'd this link will point to invalid memory.
   // don't use this pointer directly, call find_best_link instead
   struct link *link;
+
+  // links that use this subscriber as their transmitter, whose path scores depend on our route
+  struct link *dependents;
+
+  // routes are only recalculated when something they depend on has changed.
+  // dirty subscribers are queued until the next call to route_recalculate()
+  struct subscriber *_next_dirty;
+  char dirty;
+  char queued;
   char calculating;
+  // has the route been recalculated, or changed, since it was last passed to set_reachable()?
+  char publish;
+  char changed;
 
   // when do we need to send a new link state message.
   time_ms_t next_update;
+  // which advertisement last included this link, and how many more times will we repeat it until every neighbour has acknowledged it?
+  uint32_t sent_version;
+  time_ms_t sent_time;
+  uint8_t repeats;
+
+  // every neighbour with a path as short as the best one, including next_hop, when multipath is enabled
+  struct path paths[MAX_PATHS];
+  unsigned path_count;
 };
 
 DEFINE_ALARM(link_send);
@@ -172,7 +219,33 @@ static int neighbour_find_best_link(struct neighbour *n);
 
 struct neighbour *neighbours=NULL;
 unsigned neighbour_count=0;
-int route_version=0;
+static struct subscriber *dirty_head=NULL, *dirty_tail=NULL;
+static unsigned route_calculations=0;
+// counters for recognising repeated payloads from each neighbour's mdp sequence numbers
+static struct payload_duplicate_stats{
+  uint64_t duplicates;
+  uint64_t sequence_jumps;
+  uint64_t expired;
+} payload_duplicate_stats;
+
+// link state advertisements we have sent
+static uint32_t lsa_version=0;
+static struct lsa_stats{
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t links;
+  uint64_t retries;
+  uint64_t refreshes;
+  // bytes sent during the current and previous second
+  time_ms_t window_start;
+  uint64_t window_bytes;
+  uint64_t last_window_bytes;
+} lsa_stats;
+
+static struct multipath_stats{
+  uint64_t alternate;
+  uint64_t failover;
+} multipath_stats;
 
 struct network_destination * new_destination(struct overlay_interface *interface){
   assert(interface);
@@ -243,15 +316,71 @@ static int NumberOfSetBits(uint32_t i)
     return (((i + (i >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
 }
 
+static void mark_dirty(struct subscriber *subscriber);
+
 static struct link_state *get_link_state(struct subscriber *subscriber)
 {
   if (!subscriber->link_state){
     subscriber->link_state = emalloc_zero(sizeof(struct link_state));
-    subscriber->link_state->route_version = route_version -1;
+    subscriber->link_state->hop_count = 99;
+    subscriber->link_state->path_drop_rate = 99;
+    mark_dirty(subscriber);
   }
   return subscriber->link_state;
 }
 
+// queue this subscriber's route for recalculation
+static void mark_dirty(struct subscriber *subscriber)
+{
+  struct link_state *state = get_link_state(subscriber);
+  state->dirty = 1;
+  if (state->queued)
+    return;
+  state->queued = 1;
+  state->_next_dirty = NULL;
+  if (dirty_tail)
+    dirty_tail->link_state->_next_dirty = subscriber;
+  else
+    dirty_head = subscriber;
+  dirty_tail = subscriber;
+}
+
+static int mark_link_dirty(void **record, void *UNUSED(context))
+{
+  struct link *link = *record;
+  mark_dirty(link->receiver);
+  return 0;
+}
+
+// every subscriber with a link in this neighbour's tree may need a new route
+static void mark_links_dirty(struct neighbour *neighbour)
+{
+  tree_walk(&neighbour->root, NULL, 0, mark_link_dirty, NULL);
+}
+
+// keep track of which links depend on the route to each transmitter
+static void set_link_transmitter(struct link *link, struct subscriber *transmitter)
+{
+  if (link->transmitter == transmitter)
+    return;
+  if (link->_prev_dependent){
+    *link->_prev_dependent = link->_next_dependent;
+    if (link->_next_dependent)
+      link->_next_dependent->_prev_dependent = link->_prev_dependent;
+    link->_next_dependent = NULL;
+    link->_prev_dependent = NULL;
+  }
+  link->transmitter = transmitter;
+  if (transmitter){
+    struct link_state *state = get_link_state(transmitter);
+    link->_next_dependent = state->dependents;
+    if (state->dependents)
+      state->dependents->_prev_dependent = &link->_next_dependent;
+    link->_prev_dependent = &state->dependents;
+    state->dependents = link;
+  }
+}
+
 static struct neighbour *get_neighbour(struct subscriber *subscriber, char create)
 {
   struct neighbour *n = neighbours;
@@ -263,6 +392,7 @@ static struct neighbour *get_neighbour(struct subscriber *subscriber, char creat
   if (create){
     n = emalloc_zero(sizeof(struct neighbour));
     n->subscriber = subscriber;
+    n->root.binary_length = SID_SIZE;
     n->_next = neighbours;
     n->last_update_seq = -1;
     n->mdp_ack_sequence = -1;
@@ -282,144 +412,187 @@ static struct neighbour *get_neighbour(struct subscriber *subscriber, char creat
   return n;
 }
 
-static void free_links(struct link *link)
+static int free_link(void **record, void *context)
 {
-  if (!link)
-    return;
-  free_links(link->_left);
-  link->_left=NULL;
-  free_links(link->_right);
-  link->_right=NULL;
+  struct neighbour *neighbour = context;
+  struct link *link = *record;
+  set_link_transmitter(link, NULL);
+  mark_dirty(link->receiver);
   if (link->destination)
     release_destination_ref(link->destination);
   free(link);
+  *record = NULL;
+  neighbour->link_count--;
+  return 0;
 }
 
-static struct link *find_link(struct neighbour *neighbour, struct subscriber *receiver, char create)
+static void free_links(struct neighbour *neighbour)
 {
-  struct link **link_ptr=&neighbour->root, *link=neighbour->root;
-  while(1){
-    if (link==NULL){
-      if (create){
-        link = *link_ptr = emalloc_zero(sizeof(struct link));
-        link->receiver = receiver;
-        link->path_version = neighbour->path_version -1;
-	link->last_ack_seq = -1;
-	link->link_version = -1;
-      }
-      break;
-    }
-    if (receiver == link->receiver)
-      break;
-    link_ptr = (cmp_sid_t(&receiver->sid, &link->receiver->sid) < 0) ? &link->_left : &link->_right;
-    link = *link_ptr;
+  tree_walk(&neighbour->root, NULL, 0, free_link, neighbour);
+}
+
+static void *create_link(void *context, const uint8_t *binary, size_t UNUSED(bin_length))
+{
+  struct neighbour *neighbour = context;
+  struct link *link = emalloc_zero(sizeof(struct link));
+  if (link){
+    struct tree_record *tree = (struct tree_record *)link;
+    assert(&tree->binary[0] == &link->receiver_sid.binary[0]);
+    link->receiver_sid = *(const sid_t *)binary;
+    link->last_ack_seq = -1;
+    link->link_version = -1;
+    link->alternate_hop_count = -1;
+    neighbour->link_count++;
   }
   return link;
 }
 
-static struct link *get_parent(struct neighbour *neighbour, struct link *link)
+// memory used by this neighbour's link records, and the tree nodes that index them
+static size_t link_memory(struct neighbour *neighbour)
 {
-  // root of the routing table.
-  if (link->receiver == neighbour->subscriber || link->transmitter == NULL)
-    return NULL;
-
-  if (!link->parent)
-    link->parent = find_link(neighbour, link->transmitter, 0);
-
-  return link->parent;
+  return neighbour->link_count * sizeof(struct link) + neighbour->root.node_count * sizeof(struct tree_node);
 }
 
-static void update_path_score(struct neighbour *neighbour, struct link *link){
-  if (link->path_version == neighbour->path_version)
-    return;
-  if (link->calculating)
-    return;
+static struct link *find_link(struct neighbour *neighbour, struct subscriber *receiver, char create)
+{
+  struct link *link = NULL;
+  if (tree_find(&neighbour->root, (void**)&link, receiver->sid.binary, SID_SIZE, create ? create_link : NULL, neighbour) != TREE_FOUND)
+    return NULL;
+  link->receiver = receiver;
+  return link;
+}
 
-  link->calculating = 1;
+// score a neighbour's path to this link's receiver from the score of its transmitter, returns non-zero if it changed
+static int update_alternate_path(struct subscriber *self, struct neighbour *neighbour, struct link *link)
+{
   int hop_count = -1;
   int drop_rate = 0;
-
-  if (link->transmitter == get_my_subscriber(1)){
-    if (link->receiver==neighbour->subscriber){
-      hop_count = 1;
-    }
-  }else{
-    struct link *parent = get_parent(neighbour, link);
-    if (parent && (!parent->calculating)){
-      update_path_score(neighbour, parent);
-      // TODO more interesting path cost metrics...
-      if (parent->hop_count>0){
-        hop_count = parent->hop_count+1;
-        drop_rate = parent->path_drop_rate;
+  if (neighbour->routable && link->transmitter){
+    if (link->transmitter == self){
+      if (link->receiver == neighbour->subscriber)
+	hop_count = 1;
+    }else{
+      struct link *parent = find_link(neighbour, link->transmitter, 0);
+      if (parent && parent->alternate_hop_count>0 && parent->alternate_hop_count<PAYLOAD_TTL_MAX){
+	hop_count = parent->alternate_hop_count+1;
+	drop_rate = parent->alternate_drop_rate;
       }
     }
+    if (link->drop_rate>2)
+      drop_rate += link->drop_rate;
   }
+  if (hop_count == link->alternate_hop_count && drop_rate == link->alternate_drop_rate)
+    return 0;
+  link->alternate_hop_count = hop_count;
+  link->alternate_drop_rate = drop_rate;
+  return 1;
+}
 
-  // ignore occasional dropped packets due to collisions
-  if (link->drop_rate>2)
-    drop_rate += link->drop_rate;
+// weight each path so that more reliable paths carry more packets
+static unsigned path_weight(int drop_rate)
+{
+  return 256 / (1 + drop_rate);
+}
 
-  if (hop_count != link->hop_count && IF_DEBUG(verbose))
-    DEBUGF(linkstate, "LINK STATE; path score to %s via %s version %d = %d",
-	   alloca_tohex_sid_t(link->receiver->sid),
-	   alloca_tohex_sid_t(neighbour->subscriber->sid),
-	   neighbour->path_version,
-	   hop_count);
+// find other neighbours with a path that is as short as the best one, and not much less reliable.
+// Since each alternate neighbour is one hop closer to the subscriber than we are, forwarding through any of them cannot loop.
+static void calculate_alternate_paths(struct subscriber *subscriber, struct link_state *state)
+{
+  unsigned max_paths = config.mdp.multipath.paths;
+  if (max_paths > MAX_PATHS)
+    max_paths = MAX_PATHS;
+  unsigned previous_count = state->path_count;
+  state->path_count = 0;
+  if (!state->next_hop || max_paths < 2)
+    return;
+  state->paths[state->path_count].next_hop = state->next_hop;
+  state->paths[state->path_count++].weight = path_weight(state->path_drop_rate);
 
-  link->hop_count = hop_count;
-  link->path_version = neighbour->path_version;
-  link->path_drop_rate = drop_rate;
-  link->calculating = 0;
+  struct neighbour *neighbour;
+  for (neighbour = neighbours; neighbour && state->path_count < max_paths; neighbour = neighbour->_next){
+    if (!neighbour->routable || neighbour->subscriber == state->next_hop)
+      continue;
+    struct link *link = find_link(neighbour, subscriber, 0);
+    if (!link
+      || link->alternate_hop_count != state->hop_count
+      || link->alternate_drop_rate > state->path_drop_rate + config.mdp.multipath.drop_rate_margin)
+      continue;
+    state->paths[state->path_count].next_hop = neighbour->subscriber;
+    state->paths[state->path_count++].weight = path_weight(link->alternate_drop_rate);
+  }
+  if (state->path_count < 2)
+    state->path_count = 0;
+  if (state->path_count != previous_count)
+    DEBUGF(overlayrouting, "%s now has %u equally short paths",
+	   alloca_tohex_sid_t(subscriber->sid), state->path_count);
 }
 
-// pick the best path to this network end point
-static struct link * find_best_link(struct subscriber *subscriber)
+/* Calculate the best path to this network end point, from the path each neighbour is using and
+ * the routes we have already calculated to the transmitter of each of those links.  When the
+ * result changes, every link that uses this subscriber as a transmitter is marked dirty, so
+ * that a single link change only re-relaxes the subscribers whose routes may depend on it.
+ */
+static void relax_route(struct subscriber *self, struct subscriber *subscriber, struct link_state *state)
 {
-  IN();
-  if (subscriber->reachable & REACHABLE_SELF)
-    RETURN(NULL);
-    
-  struct link_state *state = get_link_state(subscriber);
-  if (state->route_version == route_version)
-    RETURN(state->link);
-
-  if (state->calculating)
-    RETURN(NULL);
-  state->calculating = 1;
+  state->dirty = 0;
+  route_calculations++;
 
   struct neighbour *neighbour = neighbours;
-  struct network_destination *destination = NULL;
   int best_hop_count = 99;
   int best_drop_rate = 99;
   struct link *best_link = NULL;
   struct subscriber *next_hop = NULL, *transmitter=NULL;
-  time_ms_t now = gettime_ms();
+  int alternates_changed = 0;
 
   while (neighbour){
-    if (neighbour->link_in_timeout < now)
+    struct link *link = find_link(neighbour, subscriber, 0);
+    if (!link)
       goto next;
 
-    struct link *link = find_link(neighbour, subscriber, 0);
-    if (!(link && link->transmitter))
+    if (config.mdp.multipath.paths > 1 && update_alternate_path(self, neighbour, link))
+      alternates_changed = 1;
+
+    if (!(neighbour->routable && link->transmitter))
       goto next;
 
-    if (link->transmitter != get_my_subscriber(1)){
+    int hop_count = -1;
+    int drop_rate = 0;
+
+    if (link->transmitter == self){
+      if (link->receiver == neighbour->subscriber)
+	hop_count = 1;
+    }else{
+      // only follow this link if our route to the transmitter is via the same neighbour
       struct link_state *parent_state = get_link_state(link->transmitter);
-      find_best_link(link->transmitter);
       if (parent_state->next_hop != neighbour->subscriber)
 	goto next;
+      // TODO more interesting path cost metrics...
+      if (parent_state->hop_count>0 && parent_state->hop_count<PAYLOAD_TTL_MAX){
+	hop_count = parent_state->hop_count+1;
+	drop_rate = parent_state->path_drop_rate;
+      }
     }
 
-    update_path_score(neighbour, link);
+    // ignore occasional dropped packets due to collisions
+    if (link->drop_rate>2)
+      drop_rate += link->drop_rate;
 
-    if (link->hop_count>0){
-      if (link->path_drop_rate < best_drop_rate ||
-         (link->path_drop_rate == best_drop_rate && link->hop_count < best_hop_count)){
+    if (hop_count != link->hop_count && IF_DEBUG(verbose))
+      DEBUGF(linkstate, "LINK STATE; path score to %s via %s = %d",
+	     alloca_tohex_sid_t(link->receiver->sid),
+	     alloca_tohex_sid_t(neighbour->subscriber->sid),
+	     hop_count);
+
+    link->hop_count = hop_count;
+    link->path_drop_rate = drop_rate;
+
+    if (hop_count>0){
+      if (drop_rate < best_drop_rate ||
+         (drop_rate == best_drop_rate && hop_count < best_hop_count)){
         next_hop = neighbour->subscriber;
-        best_hop_count = link->hop_count;
-	best_drop_rate = link->path_drop_rate;
+        best_hop_count = hop_count;
+	best_drop_rate = drop_rate;
         transmitter = link->transmitter;
-        destination = link->destination;
         best_link = link;
       }
     }
@@ -428,36 +601,157 @@ next:
     neighbour = neighbour->_next;
   }
 
-  int changed =0;
+  if (alternates_changed
+    || state->next_hop != next_hop
+    || state->hop_count != best_hop_count
+    || state->path_drop_rate != best_drop_rate){
+    // the path score of every link from this subscriber has changed
+    struct link *dependent = state->dependents;
+    while(dependent){
+      mark_dirty(dependent->receiver);
+      dependent = dependent->_next_dependent;
+    }
+  }
+
   if (state->transmitter != transmitter || state->link != best_link)
-    changed = 1;
+    state->changed = 1;
+  state->publish = 1;
 
   state->next_hop = next_hop;
   state->transmitter = transmitter;
   state->hop_count = best_hop_count;
-  state->route_version = route_version;
-  state->calculating = 0;
+  state->path_drop_rate = best_drop_rate;
   state->link = best_link;
-  
+  calculate_alternate_paths(subscriber, state);
+  state->calculating = 0;
+}
+
+// subscribers waiting for the routes to their transmitters to be calculated first
+static struct subscriber **route_stack = NULL;
+static unsigned route_stack_size = 0;
+
+static int route_stack_push(unsigned depth, struct subscriber *subscriber)
+{
+  if (depth == route_stack_size){
+    unsigned size = route_stack_size ? route_stack_size * 2 : 64;
+    struct subscriber **stack = erealloc(route_stack, sizeof(struct subscriber *) * size);
+    if (!stack)
+      return -1;
+    route_stack = stack;
+    route_stack_size = size;
+  }
+  route_stack[depth] = subscriber;
+  return 0;
+}
+
+/* Calculate the route to a subscriber, after first calculating any dirty routes to the
+ * transmitters of its links, without recursion.  A subscriber stays on the stack, marked as
+ * calculating, until all of its transmitters are done; a transmitter that is already calculating
+ * is part of a loop, and its previous route is used instead.
+ */
+static void calculate_route(struct subscriber *self, struct subscriber *subscriber)
+{
+  struct link_state *state = get_link_state(subscriber);
+  if (!state->dirty || state->calculating)
+    return;
+  unsigned depth = 0;
+  if (route_stack_push(depth, subscriber) == -1){
+    relax_route(self, subscriber, state);
+    return;
+  }
+  depth++;
+  while (depth){
+    subscriber = route_stack[depth - 1];
+    state = subscriber->link_state;
+    if (!state->dirty){
+      depth--;
+      continue;
+    }
+    int waiting = 0;
+    if (!state->calculating){
+      state->calculating = 1;
+      struct neighbour *neighbour;
+      for (neighbour = neighbours; neighbour; neighbour = neighbour->_next){
+	if (!neighbour->routable)
+	  continue;
+	struct link *link = find_link(neighbour, subscriber, 0);
+	if (!(link && link->transmitter) || link->transmitter == self)
+	  continue;
+	struct link_state *parent_state = get_link_state(link->transmitter);
+	if (!parent_state->dirty || parent_state->calculating)
+	  continue;
+	if (route_stack_push(depth, link->transmitter) == -1)
+	  break;
+	depth++;
+	waiting = 1;
+      }
+    }
+    if (waiting)
+      continue;
+    depth--;
+    relax_route(self, subscriber, state);
+  }
+}
+
+// pick the best path to this network end point
+static struct link * find_best_link(struct subscriber *subscriber)
+{
+  IN();
+  if (subscriber->reachable & REACHABLE_SELF)
+    RETURN(NULL);
+
+  struct link_state *state = get_link_state(subscriber);
+  calculate_route(get_my_subscriber(1), subscriber);
+  if (!state->publish)
+    RETURN(state->link);
+
+  struct subscriber *next_hop = state->next_hop;
+  struct link *best_link = state->link;
+  int changed = state->changed;
+  state->publish = 0;
+  state->changed = 0;
+
   if (next_hop == subscriber)
     next_hop = NULL;
-  
-  if (set_reachable(subscriber, destination, next_hop, best_hop_count, transmitter))
+
+  if (set_reachable(subscriber, best_link ? best_link->destination : NULL, next_hop, state->hop_count, state->transmitter))
     changed = 1;
-  
+
   if (subscriber->identity && subscriber->reachable == REACHABLE_NONE){
     subscriber->reachable=REACHABLE_SELF;
     changed = 1;
     best_link = NULL;
     DEBUGF2(overlayrouting, linkstate, "REACHABLE via self %s", alloca_tohex_sid_t(subscriber->sid));
   }
-  
+
   if (changed)
-    state->next_update = now+5;
+    state->next_update = gettime_ms()+5;
 
   RETURN(best_link);
 }
 
+static struct subscriber *next_dirty()
+{
+  struct subscriber *subscriber = dirty_head;
+  if (subscriber){
+    struct link_state *state = subscriber->link_state;
+    dirty_head = state->_next_dirty;
+    if (!dirty_head)
+      dirty_tail = NULL;
+    state->_next_dirty = NULL;
+    state->queued = 0;
+  }
+  return subscriber;
+}
+
+// recalculate every route that depends on something that has changed
+static void route_recalculate()
+{
+  struct subscriber *subscriber;
+  while ((subscriber = next_dirty()))
+    find_best_link(subscriber);
+}
+
 static int append_link_state(struct overlay_buffer *payload, struct decode_context *context, char flags,
                              struct subscriber *transmitter, struct subscriber *receiver, 
                              int interface, int version, int ack_sequence, uint32_t ack_mask, 
@@ -519,6 +813,20 @@ static int free_subscriber_link_state(void **record, void *UNUSED(context))
   return 0;
 }
 
+// has every neighbour that can hear us acknowledged the last advertisement of this link?
+static int link_state_acked(struct link_state *state)
+{
+  struct neighbour *n;
+  for (n = neighbours; n; n = n->_next){
+    if (!n->routable || n->legacy_protocol)
+      continue;
+    struct lsa_sent *sent = &n->lsa_sent[state->sent_version % LSA_WINDOW];
+    if (sent->version != state->sent_version || !sent->acked)
+      return 0;
+  }
+  return 1;
+}
+
 static int append_link(void **record, void *context)
 {
   struct subscriber *subscriber = *record;
@@ -532,44 +840,136 @@ static int append_link(void **record, void *context)
   struct append_context *append_context = context;
   time_ms_t now = gettime_ms();
 
-  if (subscriber->reachable==REACHABLE_SELF){
-    if (state->next_update - 20 <= now){
-      // Other entries in our keyring are always one hop away from us.
-      if (append_link_state(append_context->payload, &append_context->context, 0, get_my_subscriber(1), subscriber, -1, 1, -1, 0, 0)){
-        ALARM_STRUCT(link_send).alarm = now+5;
-        return 1;
-      }
-      // include information about this link every 5s
-      state->next_update = now + 5000;
-    }
-  } else {
-    
+  if (subscriber->reachable!=REACHABLE_SELF){
     if (subscriber->identity)
       keyring_send_unlock(subscriber);
-    
+
     if (best_link && best_link->destination 
       && !best_link->destination->ifconfig.route){
       // never mention links we shouldn't advertise
       state->next_update = TIME_MS_NEVER_WILL;
+      state->repeats = 0;
+      return 0;
+    }
+  }
+
+  // only repeat a changed link until every neighbour has heard it
+  if (state->repeats && link_state_acked(state))
+    state->repeats = 0;
+  char retry = state->next_update - 20 > now
+    && state->repeats && state->sent_time + config.mdp.link_state.retry_ms <= now;
+
+  if (retry || state->next_update - 20 <= now){
+    int ret;
+    if (subscriber->reachable==REACHABLE_SELF){
+      // Other entries in our keyring are always one hop away from us.
+      ret = append_link_state(append_context->payload, &append_context->context, 0, get_my_subscriber(1), subscriber, -1, 1, -1, 0, 0);
     }else{
-      if (state->next_update - 20 <= now){
-	if (append_link_state(append_context->payload, &append_context->context, 0, state->transmitter, subscriber, -1,
-	    best_link?best_link->link_version:-1, -1, 0, best_link?best_link->drop_rate:32)){
-	  ALARM_STRUCT(link_send).alarm = now+5;
-	  return 1;
-	}
-	// include information about this link every 5s
-	state->next_update = now + 5000;
-      }
+      ret = append_link_state(append_context->payload, &append_context->context, 0, state->transmitter, subscriber, -1,
+	    best_link?best_link->link_version:-1, -1, 0, best_link?best_link->drop_rate:32);
     }
+    if (ret){
+      ALARM_STRUCT(link_send).alarm = now+5;
+      return 1;
+    }
+    lsa_stats.links++;
+    if (retry){
+      DEBUGF(linkstate, "LINK STATE; repeating unacknowledged link to %s", alloca_tohex_sid_t(subscriber->sid));
+      lsa_stats.retries++;
+      state->repeats--;
+    }else
+      state->repeats = LSA_REPEATS;
+    state->sent_version = lsa_version;
+    state->sent_time = now;
+    // unless it changes, only include this link again in the next full refresh
+    state->next_update = now + config.mdp.link_state.refresh_ms;
   }
 
   if (state->next_update < ALARM_STRUCT(link_send).alarm)
     ALARM_STRUCT(link_send).alarm = state->next_update;
+  if (state->repeats && state->sent_time + config.mdp.link_state.retry_ms < ALARM_STRUCT(link_send).alarm)
+    ALARM_STRUCT(link_send).alarm = state->sent_time + config.mdp.link_state.retry_ms;
+
+  return 0;
+}
+
+static int refresh_link_state(void **record, void *context)
+{
+  struct subscriber *subscriber = *record;
+  time_ms_t *now = context;
+  if (subscriber->link_state)
+    subscriber->link_state->next_update = *now;
+  return 0;
+}
+
+// a new neighbour has started hearing us, advertise every link we know about
+static void link_state_refresh(time_ms_t now)
+{
+  lsa_stats.refreshes++;
+  enum_subscribers(NULL, refresh_link_state, &now);
+}
 
+// remember which packet carried each advertisement to each neighbour, so their acks tell us what they have heard
+static int link_state_sent(struct overlay_frame *UNUSED(frame), struct network_destination *destination, int sequence, void *context)
+{
+  uint32_t version = (uintptr_t)context;
+  if (sequence == -1)
+    return 0;
+  struct neighbour *n;
+  for (n = neighbours; n; n = n->_next){
+    struct link_out *out = n->out_links;
+    while(out && out->destination != destination)
+      out = out->_next;
+    if (!out)
+      continue;
+    struct lsa_sent *sent = &n->lsa_sent[version % LSA_WINDOW];
+    if (sent->version == version)
+      continue;
+    sent->version = version;
+    sent->destination = destination;
+    sent->seq = sequence;
+    sent->acked = 0;
+  }
   return 0;
 }
 
+static void link_state_ack(struct neighbour *neighbour, struct network_destination *destination, int ack_seq, uint32_t ack_mask)
+{
+  unsigned i;
+  for (i = 0; i < LSA_WINDOW; i++){
+    struct lsa_sent *sent = &neighbour->lsa_sent[i];
+    if (sent->acked || sent->destination != destination)
+      continue;
+    int seq_delta = (ack_seq - sent->seq)&0xFF;
+    if (seq_delta==0 || (seq_delta <= 32 && ack_mask&((uint32_t)1<<(seq_delta-1))))
+      sent->acked = 1;
+    else if (seq_delta > 32 && seq_delta < 128)
+      // too old to be acked, don't let the sequence number wrap around
+      sent->destination = NULL;
+  }
+}
+
+static uint64_t lsa_bytes_per_second(time_ms_t now)
+{
+  if (now - lsa_stats.window_start >= 2000)
+    return 0;
+  if (now - lsa_stats.window_start >= 1000)
+    return lsa_stats.window_bytes;
+  return lsa_stats.last_window_bytes;
+}
+
+static void lsa_count_bytes(time_ms_t now, size_t bytes)
+{
+  if (now - lsa_stats.window_start >= 1000){
+    lsa_stats.last_window_bytes = (now - lsa_stats.window_start >= 2000) ? 0 : lsa_stats.window_bytes;
+    lsa_stats.window_start = now;
+    lsa_stats.window_bytes = 0;
+  }
+  lsa_stats.packets++;
+  lsa_stats.bytes += bytes;
+  lsa_stats.window_bytes += bytes;
+}
+
 static void free_neighbour(struct neighbour **neighbour_ptr){
   struct neighbour *n = *neighbour_ptr;
   if (IF_DEBUG(verbose))
@@ -590,8 +990,7 @@ static void free_neighbour(struct neighbour **neighbour_ptr){
     free(l);
   }
   
-  free_links(n->root);
-  n->root=NULL;
+  free_links(n);
   *neighbour_ptr = n->_next;
   free(n);
 }
@@ -635,12 +1034,11 @@ static void clean_neighbours(time_ms_t now)
       }
     }
     
-    // when all links to a neighbour that we were directly routing to expire, force a routing calculation update
-    struct link_state *state = get_link_state(subscriber);
-    if (state->next_hop == subscriber && 
-	(n->link_in_timeout < now || !n->links || !alive) && 
-	state->route_version == route_version)
-      route_version++;
+    // when the link to a neighbour expires, every route through them needs to be recalculated
+    if (n->routable && n->link_in_timeout < now){
+      n->routable = 0;
+      mark_links_dirty(n);
+    }
       
     if (!n->links || !alive){
       free_neighbour(n_ptr);
@@ -648,6 +1046,7 @@ static void clean_neighbours(time_ms_t now)
       CALL_TRIGGER(nbr_change, subscriber, 0, neighbour_count);
       if (neighbour_count==0){
 	// clean up the routing table
+	dirty_head = dirty_tail = NULL;
 	enum_subscribers(NULL, free_subscriber_link_state, NULL);
 	RESCHEDULE(&ALARM_STRUCT(link_send), 
 	  TIME_MS_NEVER_WILL, TIME_MS_NEVER_WILL, TIME_MS_NEVER_WILL);
@@ -658,11 +1057,17 @@ static void clean_neighbours(time_ms_t now)
   }
 }
 
-static void link_status_html(struct strbuf *b, struct subscriber *n, struct link *link)
+struct link_status_context{
+  struct strbuf *b;
+  struct subscriber *neighbour;
+};
+
+static int link_status_html(void **record, void *context)
 {
-  if (!link)
-    return;
-  link_status_html(b, n, link->_left);
+  struct link_status_context *ctx = context;
+  struct strbuf *b = ctx->b;
+  struct subscriber *n = ctx->neighbour;
+  struct link *link = *record;
   int best=0;
   if (link->receiver->next_hop==n)
     best=1;
@@ -673,20 +1078,32 @@ static void link_status_html(struct strbuf *b, struct subscriber *n, struct link
     best?" *best*":"",
     link->hop_count, link->path_drop_rate, 
     link->transmitter?alloca_tohex_sid_t_trunc(link->transmitter->sid, 16):"unreachable");
-  link_status_html(b, n, link->_right);
+  return 0;
 }
 
 void link_neighbour_short_status_html(struct strbuf *b, const char *link_prefix)
 {
   struct neighbour *n = neighbours;
+  strbuf_sprintf(b, "Duplicate payloads: %"PRIu64", sequence jumps: %"PRIu64", expired: %"PRIu64"<br>",
+    payload_duplicate_stats.duplicates,
+    payload_duplicate_stats.sequence_jumps,
+    payload_duplicate_stats.expired);
+  strbuf_sprintf(b, "Link state: %"PRIu64" bytes/s, %"PRIu64" bytes in %"PRIu64" packets, %"PRIu64" links, %"PRIu64" repeated, %"PRIu64" refreshes<br>",
+    lsa_bytes_per_second(gettime_ms()),
+    lsa_stats.bytes, lsa_stats.packets,
+    lsa_stats.links, lsa_stats.retries, lsa_stats.refreshes);
+  if (config.mdp.multipath.paths > 1)
+    strbuf_sprintf(b, "Multipath: %"PRIu64" frames via alternate paths, %"PRIu64" failovers<br>",
+      multipath_stats.alternate, multipath_stats.failover);
   if (!n)
     strbuf_puts(b, "No peers<br>");
   while(n){
-    strbuf_sprintf(b, "<a href=\"%s/%s\">%s*</a>, seq=%d, mask=%08"PRIx64"<br>", 
+    strbuf_sprintf(b, "<a href=\"%s/%s\">%s*</a>, seq=%d, mask=%08"PRIx64", links=%u (%zu bytes)<br>", 
       link_prefix,
       alloca_tohex_sid_t(n->subscriber->sid),
       alloca_tohex_sid_t_trunc(n->subscriber->sid, 16),
-      n->mdp_ack_sequence, n->mdp_ack_mask);
+      n->mdp_ack_sequence, n->mdp_ack_mask,
+      n->link_count, link_memory(n));
     n=n->_next;
   }
 }
@@ -719,8 +1136,9 @@ void link_neighbour_status_html(struct strbuf *b, struct subscriber *neighbour)
 	}
 	link_out = link_out->_next;
       }
-      strbuf_puts(b, "Links;<br>");
-      link_status_html(b, n->subscriber, n->root);
+      strbuf_sprintf(b, "Links; %u (%zu bytes)<br>", n->link_count, link_memory(n));
+      struct link_status_context context = {.b = b, .neighbour = n->subscriber};
+      tree_walk(&n->root, NULL, 0, link_status_html, &context);
       return;
     }
     n = n->_next;
@@ -959,6 +1377,7 @@ void link_send(struct sched_ent *alarm)
 
   // TODO use a separate alarm?
   link_send_neighbours();
+  route_recalculate();
 
   struct append_context context;
   bzero(&context, sizeof(context));
@@ -978,6 +1397,8 @@ void link_send(struct sched_ent *alarm)
     header.qos = OQ_MESH_MANAGEMENT;
     header.crypt_flags = MDP_FLAG_NO_CRYPT|MDP_FLAG_NO_SIGN;
     header.resend = -1;
+    header.send_hook = link_state_sent;
+    header.send_context = (void *)(uintptr_t)++lsa_version;
     
     ob_limitsize(context.payload, 400);
     
@@ -988,6 +1409,7 @@ void link_send(struct sched_ent *alarm)
     
     if (ob_position(context.payload) != pos){
       ob_flip(context.payload);
+      lsa_count_bytes(gettime_ms(), ob_remaining(context.payload));
       overlay_send_frame(&header, context.payload);
     }
     ob_free(context.payload);
@@ -1016,6 +1438,7 @@ int link_stop_routing(struct subscriber *subscriber)
   subscriber->identity=NULL;
   if (serverMode && subscriber->link_state){
     struct link_state *state = get_link_state(subscriber);
+    mark_dirty(subscriber);
     state->next_update = gettime_ms();
     update_alarm(__WHENCE__, state->next_update);
   }
@@ -1054,6 +1477,52 @@ struct link_in * get_neighbour_link(struct neighbour *neighbour, struct overlay_
   return link;
 }
 
+static uint32_t frame_flow_hash(struct overlay_frame *frame)
+{
+  uint32_t hash = frame->flow_hash;
+  if (frame->source)
+    hash ^= read_uint32(&frame->source->sid.binary[0]);
+  hash ^= read_uint32(&frame->destination->sid.binary[0]) * 2654435761u;
+  return hash ^ (hash >> 16);
+}
+
+// spread packets across every path to this subscriber, while keeping each flow on the same path.
+// If the neighbour we would normally use has stopped hearing us, switch to another path immediately.
+static struct subscriber *choose_path(struct overlay_frame *frame, struct subscriber *subscriber, struct subscriber *next_hop)
+{
+  struct link_state *state = subscriber->link_state;
+  if (!state || state->path_count < 2)
+    return next_hop;
+
+  time_ms_t now = gettime_ms();
+  struct path *alive[MAX_PATHS];
+  unsigned count = 0, total = 0, i;
+  for (i = 0; i < state->path_count; i++){
+    struct neighbour *n = get_neighbour(state->paths[i].next_hop, 0);
+    if (!n || n->link_in_timeout < now || !(n->subscriber->reachable & REACHABLE_DIRECT))
+      continue;
+    alive[count++] = &state->paths[i];
+    total += state->paths[i].weight;
+  }
+  if (count == 0)
+    return next_hop;
+
+  uint32_t pick = frame_flow_hash(frame) % total;
+  for (i = 0; i + 1 < count && pick >= alive[i]->weight; i++)
+    pick -= alive[i]->weight;
+  struct subscriber *chosen = alive[i]->next_hop;
+  if (chosen != next_hop){
+    struct neighbour *n = get_neighbour(next_hop, 0);
+    if (!n || n->link_in_timeout < now)
+      multipath_stats.failover++;
+    else
+      multipath_stats.alternate++;
+    DEBUGF(overlayrouting, "Sending to %s via alternate path through %s",
+	   alloca_tohex_sid_t(subscriber->sid), alloca_tohex_sid_t(chosen->sid));
+  }
+  return chosen;
+}
+
 int link_add_destinations(struct overlay_frame *frame)
 {
   if (frame->destination){
@@ -1092,7 +1561,7 @@ int link_add_destinations(struct overlay_frame *frame)
     }
     
     if ((next_hop->reachable&REACHABLE)==REACHABLE_INDIRECT)
-      next_hop = next_hop->next_hop;
+      next_hop = choose_path(frame, next_hop, next_hop->next_hop);
     
     if (next_hop->reachable&REACHABLE_DIRECT){
       unsigned i;
@@ -1189,17 +1658,31 @@ int link_received_duplicate(struct decode_context *context, int payload_seq)
   if (!neighbour)
     return 0;
 
+  // after a long silence the sequence numbers may have wrapped, or our neighbour restarted
+  time_ms_t now = gettime_ms();
+  if (neighbour->mdp_ack_sequence != -1
+    && neighbour->mdp_ack_time + context->interface->destination->ifconfig.reachable_timeout_ms < now){
+    DEBUGF(ack, "Forgetting stale neighbour mdp seq %d", neighbour->mdp_ack_sequence);
+    payload_duplicate_stats.expired++;
+    neighbour->mdp_ack_sequence = -1;
+    neighbour->mdp_ack_mask = 0;
+  }
+  neighbour->mdp_ack_time = now;
+
   if (neighbour->mdp_ack_sequence == -1){
     neighbour->mdp_ack_sequence = payload_seq;
     return 0;
   }
   
-  if (neighbour->mdp_ack_sequence == payload_seq)
+  if (neighbour->mdp_ack_sequence == payload_seq){
+    payload_duplicate_stats.duplicates++;
     return 1;
+  }
 
   int offset = (neighbour->mdp_ack_sequence - 1 - payload_seq)&0xFF;
   if (offset < 64){
     if (neighbour->mdp_ack_mask & (1ull<<offset)){
+      payload_duplicate_stats.duplicates++;
       return 1;
     }
     neighbour->mdp_ack_mask |= (1ull<<offset);
@@ -1207,6 +1690,7 @@ int link_received_duplicate(struct decode_context *context, int payload_seq)
     int offset = (payload_seq - neighbour->mdp_ack_sequence - 1)&0xFF;
     if (offset>=64){
       neighbour->mdp_ack_mask = 0;
+      payload_duplicate_stats.sequence_jumps++;
       DEBUGF(ack, "Jump in neighbour mdp seq (%d -> %d)",neighbour->mdp_ack_sequence,payload_seq);
     }else{
       neighbour->mdp_ack_mask = (neighbour->mdp_ack_mask << 1) | 1;
@@ -1523,6 +2007,12 @@ static int link_receive(struct internal_mdp_header *header, struct overlay_buffe
 	version++;
       }
       neighbour->link_in_timeout = now + interface->destination->ifconfig.reachable_timeout_ms;
+      if (!neighbour->routable){
+	DEBUGF(linkstate, "LINK STATE; %s can hear us, advertising every link", alloca_tohex_sid_t(neighbour->subscriber->sid));
+	neighbour->routable = 1;
+	mark_links_dirty(neighbour);
+	link_state_refresh(now);
+      }
 
       if (drop_rate != link->drop_rate || transmitter != link->transmitter)
 	version++;
@@ -1535,6 +2025,7 @@ static int link_receive(struct internal_mdp_header *header, struct overlay_buffe
 	}
 	
         overlay_queue_ack(header->source, destination, ack_mask, ack_seq);
+        link_state_ack(neighbour, destination, ack_seq, ack_mask);
 
         // did they miss our last ack?
         if (neighbour->last_update_seq!=-1){
@@ -1552,24 +2043,24 @@ static int link_receive(struct internal_mdp_header *header, struct overlay_buffe
       }
 
       link->last_ack_seq = ack_seq;
-    }else{
-      set_destination_ref(&link->destination, NULL);
+    }else if (set_destination_ref(&link->destination, NULL)){
+      changed = 1;
+      mark_dirty(receiver);
     }
 
     if (link->transmitter != transmitter || link->link_version != version){
       changed = 1;
-      link->transmitter = transmitter;
+      set_link_transmitter(link, transmitter);
       link->link_version = version & 0xFF;
       link->drop_rate = drop_rate;
       // TODO other link attributes...
+      mark_dirty(receiver);
     }
   }
 
   send_please_explain(&context, myself, header->source);
 
   if (changed){
-    route_version++;
-    neighbour->path_version ++;
     if (ALARM_STRUCT(link_send).alarm>now+5){
       RESCHEDULE(&ALARM_STRUCT(link_send), now+5, now+5, now+25);
     }
@@ -1623,7 +2114,7 @@ int link_state_legacy_ack(struct overlay_frame *frame, time_ms_t now)
   if (link->transmitter != get_my_subscriber(1))
     changed = 1;
 
-  link->transmitter = get_my_subscriber(1);
+  set_link_transmitter(link, get_my_subscriber(1));
   link->link_version = 1;
   link->destination = interface->destination;
 
@@ -1636,10 +2127,13 @@ int link_state_legacy_ack(struct overlay_frame *frame, time_ms_t now)
 
   neighbour->legacy_protocol = 1;
   neighbour->link_in_timeout = now + link->destination->ifconfig.reachable_timeout_ms;
+  if (!neighbour->routable){
+    neighbour->routable = 1;
+    mark_links_dirty(neighbour);
+  }
 
   if (changed){
-    route_version++;
-    neighbour->path_version ++;
+    mark_dirty(frame->source);
     if (ALARM_STRUCT(link_send).alarm>now+5){
       RESCHEDULE(&ALARM_STRUCT(link_send), now+5, now+5, now+25);
     }
@@ -1648,3 +2142,178 @@ int link_state_legacy_ack(struct overlay_frame *frame, time_ms_t now)
   return 0;
 }
 
+
+/* Benchmark route calculation over a synthetic mesh.  The nodes are laid out in a square grid,
+ * with this node in the middle, and each of our immediate neighbours reports a shortest path
+ * tree to every other node that doesn't pass through us.
+ */
+DEFINE_CMD(app_route_test, 0,
+  "Time route calculations over a synthetic mesh",
+  "test","routing","[<nodes>]");
+static int app_route_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *nodes_arg;
+  if (cli_arg(parsed, "nodes", &nodes_arg, cli_uint, "1000") == -1)
+    return -1;
+  if (serverMode || neighbours)
+    return WHY("Cannot benchmark routing in a running daemon");
+
+  unsigned side = 3;
+  while (side * side < (unsigned)atoi(nodes_arg))
+    side++;
+  unsigned count = side * side;
+  struct subscriber **nodes = emalloc_zero(sizeof(struct subscriber *) * count);
+  unsigned *parent = emalloc(sizeof(unsigned) * count);
+  unsigned *queue = emalloc(sizeof(unsigned) * count);
+  int ret = -1;
+  unsigned i;
+  if (!nodes || !parent || !queue)
+    goto end;
+
+  for (i = 0; i < count; i++){
+    sid_t sid;
+    randombytes_buf(sid.binary, sizeof sid.binary);
+    if (!(nodes[i] = find_subscriber(sid.binary, sizeof sid.binary, 1)))
+      goto end;
+  }
+  unsigned self = (side / 2) * side + side / 2;
+  int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+  unsigned link_count = 0, d;
+  time_ms_t start, end;
+
+  for (d = 0; d < 4; d++){
+    unsigned first = self + dx[d] + dy[d] * side;
+    struct neighbour *n = emalloc_zero(sizeof(struct neighbour));
+    if (!n)
+      goto end;
+    n->subscriber = nodes[first];
+    n->root.binary_length = SID_SIZE;
+    n->routable = 1;
+    n->_next = neighbours;
+    neighbours = n;
+
+    // breadth first search from this neighbour, without passing through us
+    for (i = 0; i < count; i++)
+      parent[i] = count;
+    unsigned head = 0, tail = 0;
+    parent[first] = self;
+    queue[tail++] = first;
+    while (head < tail){
+      unsigned v = queue[head++];
+      struct link *link = find_link(n, nodes[v], 1);
+      if (!link)
+	goto end;
+      set_link_transmitter(link, nodes[parent[v]]);
+      link_count++;
+      unsigned e;
+      for (e = 0; e < 4; e++){
+	int x = v % side + dx[e], y = v / side + dy[e];
+	if (x < 0 || y < 0 || x >= (int)side || y >= (int)side)
+	  continue;
+	unsigned w = y * side + x;
+	if (w == self || parent[w] != count)
+	  continue;
+	parent[w] = v;
+	queue[tail++] = w;
+      }
+    }
+  }
+  size_t link_bytes = 0;
+  struct neighbour *n;
+  for (n = neighbours; n; n = n->_next)
+    link_bytes += link_memory(n);
+  cli_printf(context, "%u nodes, 4 neighbours, %u links, %zu bytes\n", count, link_count, link_bytes);
+
+  // look up random links in each neighbour's tree
+  unsigned rounds = 100000;
+  start = gettime_ms();
+  unsigned r, found = 0;
+  for (r = 0; r < rounds; r++){
+    for (n = neighbours; n; n = n->_next)
+      if (find_link(n, nodes[randombytes_uniform(count)], 0))
+	found++;
+  }
+  end = gettime_ms();
+  cli_printf(context, "Link lookup: %.3fus, %u found\n",
+    (end - start) * 1000.0 / (rounds * 4), found);
+
+  // recalculate every route, as if every link had changed
+  rounds = 100;
+  route_calculations = 0;
+  start = gettime_ms();
+  for (r = 0; r < rounds; r++){
+    for (i = 0; i < count; i++)
+      if (i != self)
+	mark_dirty(nodes[i]);
+    struct subscriber *subscriber;
+    while ((subscriber = next_dirty()))
+      calculate_route(nodes[self], subscriber);
+  }
+  end = gettime_ms();
+  unsigned reachable = 0;
+  for (i = 0; i < count; i++)
+    if (i != self && nodes[i]->link_state->next_hop)
+      reachable++;
+  cli_printf(context, "Full recalculation: %.3fms, %u routes calculated, %u reachable\n",
+    (end - start) * 1.0 / rounds, route_calculations / rounds, reachable);
+
+  // change the drop rate of one link at a time
+  rounds = 1000;
+  route_calculations = 0;
+  start = gettime_ms();
+  for (r = 0; r < rounds; r++){
+    n = neighbours;
+    for (d = randombytes_uniform(4); d; d--)
+      n = n->_next;
+    struct link *link = find_link(n, nodes[randombytes_uniform(count)], 0);
+    if (!link)
+      continue;
+    link->drop_rate = link->drop_rate ? 0 : 8;
+    mark_dirty(link->receiver);
+    struct subscriber *subscriber;
+    while ((subscriber = next_dirty()))
+      calculate_route(nodes[self], subscriber);
+  }
+  end = gettime_ms();
+  cli_printf(context, "Incremental link change: %.3fms, %.1f routes calculated\n",
+    (end - start) * 1.0 / rounds, route_calculations * 1.0 / rounds);
+
+  // forget every link one neighbour told us about, as if it had gone away
+  n = neighbours;
+  n->routable = 0;
+  start = gettime_ms();
+  free_links(n);
+  struct subscriber *subscriber;
+  while ((subscriber = next_dirty()))
+    calculate_route(nodes[self], subscriber);
+  end = gettime_ms();
+  reachable = 0;
+  for (i = 0; i < count; i++)
+    if (i != self && nodes[i]->link_state->next_hop)
+      reachable++;
+  cli_printf(context, "Remove neighbour: %.3fms, %u links and %zu bytes left, %u reachable\n",
+    (end - start) * 1.0, n->link_count, link_memory(n), reachable);
+
+  ret = 0;
+
+end:
+  while (neighbours){
+    struct neighbour *n = neighbours;
+    neighbours = n->_next;
+    free_links(n);
+    free(n);
+  }
+  dirty_head = dirty_tail = NULL;
+  if (nodes){
+    for (i = 0; i < count; i++){
+      if (!nodes[i])
+	continue;
+      free(nodes[i]->link_state);
+      nodes[i]->link_state = NULL;
+    }
+  }
+  free(nodes);
+  free(parent);
+  free(queue);
+  return ret;
+}
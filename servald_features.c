@@ -57,4 +57,5 @@ void servald_features()
   USE_FEATURE(http_rest_rhizome);
   USE_FEATURE(http_rest_meshms);
   USE_FEATURE(http_rest_meshmb);
+  USE_FEATURE(http_rest_events);
 }
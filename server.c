@@ -52,6 +52,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "commandline.h"
 #include "mdp_client.h"
 #include "route_link.h"
+#include "trace.h"
 
 DEFINE_FEATURE(cli_server);
 
@@ -610,6 +611,7 @@ static void server_on_config_change()
   
   time_ms_t now = gettime_ms();
   
+  trace_configure(config.server.trace.enable, config.server.trace.events);
   dna_helper_start();
   directory_service_init();
   
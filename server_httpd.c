@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "overlay_interface.h"
 #include "os.h"
 #include "route_link.h"
+#include "keyring.h"
 
 DEFINE_FEATURE(http_server);
 
@@ -33,6 +34,8 @@ DECLARE_HANDLER("/static/", static_page);
 DECLARE_HANDLER("/interface/", interface_page);
 DECLARE_HANDLER("/neighbour/", neighbour_page);
 DECLARE_HANDLER("/favicon.ico", fav_icon_header);
+DECLARE_HANDLER("/restful/alarms.json", restful_alarms_json);
+DECLARE_HANDLER("/restful/trace.json", restful_trace_json);
 
 static int root_page(httpd_request *r, const char *remainder)
 {
@@ -58,6 +61,10 @@ static int root_page(httpd_request *r, const char *remainder)
 	i, i, overlay_interfaces[i].name, overlay_interfaces[i].tx_count, overlay_interfaces[i].recv_count);
   }
   strbuf_puts(b, "Neighbours;<br />");
+  overlay_broadcast_status_html(b);
+  keyring_nm_cache_status_html(b);
+  http_connection_status_html(b);
+  httpd_watch_status_html(b);
   link_neighbour_short_status_html(b, "/neighbour");
   if (is_rhizome_http_enabled()){
     strbuf_puts(b, "<a href=\"/rhizome/status\">Rhizome Status</a><br />");
@@ -71,6 +78,57 @@ static int root_page(httpd_request *r, const char *remainder)
   return 1;
 }
 
+static int restful_alarms_json(httpd_request *r, const char *remainder)
+{
+  if (*remainder)
+    return 404;
+  r->http.response.header.content_type = CONTENT_TYPE_JSON;
+  int ret = authorize_restful(&r->http);
+  if (ret)
+    return ret;
+  if (r->http.verb != HTTP_VERB_GET)
+    return 405;
+  char buf[32*1024];
+  strbuf b = strbuf_local_buf(buf);
+  fd_alarm_stats_json(b);
+  if (strbuf_overrun(b)) {
+    WHY("HTTP alarm statistics buffer overrun");
+    return 500;
+  }
+  http_request_response_static(&r->http, 200, CONTENT_TYPE_JSON, buf, strbuf_len(b));
+  return 1;
+}
+
+static HTTP_CONTENT_GENERATOR restful_trace_json_content;
+
+static int restful_trace_json(httpd_request *r, const char *remainder)
+{
+  if (*remainder)
+    return 404;
+  r->http.response.header.content_type = CONTENT_TYPE_JSON;
+  int ret = authorize_restful(&r->http);
+  if (ret)
+    return ret;
+  if (r->http.verb != HTTP_VERB_GET)
+    return 405;
+  trace_cursor_start(&r->u.trace);
+  http_request_response_generated(&r->http, 200, CONTENT_TYPE_JSON, restful_trace_json_content);
+  return 1;
+}
+
+static HTTP_CONTENT_GENERATOR_STRBUF_CHUNKER restful_trace_json_content_chunk;
+
+static int restful_trace_json_content(struct http_request *hr, unsigned char *buf, size_t bufsz, struct http_content_generator_result *result)
+{
+  return generate_http_content_from_strbuf_chunks(hr, (char *)buf, bufsz, result, restful_trace_json_content_chunk);
+}
+
+static int restful_trace_json_content_chunk(struct http_request *hr, strbuf b)
+{
+  httpd_request *r = (httpd_request *) hr;
+  return trace_json_chunk(b, &r->u.trace);
+}
+
 static int fav_icon_header(httpd_request *r, const char *remainder)
 {
   if (*remainder)
@@ -33,6 +33,7 @@ SERVAL_CLIENT_SOURCES = \
 	str.c \
 	strlcpy.c \
 	test_cli.c \
+	trace.c \
 	uri.c \
 	uuid.c \
 	version_cli.c \
@@ -53,6 +54,7 @@ SERVAL_DAEMON_SOURCES = \
 	crypto.c \
 	directory_client.c \
 	dna_helper.c \
+	events_restful.c \
 	golay.c \
 	httpd.c \
 	http_server.c \
@@ -110,6 +112,7 @@ SERVAL_DAEMON_SOURCES = \
 	rhizome_store.c \
 	rhizome_sync.c \
 	rhizome_sync_keys.c \
+	rhizome_verify.c \
 	rhizome_restful.c \
 	rhizome_cli.c \
 	sync_keys.c \
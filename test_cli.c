@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "cli.h"
 #include "serval_types.h"
@@ -33,6 +34,7 @@
 #include "commandline.h"
 #include "mem.h"
 #include "str.h"
+#include "fdqueue.h"
 
 DEFINE_FEATURE(cli_tests);
 
@@ -195,6 +197,211 @@ static int app_crypt_test(const struct cli_parsed *parsed, struct cli_context *c
   return 0;
 }
 
+static unsigned scheduler_test_calls;
+static void scheduler_test_alarm(struct sched_ent *UNUSED(alarm))
+{
+  scheduler_test_calls++;
+}
+
+DEFINE_CMD(app_scheduler_test, 0,
+   "Run alarm scheduling speed test",
+   "test","scheduler","[<alarms>]");
+static int app_scheduler_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *count_arg;
+  if (cli_arg(parsed, "alarms", &count_arg, cli_uint, "10000") == -1)
+    return -1;
+  unsigned count = atoi(count_arg);
+  if (count == 0)
+    return WHY("Need at least one alarm");
+  struct profile_total stats = {.name = "scheduler_test"};
+  struct sched_ent *alarms = emalloc_zero(sizeof(struct sched_ent) * count);
+  if (!alarms)
+    return -1;
+  unsigned i;
+  for (i = 0; i < count; i++){
+    alarms[i].function = scheduler_test_alarm;
+    alarms[i].stats = &stats;
+    alarms[i].run_after = TIME_MS_NEVER_WILL;
+  }
+
+  // schedule every alarm well into the future, so none of them run
+  time_ms_t now = gettime_ms();
+  time_ms_t start = gettime_ms();
+  for (i = 0; i < count; i++){
+    time_ms_t when = now + 60000 + random() % 60000;
+    RESCHEDULE(&alarms[i], when, when, when + 1000);
+  }
+  time_ms_t end = gettime_ms();
+  cli_printf(context, "Schedule %u alarms: %.3fus per alarm\n", count, (end - start) * 1000.0 / count);
+
+  unsigned rounds = 10, r;
+  start = gettime_ms();
+  for (r = 0; r < rounds; r++){
+    for (i = 0; i < count; i++){
+      time_ms_t when = now + 60000 + random() % 60000;
+      RESCHEDULE(&alarms[i], when, when, when + 1000);
+    }
+  }
+  end = gettime_ms();
+  cli_printf(context, "Reschedule: %.3fus per alarm\n", (end - start) * 1000.0 / (count * rounds));
+
+  start = gettime_ms();
+  for (i = 0; i < count; i++)
+    unschedule(&alarms[i]);
+  end = gettime_ms();
+  cli_printf(context, "Unschedule: %.3fus per alarm\n", (end - start) * 1000.0 / count);
+
+  // now make every alarm due, and run them all
+  scheduler_test_calls = 0;
+  now = gettime_ms();
+  for (i = 0; i < count; i++){
+    time_ms_t when = now - random() % 1000;
+    RESCHEDULE(&alarms[i], when, when, now + 1000);
+  }
+  start = gettime_ms();
+  while (scheduler_test_calls < count && fd_poll())
+    ;
+  end = gettime_ms();
+  cli_printf(context, "Run %u alarms: %.3fus per alarm\n", scheduler_test_calls, (end - start) * 1000.0 / count);
+
+  for (i = 0; i < count; i++)
+    unschedule(&alarms[i]);
+  free(alarms);
+  return 0;
+}
+
+struct watch_test_pipe{
+  struct sched_ent alarm;
+  int write_fd;
+  // bytes written that have not been read yet
+  unsigned bytes;
+  char unwatched;
+};
+
+static struct watch_test_state{
+  // pipes with bytes left to read
+  unsigned pending;
+  unsigned bytes_read;
+  unsigned idle_calls;
+  unsigned unwatched_calls;
+  struct watch_test_pipe *victim;
+  char timed_out;
+} watch_test;
+
+static void watch_test_read(struct sched_ent *alarm)
+{
+  struct watch_test_pipe *p = alarm->context;
+  if (p->unwatched){
+    watch_test.unwatched_calls++;
+    return;
+  }
+  if (!p->bytes)
+    watch_test.idle_calls++;
+  // read one byte at a time, so the pipe is still readable when we return
+  char c;
+  if ((alarm->poll.revents & POLLIN) && read(alarm->poll.fd, &c, 1) == 1){
+    watch_test.bytes_read++;
+    if (p->bytes && --p->bytes == 0)
+      watch_test.pending--;
+  }
+  // the first callback stops watching another ready pipe, which must not be called again
+  if (watch_test.victim && watch_test.victim != p){
+    struct watch_test_pipe *victim = watch_test.victim;
+    watch_test.victim = NULL;
+    unwatch(&victim->alarm);
+    victim->unwatched = 1;
+    if (victim->bytes)
+      watch_test.pending--;
+  }
+}
+
+static void watch_test_timeout(struct sched_ent *UNUSED(alarm))
+{
+  watch_test.timed_out = 1;
+}
+
+DEFINE_CMD(app_watch_test, 0,
+   "Test and time the dispatch of file handle events",
+   "test","watch","[--poll]","[<pipes>]");
+static int app_watch_test(const struct cli_parsed *parsed, struct cli_context *context)
+{
+  const char *count_arg;
+  if (cli_arg(parsed, "pipes", &count_arg, cli_uint, "64") == -1)
+    return -1;
+  unsigned count = atoi(count_arg);
+  if (count < 4 || count > 100)
+    return WHY("Need between 4 and 100 pipes");
+  if (cli_arg(parsed, "--poll", NULL, NULL, NULL) == 0)
+    fd_disable_epoll();
+  cli_printf(context, "Method: %s\n", fd_poll_method());
+
+  struct profile_total stats = {.name = "watch_test"};
+  struct watch_test_pipe *pipes = emalloc_zero(sizeof(struct watch_test_pipe) * count);
+  if (!pipes)
+    return -1;
+  int ret = -1;
+  unsigned i, opened = 0;
+  bzero(&watch_test, sizeof watch_test);
+  struct sched_ent timeout = STRUCT_SCHED_ENT_UNUSED;
+  timeout.function = watch_test_timeout;
+  timeout.stats = &stats;
+
+  for (opened = 0; opened < count; opened++){
+    struct watch_test_pipe *p = &pipes[opened];
+    int fds[2];
+    if (pipe(fds) == -1){
+      WHY_perror("pipe");
+      goto end;
+    }
+    p->alarm = timeout;
+    p->alarm.function = watch_test_read;
+    p->alarm.context = p;
+    p->alarm.poll.fd = fds[0];
+    p->alarm.poll.events = POLLIN;
+    p->write_fd = fds[1];
+    if (watch(&p->alarm) == -1){
+      close(fds[0]);
+      close(fds[1]);
+      goto end;
+    }
+  }
+
+  // every second pipe has something to read, the rest are idle
+  for (i = 0; i < count; i += 2){
+    if (write(pipes[i].write_fd, "abc", 3) != 3){
+      WHY_perror("write");
+      goto end;
+    }
+    pipes[i].bytes = 3;
+    watch_test.pending++;
+  }
+  watch_test.victim = &pipes[2];
+
+  time_ms_t start = gettime_ms();
+  RESCHEDULE(&timeout, start + 5000, start + 5000, start + 5000);
+  while (watch_test.pending && !watch_test.timed_out && fd_poll())
+    ;
+  time_ms_t end = gettime_ms();
+  unschedule(&timeout);
+
+  cli_printf(context, "Read %u bytes from %u pipes in %"PRId64"ms\n", watch_test.bytes_read, count, end - start);
+  cli_printf(context, "Unread pipes: %u\n", watch_test.pending);
+  cli_printf(context, "Idle calls: %u\n", watch_test.idle_calls);
+  cli_printf(context, "Unwatched calls: %u\n", watch_test.unwatched_calls);
+  ret = 0;
+
+end:
+  for (i = 0; i < opened; i++){
+    if (!pipes[i].unwatched)
+      unwatch(&pipes[i].alarm);
+    close(pipes[i].alarm.poll.fd);
+    close(pipes[i].write_fd);
+  }
+  free(pipes);
+  return ret;
+}
+
 void context_switch_test(int);
 DEFINE_CMD(app_mem_test, 0,
    "Run memory speed test",
@@ -0,0 +1,105 @@
+/*
+Serval DNA event tracing
+Copyright (C) 2016 Flinders University
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <sys/time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "trace.h"
+#include "mem.h"
+#include "conf.h"
+#include "debug.h"
+#include "strbuf_helpers.h"
+
+__thread struct trace_buffer *trace_buffer = NULL;
+static __thread struct trace_buffer trace_ring;
+
+void trace_configure(int enable, unsigned capacity)
+{
+  if (enable && trace_ring.events && trace_ring.capacity == capacity){
+    trace_buffer = &trace_ring;
+    return;
+  }
+  trace_buffer = NULL;
+  if (trace_ring.events){
+    free(trace_ring.events);
+    trace_ring.events = NULL;
+  }
+  trace_ring.capacity = 0;
+  trace_ring.count = 0;
+  // any export in progress refers to the old ring, so ends early
+  trace_ring.generation++;
+  if (!enable)
+    return;
+  if ((trace_ring.events = emalloc(sizeof(struct trace_event) * capacity)) == NULL)
+    return;
+  trace_ring.capacity = capacity;
+  trace_buffer = &trace_ring;
+  DEBUGF(verbose, "Tracing the last %u events", capacity);
+}
+
+void _trace_event(char phase, const char *category, const char *name)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  struct trace_event *event = &trace_buffer->events[trace_buffer->count++ % trace_buffer->capacity];
+  event->time_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  event->category = category;
+  event->name = name;
+  event->phase = phase;
+}
+
+// Only events that were recorded before the export started are written
+void trace_cursor_start(struct trace_cursor *cursor)
+{
+  cursor->started = 0;
+  cursor->generation = trace_ring.generation;
+  cursor->end = trace_ring.count;
+  cursor->next = trace_ring.count > trace_ring.capacity ? trace_ring.count - trace_ring.capacity : 0;
+}
+
+// Write the next event(s) of a Chrome trace event format document, returns 0 after the last chunk
+int trace_json_chunk(strbuf b, struct trace_cursor *cursor)
+{
+  if (!cursor->started){
+    strbuf_puts(b, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    if (!strbuf_overrun(b))
+      cursor->started = 1;
+    return 1;
+  }
+  // skip any events that were overwritten while we were writing
+  if (trace_ring.count > trace_ring.capacity && cursor->next < trace_ring.count - trace_ring.capacity)
+    cursor->next = trace_ring.count - trace_ring.capacity;
+  if (cursor->generation != trace_ring.generation || cursor->next >= cursor->end || !trace_ring.capacity){
+    strbuf_puts(b, "\n]}\n");
+    return 0;
+  }
+  const struct trace_event *event = &trace_ring.events[cursor->next % trace_ring.capacity];
+  if (cursor->started == 2)
+    strbuf_putc(b, ',');
+  strbuf_puts(b, "\n{\"name\":");
+  strbuf_json_string(b, event->name);
+  strbuf_puts(b, ",\"cat\":");
+  strbuf_json_string(b, event->category);
+  strbuf_sprintf(b, ",\"ph\":\"%c\",\"ts\":%"PRIu64",\"pid\":%d,\"tid\":0}", event->phase, event->time_us, getpid());
+  if (!strbuf_overrun(b)){
+    cursor->started = 2;
+    cursor->next++;
+  }
+  return 1;
+}
@@ -0,0 +1,64 @@
+/*
+Serval DNA event tracing
+Copyright (C) 2016 Flinders University
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __SERVAL_DNA__TRACE_H
+#define __SERVAL_DNA__TRACE_H
+
+#include <stdint.h>
+#include "strbuf.h"
+
+/* A bounded ring of begin/end events, in the phase letters used by the Chrome
+ * trace event format. Category and name strings are never copied, so they must
+ * be static.
+ */
+struct trace_event {
+  uint64_t time_us;
+  const char *category;
+  const char *name;
+  char phase;
+};
+
+struct trace_buffer {
+  struct trace_event *events;
+  unsigned capacity;
+  uint64_t count; // total number of events ever recorded
+  unsigned generation; // incremented whenever the ring is discarded
+};
+
+// NULL whenever tracing is disabled
+extern __thread struct trace_buffer *trace_buffer;
+
+void trace_configure(int enable, unsigned capacity);
+void _trace_event(char phase, const char *category, const char *name);
+
+#define TRACE_BEGIN(CATEGORY, NAME) do { if (trace_buffer) _trace_event('B', (CATEGORY), (NAME)); } while (0)
+#define TRACE_END(CATEGORY, NAME) do { if (trace_buffer) _trace_event('E', (CATEGORY), (NAME)); } while (0)
+
+// Position of an export in progress, so that the trace can be written in chunks
+struct trace_cursor {
+  uint8_t started; // 1 after the header, 2 after the first event
+  uint64_t next;
+  uint64_t end;
+  unsigned generation; // of the ring that next and end refer to
+};
+
+void trace_cursor_start(struct trace_cursor *cursor);
+int trace_json_chunk(strbuf b, struct trace_cursor *cursor);
+
+#endif // __SERVAL_DNA__TRACE_H